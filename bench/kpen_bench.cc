@@ -0,0 +1,379 @@
+// kpen_bench — micro-benchmarks for the rasterizers, flood fill, undo history,
+// the mip filter and image codecs. Draws with an SDL software renderer; no window is opened.
+//
+//   kpen_bench [--filter TEXT] [--min-time MS] [--json FILE|-]
+//              [--baseline FILE] [--threshold PCT]
+//
+// Each benchmark is timed in five batches and the median ns/op is reported.
+// With --baseline, results are compared against a previous --json file and the
+// exit status is 1 if any benchmark is slower by more than --threshold percent.
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include "DrawingUtils.h"
+#include "PerfStats.h"
+#include "Trace.h"
+#include "UndoManager.h"
+
+namespace {
+
+struct Result {
+    std::string name;
+    double nsPerOp = 0;
+    long long iterations = 0;
+};
+
+struct Config {
+    std::string filter;
+    double minTimeMs = 200;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedNs(Clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+// Calibrate an iteration count so one batch takes ~minTime/5, then time five
+// batches and keep the median.
+Result measure(const Config& cfg, const std::string& name, const std::function<void()>& op) {
+    const double batchNs = cfg.minTimeMs * 1e6 / 5;
+    long long n = 1;
+    for (;;) {
+        auto t = Clock::now();
+        for (long long i = 0; i < n; i++) op();
+        double ns = elapsedNs(t);
+        if (ns >= batchNs || n >= (1LL << 30)) break;
+        n = ns < batchNs / 100 ? n * 10 : std::max(n + 1, (long long)(n * batchNs / std::max(ns, 1.0)));
+    }
+    std::vector<double> perOp;
+    for (int b = 0; b < 5; b++) {
+        auto t = Clock::now();
+        for (long long i = 0; i < n; i++) op();
+        perOp.push_back(elapsedNs(t) / n);
+    }
+    return { name, PerfStats::percentile(perOp, 0.5), n * 5 };
+}
+
+bool wanted(const Config& cfg, const std::string& name) {
+    return cfg.filter.empty() || name.find(cfg.filter) != std::string::npos;
+}
+
+// Deterministic xorshift so patterns and images are identical between runs.
+struct Rng {
+    uint32_t s = 0x9E3779B9u;
+    uint32_t next() { s ^= s << 13; s ^= s >> 17; s ^= s << 5; return s; }
+};
+
+// ── Rasterizers ───────────────────────────────────────────────────────────────
+
+void benchRasterizers(const Config& cfg, std::vector<Result>& out) {
+    const int W = 1024, H = 1024;
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, W, H, 32, SDL_PIXELFORMAT_ARGB8888);
+    SDL_Renderer* r = surface ? SDL_CreateSoftwareRenderer(surface) : nullptr;
+    if (!r) {
+        fprintf(stderr, "kpen_bench: no software renderer (%s); skipping rasterizers\n", SDL_GetError());
+        if (surface) SDL_FreeSurface(surface);
+        return;
+    }
+    SDL_SetRenderDrawBlendMode(r, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(r, 20, 40, 200, 255);
+    const SDL_Color color = { 20, 40, 200, 255 };
+
+    for (int bs : { 1, 2, 4, 8, 16, 32, 64 }) {
+        std::string sz = "/size=" + std::to_string(bs);
+        if (wanted(cfg, "drawLine" + sz))
+            out.push_back(measure(cfg, "drawLine" + sz, [&] {
+                DrawingUtils::drawLine(r, 100, 120, 900, 700, bs, W, H);
+            }));
+        if (wanted(cfg, "drawSquareLine" + sz))
+            out.push_back(measure(cfg, "drawSquareLine" + sz, [&] {
+                DrawingUtils::drawSquareLine(r, 100, 120, 900, 700, bs, W, H, color);
+            }));
+        if (wanted(cfg, "drawOval" + sz))
+            out.push_back(measure(cfg, "drawOval" + sz, [&] {
+                DrawingUtils::drawOval(r, 112, 212, 911, 811, bs, W, H);
+            }));
+    }
+    for (int d : { 16, 64, 256, 800 }) {
+        std::string name = "drawFilledOval/diameter=" + std::to_string(d);
+        if (wanted(cfg, name))
+            out.push_back(measure(cfg, name, [&] {
+                DrawingUtils::drawFilledOval(r, 100, 100, 100 + d - 1, 100 + d - 1, W, H);
+            }));
+    }
+    SDL_DestroyRenderer(r);
+    SDL_FreeSurface(surface);
+}
+
+// ── Flood fill ────────────────────────────────────────────────────────────────
+
+// Each op refills the same region, alternating between two colors, so no
+// per-iteration reset is needed.
+void benchFloodFill(const Config& cfg, std::vector<Result>& out) {
+    const int W = 1024, H = 1024;
+    const uint32_t A = 0xFFFFFFFFu, B = 0xFF3366CCu, WALL = 0xFF000000u;
+
+    struct Pattern { const char* name; std::function<void(std::vector<uint32_t>&)> make; };
+    std::vector<Pattern> patterns = {
+        { "open",   [&](std::vector<uint32_t>& p) { std::fill(p.begin(), p.end(), A); } },
+        // Vertical walls with gaps at alternating ends: one long winding corridor.
+        { "serpentine", [&](std::vector<uint32_t>& p) {
+            std::fill(p.begin(), p.end(), A);
+            for (int x = 2; x < W; x += 3) {
+                bool gapTop = (x / 3) % 2;
+                for (int y = 0; y < H; y++)
+                    if (gapTop ? y > 0 : y < H - 1) p[(size_t)y * W + x] = WALL;
+            }
+        } },
+        // ~40% random walls: irregular region with many dead ends.
+        { "noise",  [&](std::vector<uint32_t>& p) {
+            Rng rng;
+            for (auto& px : p) px = (rng.next() % 100 < 40) ? WALL : A;
+            p[(size_t)(H / 2) * W + W / 2] = A;
+        } },
+    };
+    for (auto& pat : patterns) {
+        std::string name = std::string("floodFill/") + pat.name + "/1024";
+        if (!wanted(cfg, name)) continue;
+        std::vector<uint32_t> pixels((size_t)W * H);
+        pat.make(pixels);
+        bool toB = true;
+        out.push_back(measure(cfg, name, [&] {
+            DrawingUtils::floodFill(pixels.data(), W, H, W / 2, H / 2, toB ? B : A);
+            toB = !toB;
+        }));
+    }
+}
+
+// ── Mip filter ────────────────────────────────────────────────────────────────
+
+// One level of a 1024x1024 tile: all opaque (the SSE2 path) and with scattered
+// transparency (the alpha-weighted scalar path).
+void benchMips(const Config& cfg, std::vector<Result>& out) {
+    const int W = 1024, H = 1024;
+    Rng rng;
+    std::vector<uint32_t> opaque(static_cast<size_t>(W) * H), mixed(opaque.size());
+    for (size_t i = 0; i < opaque.size(); i++) {
+        opaque[i] = 0xFF000000u | (rng.next() & 0xFFFFFF);
+        mixed[i]  = (rng.next() & 7) ? opaque[i] : (opaque[i] & 0x00FFFFFFu);
+    }
+    std::vector<uint32_t> dst(static_cast<size_t>(W / 2) * (H / 2));
+    if (wanted(cfg, "downsample2x/opaque/1024"))
+        out.push_back(measure(cfg, "downsample2x/opaque/1024", [&] {
+            DrawingUtils::downsample2x(opaque.data(), W, H, W * 4, dst.data(), W / 2 * 4);
+        }));
+    if (wanted(cfg, "downsample2x/alpha/1024"))
+        out.push_back(measure(cfg, "downsample2x/alpha/1024", [&] {
+            DrawingUtils::downsample2x(mixed.data(), W, H, W * 4, dst.data(), W / 2 * 4);
+        }));
+}
+
+// ── Undo history ──────────────────────────────────────────────────────────────
+
+// Push a history of small brush-sized edits on a default-size canvas, then
+// undo and redo all of it the way kPen::undo/redo drive UndoManager. The same
+// edits are also pushed as regions, the way saveState snapshots a stroke.
+void benchUndo(const Config& cfg, std::vector<Result>& out) {
+    const int W = 1200, H = 800, STEPS = 200, PATCH = 48;
+    const char* names[4] = { "undo/push/1200x800", "undo/undo/1200x800", "undo/redo/1200x800",
+                             "undo/push-region/1200x800" };
+    bool any = false;
+    for (auto* n : names) any = any || wanted(cfg, n);
+    if (!any) return;
+
+    std::vector<double> samples[4];
+    auto start = Clock::now();
+    int rounds = 0;
+    while (rounds < 3 || (elapsedNs(start) < cfg.minTimeMs * 1e6 && rounds < 50)) {
+        UndoManager um, umRegion;
+        std::vector<uint32_t> canvas((size_t)W * H, 0);
+        std::vector<uint32_t> patch((size_t)PATCH * PATCH);
+        Rng rng;
+        um.pushUndo(W, H, canvas);
+        umRegion.pushUndo(W, H, canvas);
+
+        double pushNs = 0, regionNs = 0;
+        for (int s = 0; s < STEPS; s++) {
+            int x0 = rng.next() % (W - PATCH), y0 = rng.next() % (H - PATCH);
+            uint32_t c = rng.next() | 0xFF000000u;
+            for (int y = y0; y < y0 + PATCH; y++)
+                std::fill_n(canvas.begin() + (size_t)y * W + x0, PATCH, c);
+            std::fill(patch.begin(), patch.end(), c);
+            auto t = Clock::now();
+            um.pushUndo(W, H, canvas);
+            pushNs += elapsedNs(t);
+            t = Clock::now();
+            umRegion.pushUndoRegion(W, H, x0, y0, PATCH, PATCH, patch.data());
+            regionNs += elapsedNs(t);
+        }
+        samples[0].push_back(pushNs / STEPS);
+        samples[3].push_back(regionNs / STEPS);
+
+        auto t = Clock::now();
+        for (int s = 0; s < STEPS; s++) um.undo();
+        samples[1].push_back(elapsedNs(t) / STEPS);
+
+        t = Clock::now();
+        for (int s = 0; s < STEPS; s++) um.redo();
+        samples[2].push_back(elapsedNs(t) / STEPS);
+        rounds++;
+    }
+    for (int i = 0; i < 4; i++)
+        if (wanted(cfg, names[i]))
+            out.push_back({ names[i], PerfStats::percentile(samples[i], 0.5), (long long)rounds * STEPS });
+}
+
+// ── Codecs ────────────────────────────────────────────────────────────────────
+
+// Something like a drawing: smooth gradient background, hard-edged shapes and
+// a little noise, fully opaque.
+std::vector<uint32_t> syntheticImage(int w, int h) {
+    std::vector<uint32_t> p((size_t)w * h);
+    Rng rng;
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++) {
+            uint32_t r = x * 255 / w, g = y * 255 / h, b = 128;
+            if (((x / 64) + (y / 64)) % 5 == 0) { r = 240; g = 200; b = 20; }
+            uint32_t n = rng.next() & 7;
+            p[(size_t)y * w + x] = 0xFF000000u | (std::min(255u, r + n) << 16) | (g << 8) | b;
+        }
+    return p;
+}
+
+void benchCodecs(const Config& cfg, std::vector<Result>& out) {
+    for (int side : { 256, 1024, 2048 }) {
+        std::string res = "/" + std::to_string(side) + "x" + std::to_string(side);
+        std::vector<uint32_t> img = syntheticImage(side, side);
+        std::vector<uint8_t> png, jpg;
+        if (wanted(cfg, "encodePNG" + res) || wanted(cfg, "decodePNG" + res))
+            png = DrawingUtils::encodePNG(img.data(), side, side);
+        if (wanted(cfg, "encodeJPEG" + res) || wanted(cfg, "decodeJPEG" + res))
+            jpg = DrawingUtils::encodeJPEG(img.data(), side, side, 92);
+
+        if (wanted(cfg, "encodePNG" + res))
+            out.push_back(measure(cfg, "encodePNG" + res, [&] {
+                DrawingUtils::encodePNG(img.data(), side, side);
+            }));
+        if (wanted(cfg, "decodePNG" + res))
+            out.push_back(measure(cfg, "decodePNG" + res, [&] {
+                int w, h;
+                DrawingUtils::decodeImage(png.data(), (int)png.size(), w, h);
+            }));
+        if (wanted(cfg, "encodeJPEG" + res))
+            out.push_back(measure(cfg, "encodeJPEG" + res, [&] {
+                DrawingUtils::encodeJPEG(img.data(), side, side, 92);
+            }));
+        if (wanted(cfg, "decodeJPEG" + res))
+            out.push_back(measure(cfg, "decodeJPEG" + res, [&] {
+                int w, h;
+                DrawingUtils::decodeImage(jpg.data(), (int)jpg.size(), w, h);
+            }));
+    }
+}
+
+// ── Output / baseline ─────────────────────────────────────────────────────────
+
+// One benchmark per line so the baseline can be read back without a JSON library.
+bool writeJson(const std::string& path, const std::vector<Result>& results) {
+    FILE* f = path == "-" ? stdout : fopen(path.c_str(), "w");
+    if (!f) return false;
+    fprintf(f, "{\n  \"kpen_bench\": 1,\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++)
+        fprintf(f, "    {\"name\": \"%s\", \"ns_per_op\": %.1f, \"iterations\": %lld}%s\n",
+                results[i].name.c_str(), results[i].nsPerOp, results[i].iterations,
+                i + 1 < results.size() ? "," : "");
+    fprintf(f, "  ]\n}\n");
+    return f == stdout || fclose(f) == 0;
+}
+
+bool readBaseline(const std::string& path, std::map<std::string, double>& out) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) return false;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        const char* n = strstr(line, "\"name\": \"");
+        const char* v = strstr(line, "\"ns_per_op\": ");
+        if (!n || !v) continue;
+        n += 9;
+        const char* end = strchr(n, '"');
+        if (!end) continue;
+        out[std::string(n, end)] = atof(v + 13);
+    }
+    fclose(f);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+#ifdef KPEN_ENABLE_TRACING
+    Trace::dumpAtExitFromEnv();
+#endif
+    Config cfg;
+    std::string jsonPath, baselinePath;
+    double threshold = 10.0;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        bool hasValue = i + 1 < argc;
+        if      (a == "--filter" && hasValue)    cfg.filter = argv[++i];
+        else if (a == "--min-time" && hasValue)  cfg.minTimeMs = std::max(1.0, atof(argv[++i]));
+        else if (a == "--json" && hasValue)      jsonPath = argv[++i];
+        else if (a == "--baseline" && hasValue)  baselinePath = argv[++i];
+        else if (a == "--threshold" && hasValue) threshold = atof(argv[++i]);
+        else {
+            fprintf(stderr, "usage: kpen_bench [--filter TEXT] [--min-time MS] [--json FILE|-]\n"
+                            "                  [--baseline FILE] [--threshold PCT]\n");
+            return 2;
+        }
+    }
+
+    std::vector<Result> results;
+    benchRasterizers(cfg, results);
+    benchFloodFill(cfg, results);
+    benchUndo(cfg, results);
+    benchMips(cfg, results);
+    benchCodecs(cfg, results);
+
+    // Human-readable table on stderr when JSON goes to stdout, otherwise stdout.
+    FILE* table = jsonPath == "-" ? stderr : stdout;
+    for (auto& r : results)
+        fprintf(table, "%-36s %14.1f ns/op  %10lld iters\n", r.name.c_str(), r.nsPerOp, r.iterations);
+
+    if (!jsonPath.empty() && !writeJson(jsonPath, results)) {
+        fprintf(stderr, "kpen_bench: could not write %s\n", jsonPath.c_str());
+        return 2;
+    }
+
+    if (baselinePath.empty()) return 0;
+    std::map<std::string, double> base;
+    if (!readBaseline(baselinePath, base)) {
+        fprintf(stderr, "kpen_bench: could not read baseline %s\n", baselinePath.c_str());
+        return 2;
+    }
+    int regressions = 0;
+    for (auto& r : results) {
+        auto it = base.find(r.name);
+        if (it == base.end() || it->second <= 0) continue;
+        double change = (r.nsPerOp / it->second - 1.0) * 100.0;
+        if (change > threshold) {
+            regressions++;
+            fprintf(table, "REGRESSION %-25s %12.1f -> %12.1f ns/op (%+.1f%%)\n",
+                    r.name.c_str(), it->second, r.nsPerOp, change);
+        } else if (change < -threshold) {
+            fprintf(table, "improved   %-25s %12.1f -> %12.1f ns/op (%+.1f%%)\n",
+                    r.name.c_str(), it->second, r.nsPerOp, change);
+        }
+    }
+    fprintf(table, "%d regression%s over %.0f%% against %s\n",
+            regressions, regressions == 1 ? "" : "s", threshold, baselinePath.c_str());
+    return regressions ? 1 : 0;
+}
@@ -1,4 +1,5 @@
 #include "CanvasResizer.h"
+#include "TiledCanvas.h"
 #include "Tools.h"
 #include <algorithm>
 #include <cmath>
@@ -149,8 +150,8 @@ void CanvasResizer::compute(int winX, int winY,
         }
     }
 
-    newW = std::max(1, std::min(16384, newW));
-    newH = std::max(1, std::min(16384, newH));
+    newW = std::max(1, std::min(TiledCanvas::MAX_SIDE, newW));
+    newH = std::max(1, std::min(TiledCanvas::MAX_SIDE, newH));
     originX = std::max(-(newW - 1), std::min(dragBaseW - 1, originX));
     originY = std::max(-(newH - 1), std::min(dragBaseH - 1, originY));
 }
@@ -7,11 +7,26 @@
 #include <algorithm>
 #include <cstdlib>
 #include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <queue>
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define KPEN_SSE2 1
+#endif
 
 #include "DrawingUtils.h"
+#include "JpegEncoder.h"
+#include "MappedFile.h"
+#include "TiledCanvas.h"
+#include "Trace.h"
 #include "stb/stb_image.h"
 #include "stb/stb_image_write.h"
 
+// Defined in the stb_image_write implementation but not declared by its header.
+extern "C" unsigned char* stbi_zlib_compress(unsigned char* data, int data_len, int* out_len, int quality);
+
 #if defined(__APPLE__)
   #include <TargetConditionals.h>
   #if TARGET_OS_MAC
@@ -45,17 +60,20 @@ namespace DrawingUtils {
 
     void drawFillCircle(SDL_Renderer* renderer, int centerX, int centerY, int radius) {
         if (radius <= 0) {
-            SDL_RenderDrawPoint(renderer, centerX, centerY);
+            renderPoint(renderer, centerX, centerY);
             return;
         }
         for (int h = -radius; h <= radius; h++) {
             int half = (int)std::sqrt((float)(radius * radius - h * h));
-            SDL_RenderDrawLine(renderer, centerX - half, centerY + h, centerX + half, centerY + h);
+            renderLine(renderer, centerX - half, centerY + h, centerX + half, centerY + h);
         }
     }
 
+    // Rows are only walked between rowMin and rowMax, the rows touched since
+    // prepare, so a stroke costs the same on a tall canvas as on a small one.
     struct SpanBuffer {
         int canvasW, canvasH;
+        int rowMin = 0, rowMax = -1;
         std::vector<std::vector<std::pair<int,int>>> spans;
         static constexpr int RESERVE_PER_ROW = 12;
 
@@ -67,14 +85,13 @@ namespace DrawingUtils {
         }
 
         void prepare(int w, int h) {
+            for (int row = rowMin; row <= rowMax && row < (int)spans.size(); row++)
+                spans[row].clear();
             canvasW = w;
             canvasH = h;
+            rowMin = h;
+            rowMax = -1;
             spans.resize(h);
-            for (auto& row : spans) {
-                row.clear();
-                if (row.capacity() < static_cast<size_t>(RESERVE_PER_ROW))
-                    row.reserve(RESERVE_PER_ROW);
-            }
         }
 
         void addCircle(int cx, int cy, int radius) {
@@ -86,7 +103,12 @@ namespace DrawingUtils {
                 int half = (radicand <= 0) ? 0 : isqrt(radicand);
                 int x0 = std::max(0, cx - half);
                 int x1 = std::min(canvasW - 1, cx + half);
-                spans[row].push_back({x0, x1});
+                auto& segs = spans[row];
+                if (segs.capacity() < static_cast<size_t>(RESERVE_PER_ROW))
+                    segs.reserve(RESERVE_PER_ROW);
+                segs.push_back({x0, x1});
+                rowMin = std::min(rowMin, row);
+                rowMax = std::max(rowMax, row);
             }
         }
         void addBrush(int cx, int cy, int size) {
@@ -103,11 +125,11 @@ namespace DrawingUtils {
         }
 
         void flush(SDL_Renderer* renderer) {
-            for (int row = 0; row < canvasH; row++) {
+            for (int row = rowMin; row <= rowMax; row++) {
                 auto& segs = spans[row];
                 if (segs.empty()) continue;
                 if (segs.size() == 1) {
-                    SDL_RenderDrawLine(renderer, segs[0].first, row, segs[0].second, row);
+                    renderLine(renderer, segs[0].first, row, segs[0].second, row);
                     continue;
                 }
                 std::sort(segs.begin(), segs.end());
@@ -119,14 +141,16 @@ namespace DrawingUtils {
                         segs[++n] = segs[i];
                 }
                 for (int i = 0; i <= n; i++)
-                    SDL_RenderDrawLine(renderer, segs[i].first, row, segs[i].second, row);
+                    renderLine(renderer, segs[i].first, row, segs[i].second, row);
             }
         }
     };
 
     void drawLine(SDL_Renderer* renderer, int x1, int y1, int x2, int y2, int size, int w, int h) {
-        if (size <= 1) { SDL_RenderDrawLine(renderer, x1, y1, x2, y2); return; }
-        static SpanBuffer buf;
+        if (size <= 1) { renderLine(renderer, x1, y1, x2, y2); return; }
+        // Per thread: headless run plays scripts on a worker pool, and undo
+        // replays strokes off the main thread.
+        static thread_local SpanBuffer buf;
         buf.prepare(w, h);
         int dx = std::abs(x2 - x1), dy = std::abs(y2 - y1);
         int sx = (x1 < x2) ? 1 : -1, sy = (y1 < y2) ? 1 : -1;
@@ -141,6 +165,26 @@ namespace DrawingUtils {
         buf.flush(renderer);
     }
 
+    // Round brushes reach size/2 past the centre line (one more on the +x/+y
+    // side for even sizes); square stamps reach the same distance.
+    SDL_Rect strokeBounds(int x0, int y0, int x1, int y1, int size, int cw, int ch) {
+        int reach = std::max(1, size) / 2 + 1;
+        int left   = std::max(0, std::min(x0, x1) - reach);
+        int top    = std::max(0, std::min(y0, y1) - reach);
+        int right  = std::min(cw - 1, std::max(x0, x1) + reach);
+        int bottom = std::min(ch - 1, std::max(y0, y1) + reach);
+        if (right < left || bottom < top) return { 0, 0, 0, 0 };
+        return { left, top, right - left + 1, bottom - top + 1 };
+    }
+
+    SDL_Rect unionRect(const SDL_Rect& a, const SDL_Rect& b) {
+        if (a.w <= 0 || a.h <= 0) return b;
+        if (b.w <= 0 || b.h <= 0) return a;
+        int x0 = std::min(a.x, b.x), y0 = std::min(a.y, b.y);
+        int x1 = std::max(a.x + a.w, b.x + b.w), y1 = std::max(a.y + a.h, b.y + b.h);
+        return { x0, y0, x1 - x0, y1 - y0 };
+    }
+
     void drawSquareStamp(SDL_Renderer* r, int cx, int cy, int brushSize, int cw, int ch, SDL_Color color) {
         int half = brushSize / 2;
         int x0 = std::max(0, cx - half);
@@ -156,7 +200,7 @@ namespace DrawingUtils {
             SDL_SetRenderDrawColor(r, color.r, color.g, color.b, 255);
         }
         SDL_Rect sq = { x0, y0, x1 - x0 + 1, y1 - y0 + 1 };
-        SDL_RenderFillRect(r, &sq);
+        renderFillRect(r, &sq);
         if (color.a == 0) SDL_SetRenderDrawBlendMode(r, SDL_BLENDMODE_BLEND);
     }
 
@@ -179,7 +223,7 @@ namespace DrawingUtils {
             int py1 = std::min(ch - 1, y0 - half + brushSize - 1);
             if (px1 >= px0 && py1 >= py0) {
                 SDL_Rect sq = { px0, py0, px1 - px0 + 1, py1 - py0 + 1 };
-                SDL_RenderFillRect(r, &sq);
+                renderFillRect(r, &sq);
             }
             if (x0 == x1 && y0 == y1) break;
             int e2 = 2 * err;
@@ -204,7 +248,7 @@ namespace DrawingUtils {
             int cx1 = std::min(w, fx + fw), cy1 = std::min(h, fy + fh);
             if (cx1 > cx0 && cy1 > cy0) {
                 SDL_Rect r = { cx0, cy0, cx1 - cx0, cy1 - cy0 };
-                SDL_RenderFillRect(renderer, &r);
+                renderFillRect(renderer, &r);
             }
         };
 
@@ -224,7 +268,7 @@ namespace DrawingUtils {
         int cx = (left+right)/2, cy = (top+bottom)/2;
         int rx = cx-left, ry = cy-top;
         long rx2 = (long)rx*rx, ry2 = (long)ry*ry;
-        static SpanBuffer buf;
+        static thread_local SpanBuffer buf;  // per thread, as in drawLine
         buf.prepare(w, h);
         auto plot = [&](SpanBuffer& spans, int x, int y) {
             auto clampX = [&](int px){ return std::max(left, std::min(right, px)); };
@@ -297,7 +341,7 @@ namespace DrawingUtils {
         clipped.w = x2 - clipped.x;
         clipped.h = y2 - clipped.y;
         if (clipped.w > 0 && clipped.h > 0)
-            SDL_RenderFillRect(renderer, &clipped);
+            renderFillRect(renderer, &clipped);
     }
 
     void drawFilledOval(SDL_Renderer* renderer, int x0, int y0, int x1, int y1, int w, int h) {
@@ -338,7 +382,7 @@ namespace DrawingUtils {
             int lx = std::max(0, rowL[row]);
             int rx2c = std::min(w-1, rowR[row]);
             if (lx <= rx2c)
-                SDL_RenderDrawLine(renderer, lx, py, rx2c, py);
+                renderLine(renderer, lx, py, rx2c, py);
         }
     }
 
@@ -392,9 +436,180 @@ namespace DrawingUtils {
         }
     }
 
+    // 5x7 font: 7 rows per char, 5 LSBs per row (row-major).
+    // Index 0=space, 1-26=A-Z, 27-36=0-9, 37=comma, 38=period, 39=colon, 40=minus, 41=plus.
+    static const uint8_t FONT_5X7[42][7] = {
+        { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // space
+        { 0x04, 0x0A, 0x11, 0x11, 0x1F, 0x11, 0x11 }, // A
+        { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E }, // B
+        { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E }, // C
+        { 0x1E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x1E }, // D
+        { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F }, // E
+        { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 }, // F
+        { 0x0E, 0x11, 0x10, 0x13, 0x11, 0x11, 0x0F }, // G
+        { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 }, // H
+        { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E }, // I
+        { 0x01, 0x01, 0x01, 0x01, 0x11, 0x11, 0x0E }, // J
+        { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 }, // K
+        { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F }, // L
+        { 0x11, 0x1B, 0x15, 0x11, 0x11, 0x11, 0x11 }, // M
+        { 0x11, 0x19, 0x15, 0x13, 0x11, 0x11, 0x11 }, // N
+        { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, // O
+        { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 }, // P
+        { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D }, // Q
+        { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 }, // R
+        { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x11, 0x1E }, // S
+        { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 }, // T
+        { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, // U
+        { 0x11, 0x11, 0x11, 0x0A, 0x0A, 0x04, 0x04 }, // V
+        { 0x11, 0x11, 0x11, 0x15, 0x15, 0x1B, 0x11 }, // W
+        { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 }, // X
+        { 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04, 0x04 }, // Y
+        { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F }, // Z
+        // 27-36: 0-9
+        { 0x1F, 0x11, 0x11, 0x11, 0x11, 0x11, 0x1F }, // 0
+        { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x1F }, // 1
+        { 0x1F, 0x01, 0x01, 0x1F, 0x10, 0x10, 0x1F }, // 2
+        { 0x1F, 0x01, 0x01, 0x0F, 0x01, 0x01, 0x1F }, // 3
+        { 0x11, 0x11, 0x11, 0x1F, 0x01, 0x01, 0x01 }, // 4
+        { 0x1F, 0x10, 0x10, 0x1F, 0x01, 0x01, 0x1F }, // 5
+        { 0x1F, 0x10, 0x10, 0x1F, 0x11, 0x11, 0x1F }, // 6
+        { 0x1F, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01 }, // 7
+        { 0x1F, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x1F }, // 8
+        { 0x1F, 0x11, 0x11, 0x1F, 0x01, 0x01, 0x1F }, // 9
+        { 0x00, 0x00, 0x00, 0x00, 0x04, 0x04, 0x08 }, // comma (37)
+        { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C }, // period
+        { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 }, // colon
+        { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 }, // minus
+        { 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00 }, // plus
+    };
+
+    void drawText(SDL_Renderer* r, int x, int y, const char* s, int scale) {
+        const int charW = 5 * scale + 2;
+        int cx = x;
+        for (; *s; s++) {
+            char c = *s;
+            int gi = 0;
+            if (c >= 'A' && c <= 'Z') gi = 1 + (c - 'A');
+            else if (c >= 'a' && c <= 'z') gi = 1 + (c - 'a');
+            else if (c >= '0' && c <= '9') gi = 27 + (c - '0');
+            else if (c == ',') gi = 37;
+            else if (c == '.') gi = 38;
+            else if (c == ':') gi = 39;
+            else if (c == '-') gi = 40;
+            else if (c == '+') gi = 41;
+            const uint8_t* rows = FONT_5X7[gi];
+            for (int row = 0; row < 7; row++) {
+                for (int col = 0; col < 5; col++) {
+                    if (rows[row] & (1 << (4 - col))) {
+                        SDL_Rect px = { cx + col * scale, y + row * scale, scale, scale };
+                        SDL_RenderFillRect(r, &px);
+                    }
+                }
+            }
+            cx += charW;
+        }
+    }
+
+    int textWidth(const char* s, int scale) {
+        return (int)strlen(s) * (5 * scale + 2);
+    }
+
+    // ── Canvas primitives ─────────────────────────────────────────────────────
+    // Pass straight through unless a TiledCanvas is the target; then each
+    // shape is drawn into every tile its bounds touch, shifted by the tile's
+    // origin. SDL rasterizes the same pixels at any integer offset, so a
+    // shape split over tiles matches one drawn on a single texture.
+
+    void renderFillRect(SDL_Renderer* r, const SDL_Rect* rect) {
+        TiledCanvas* c = TiledCanvas::bound(r);
+        if (!c) { SDL_RenderFillRect(r, rect); return; }
+        SDL_Rect b = rect ? *rect : SDL_Rect{ 0, 0, c->width(), c->height() };
+        c->forEachTile(b, [&](int ox, int oy) {
+            SDL_Rect t = { b.x - ox, b.y - oy, b.w, b.h };
+            SDL_RenderFillRect(r, &t);
+        });
+    }
+
+    void renderPoint(SDL_Renderer* r, int x, int y) {
+        TiledCanvas* c = TiledCanvas::bound(r);
+        if (!c) { SDL_RenderDrawPoint(r, x, y); return; }
+        c->forEachTile({ x, y, 1, 1 }, [&](int ox, int oy) { SDL_RenderDrawPoint(r, x - ox, y - oy); });
+    }
+
+    // Whether the segment passes within a pixel of `t` (Liang-Barsky clip).
+    static bool segmentNearRect(int x1, int y1, int x2, int y2, const SDL_Rect& t) {
+        float dx = (float)(x2 - x1), dy = (float)(y2 - y1), t0 = 0.f, t1 = 1.f;
+        const float p[4] = { -dx, dx, -dy, dy };
+        const float q[4] = { x1 - (t.x - 1.f), (t.x + t.w) - (float)x1,
+                             y1 - (t.y - 1.f), (t.y + t.h) - (float)y1 };
+        for (int i = 0; i < 4; i++) {
+            if (p[i] == 0.f) { if (q[i] < 0.f) return false; continue; }
+            float u = q[i] / p[i];
+            if (p[i] < 0.f) t0 = std::max(t0, u);
+            else            t1 = std::min(t1, u);
+            if (t0 > t1) return false;
+        }
+        return true;
+    }
+
+    void renderLine(SDL_Renderer* r, int x1, int y1, int x2, int y2) {
+        TiledCanvas* c = TiledCanvas::bound(r);
+        if (!c) { SDL_RenderDrawLine(r, x1, y1, x2, y2); return; }
+        // A long diagonal's bounds cover tiles it never enters; skip those.
+        SDL_Rect b = { std::min(x1, x2), std::min(y1, y2), std::abs(x2 - x1) + 1, std::abs(y2 - y1) + 1 };
+        c->forEachTile(b, [&](int ox, int oy) { SDL_RenderDrawLine(r, x1 - ox, y1 - oy, x2 - ox, y2 - oy); },
+                       [&](const SDL_Rect& t) { return segmentNearRect(x1, y1, x2, y2, t); });
+    }
+
+    void renderCopyEx(SDL_Renderer* r, SDL_Texture* tex, const SDL_FRect* dst, double angle,
+                      const SDL_FPoint* center, SDL_RendererFlip flip) {
+        TiledCanvas* c = TiledCanvas::bound(r);
+        if (!c) { SDL_RenderCopyExF(r, tex, nullptr, dst, angle, center, flip); return; }
+        // Bounds of dst rotated about its pivot.
+        float px = dst->x + (center ? center->x : dst->w * 0.5f);
+        float py = dst->y + (center ? center->y : dst->h * 0.5f);
+        float cs = (float)std::cos(angle * M_PI / 180.0), sn = (float)std::sin(angle * M_PI / 180.0);
+        float minX = px, minY = py, maxX = px, maxY = py;
+        for (int i = 0; i < 4; i++) {
+            float x = ((i & 1) ? dst->x + dst->w : dst->x) - px;
+            float y = ((i & 2) ? dst->y + dst->h : dst->y) - py;
+            float rx = px + x * cs - y * sn, ry = py + x * sn + y * cs;
+            minX = std::min(minX, rx); maxX = std::max(maxX, rx);
+            minY = std::min(minY, ry); maxY = std::max(maxY, ry);
+        }
+        int x0 = (int)std::floor(minX) - 1, y0 = (int)std::floor(minY) - 1;
+        SDL_Rect b = { x0, y0, (int)std::ceil(maxX) + 1 - x0, (int)std::ceil(maxY) + 1 - y0 };
+        c->forEachTile(b, [&](int ox, int oy) {
+            SDL_FRect t = { dst->x - ox, dst->y - oy, dst->w, dst->h };
+            SDL_RenderCopyExF(r, tex, nullptr, &t, angle, center, flip);
+        });
+    }
+
+    void renderClear(SDL_Renderer* r) {
+        TiledCanvas* c = TiledCanvas::bound(r);
+        if (!c) { SDL_RenderClear(r); return; }
+        SDL_Color color;
+        SDL_GetRenderDrawColor(r, &color.r, &color.g, &color.b, &color.a);
+        c->clear(color);
+    }
+
+    void readPixels(SDL_Renderer* r, const SDL_Rect* rect, uint32_t* out, int pitch) {
+        TiledCanvas* c = TiledCanvas::bound(r);
+        if (!c) { SDL_RenderReadPixels(r, rect, SDL_PIXELFORMAT_ARGB8888, out, pitch); return; }
+        c->read(rect ? *rect : SDL_Rect{ 0, 0, c->width(), c->height() }, out, pitch);
+    }
+
+    void writePixels(SDL_Renderer* r, const SDL_Rect* rect, const uint32_t* pixels, int pitch) {
+        TiledCanvas* c = TiledCanvas::bound(r);
+        if (!c) { SDL_UpdateTexture(SDL_GetRenderTarget(r), rect, pixels, pitch); return; }
+        c->write(rect ? *rect : SDL_Rect{ 0, 0, c->width(), c->height() }, pixels, pitch);
+    }
+
     static std::vector<uint8_t> argbToRGBA(const uint32_t* argb, int w, int h) {
-        std::vector<uint8_t> rgba(w * h * 4);
-        for (int i = 0; i < w * h; i++) {
+        const size_t n = (size_t)w * h;
+        std::vector<uint8_t> rgba(n * 4);
+        for (size_t i = 0; i < n; i++) {
             uint32_t px = argb[i];
             rgba[i*4+0] = (px >> 16) & 0xFF;
             rgba[i*4+1] = (px >>  8) & 0xFF;
@@ -405,8 +620,9 @@ namespace DrawingUtils {
     }
 
     static std::vector<uint32_t> rgbaToARGB(const uint8_t* rgba, int w, int h) {
-        std::vector<uint32_t> argb(w * h);
-        for (int i = 0; i < w * h; i++) {
+        const size_t n = (size_t)w * h;
+        std::vector<uint32_t> argb(n);
+        for (size_t i = 0; i < n; i++) {
             uint8_t r=rgba[i*4+0], g=rgba[i*4+1], b=rgba[i*4+2], a=rgba[i*4+3];
             argb[i] = ((uint32_t)a<<24)|((uint32_t)r<<16)|((uint32_t)g<<8)|b;
         }
@@ -414,28 +630,20 @@ namespace DrawingUtils {
     }
 
     std::vector<uint8_t> encodeJPEG(const uint32_t* argbPixels, int w, int h, int quality) {
-        std::vector<uint8_t> rgb(w * h * 3);
-        for (int i = 0; i < w * h; i++) {
-            uint32_t px = argbPixels[i];
-            uint8_t  a  = (px >> 24) & 0xFF;
-            uint8_t  r  = (px >> 16) & 0xFF;
-            uint8_t  g  = (px >>  8) & 0xFF;
-            uint8_t  b  = (px >>  0) & 0xFF;
-            rgb[i*3+0] = (uint8_t)(r + (255-r)*(255-a)/255);
-            rgb[i*3+1] = (uint8_t)(g + (255-g)*(255-a)/255);
-            rgb[i*3+2] = (uint8_t)(b + (255-b)*(255-a)/255);
-        }
-        std::vector<uint8_t> out;
-        auto cb = [](void* ctx, void* data, int size) {
-            auto* buf = static_cast<std::vector<uint8_t>*>(ctx);
-            auto* bytes = static_cast<uint8_t*>(data);
-            buf->insert(buf->end(), bytes, bytes + size);
-        };
-        stbi_write_jpg_to_func(cb, &out, w, h, 3, rgb.data(), quality);
-        return out;
+        KPEN_TRACE_ZONE("encodeJPEG");
+        return JpegEncoder::encode(argbPixels, w, h, quality);
+    }
+
+    bool fitsPNG(int w, int h) {
+        // stb_image_write holds the filtered image, (w * 4 + 1) * h bytes, and
+        // the deflated stream in int-sized buffers. The stream can be 9/8 of
+        // the input, and its buffer doubles, so it must stay under 2^30.
+        return w > 0 && h > 0 && ((size_t)w * 4 + 1) * h <= ((size_t)1 << 30) / 9 * 8;
     }
 
     std::vector<uint8_t> encodePNG(const uint32_t* argbPixels, int w, int h) {
+        KPEN_TRACE_ZONE("encodePNG");
+        if (!argbPixels || !fitsPNG(w, h)) return {};
         auto rgba = argbToRGBA(argbPixels, w, h);
         std::vector<uint8_t> out;
         auto cb = [](void* ctx, void* data, int size) {
@@ -447,7 +655,465 @@ namespace DrawingUtils {
         return out;
     }
 
+    static const size_t kMaxDecodePixels = 400000000;
+
+    // ── Indexed PNG ───────────────────────────────────────────────────────────
+    // stb_image_write only emits truecolor PNGs, so palette images are assembled
+    // here; stb's deflate is reused for the IDAT stream.
+
+    static uint32_t pngCrc(const uint8_t* data, size_t len, uint32_t crc = 0) {
+        struct Table {
+            uint32_t v[256];
+            Table() {
+                for (uint32_t n = 0; n < 256; n++) {
+                    uint32_t c = n;
+                    for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                    v[n] = c;
+                }
+            }
+        };
+        static const Table table;  // built once, even when headless jobs save concurrently
+        crc = ~crc;
+        for (size_t i = 0; i < len; i++) crc = table.v[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    static void pngChunk(std::vector<uint8_t>& out, const char type[4], const uint8_t* data, size_t len) {
+        size_t at = out.size();
+        out.resize(at + 8 + len + 4);
+        uint8_t* p = out.data() + at;
+        p[0] = (uint8_t)(len >> 24); p[1] = (uint8_t)(len >> 16); p[2] = (uint8_t)(len >> 8); p[3] = (uint8_t)len;
+        std::memcpy(p + 4, type, 4);
+        if (len) std::memcpy(p + 8, data, len);
+        uint32_t crc = pngCrc(p + 4, 4 + len);
+        p += 8 + len;
+        p[0] = (uint8_t)(crc >> 24); p[1] = (uint8_t)(crc >> 16); p[2] = (uint8_t)(crc >> 8); p[3] = (uint8_t)crc;
+    }
+
+    std::vector<uint8_t> encodeIndexedPNG(const uint32_t* palette, int paletteSize,
+                                          const uint8_t* indices, int w, int h) {
+        KPEN_TRACE_ZONE("encodeIndexedPNG");
+        if (!palette || !indices || paletteSize < 1 || paletteSize > 256 || w <= 0 || h <= 0) return {};
+        // Smallest bit depth that holds the palette; pixel-art palettes often fit in 1-4 bits.
+        const int depth = paletteSize <= 2 ? 1 : paletteSize <= 4 ? 2 : paletteSize <= 16 ? 4 : 8;
+        const size_t rowBytes = ((size_t)w * depth + 7) / 8;
+        const size_t rawSize = (rowBytes + 1) * h;
+        if (rawSize > (size_t)INT32_MAX) return {};
+        std::vector<uint8_t> raw(rawSize, 0);
+        for (int y = 0; y < h; y++) {
+            uint8_t* dst = raw.data() + (rowBytes + 1) * y + 1;  // filter byte 0 (None) suits palette data
+            const uint8_t* src = indices + (size_t)y * w;
+            if (depth == 8) { std::memcpy(dst, src, (size_t)w); continue; }
+            const int perByte = 8 / depth;
+            for (int x = 0; x < w; x++)
+                dst[x / perByte] |= (uint8_t)(src[x] << (8 - depth * (x % perByte + 1)));
+        }
+        int zlen = 0;
+        uint8_t* z = stbi_zlib_compress(raw.data(), (int)raw.size(), &zlen, stbi_write_png_compression_level);
+        if (!z) return {};
+
+        std::vector<uint8_t> out;
+        out.reserve((size_t)zlen + 1024);
+        static const uint8_t sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        out.insert(out.end(), sig, sig + 8);
+        uint8_t ihdr[13] = {
+            (uint8_t)(w >> 24), (uint8_t)(w >> 16), (uint8_t)(w >> 8), (uint8_t)w,
+            (uint8_t)(h >> 24), (uint8_t)(h >> 16), (uint8_t)(h >> 8), (uint8_t)h,
+            (uint8_t)depth, 3 /* palette */, 0, 0, 0
+        };
+        pngChunk(out, "IHDR", ihdr, sizeof(ihdr));
+        uint8_t plte[256 * 3], trns[256];
+        int trnsLen = 0;
+        for (int i = 0; i < paletteSize; i++) {
+            uint32_t c = palette[i];
+            plte[i*3+0] = (uint8_t)(c >> 16);
+            plte[i*3+1] = (uint8_t)(c >> 8);
+            plte[i*3+2] = (uint8_t)c;
+            trns[i] = (uint8_t)(c >> 24);
+            if (trns[i] != 0xFF) trnsLen = i + 1;  // entries past the last translucent one default to opaque
+        }
+        pngChunk(out, "PLTE", plte, (size_t)paletteSize * 3);
+        if (trnsLen) pngChunk(out, "tRNS", trns, (size_t)trnsLen);
+        pngChunk(out, "IDAT", z, (size_t)zlen);
+        pngChunk(out, "IEND", nullptr, 0);
+        free(z);
+        return out;
+    }
+
+    // PNG for images too large for stb (!fitsPNG): zlib stored blocks, no
+    // compression, written a row at a time so no second whole-image buffer
+    // is needed.
+    static bool writeStoredPNG(FILE* f, const uint32_t* argb, int w, int h) {
+        std::vector<uint8_t> out;
+        static const uint8_t sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        out.insert(out.end(), sig, sig + 8);
+        uint8_t ihdr[13] = {
+            (uint8_t)(w >> 24), (uint8_t)(w >> 16), (uint8_t)(w >> 8), (uint8_t)w,
+            (uint8_t)(h >> 24), (uint8_t)(h >> 16), (uint8_t)(h >> 8), (uint8_t)h,
+            8, 6 /* RGBA */, 0, 0, 0
+        };
+        pngChunk(out, "IHDR", ihdr, sizeof(ihdr));
+        auto flush = [&] { bool ok = fwrite(out.data(), 1, out.size(), f) == out.size(); out.clear(); return ok; };
+        if (!flush()) return false;
+
+        const size_t kBlock = 65535, kChunk = (size_t)1 << 22;
+        const size_t rowBytes = (size_t)w * 4 + 1;
+        size_t remaining = rowBytes * h;
+        uint32_t adlerA = 1, adlerB = 0;
+        std::vector<uint8_t> z = { 0x78, 0x01 }, pending, row(rowBytes);
+        for (int y = 0; y < h; y++) {
+            const uint32_t* src = argb + (size_t)y * w;
+            row[0] = 0;  // filter None
+            for (int x = 0; x < w; x++) {
+                uint32_t px = src[x];
+                uint8_t* p = &row[1 + (size_t)x * 4];
+                p[0] = (uint8_t)(px >> 16); p[1] = (uint8_t)(px >> 8); p[2] = (uint8_t)px; p[3] = (uint8_t)(px >> 24);
+            }
+            for (size_t i = 0; i < rowBytes; ) {
+                size_t n = std::min<size_t>(rowBytes - i, 5552);  // keeps the sums below 2^32
+                for (size_t k = 0; k < n; k++) { adlerA += row[i + k]; adlerB += adlerA; }
+                adlerA %= 65521; adlerB %= 65521;
+                i += n;
+            }
+            pending.insert(pending.end(), row.begin(), row.end());
+            size_t at = 0;
+            while (pending.size() - at >= kBlock || (y == h - 1 && at < pending.size())) {
+                size_t n = std::min(kBlock, pending.size() - at);
+                remaining -= n;
+                uint8_t hdr[5] = { (uint8_t)(remaining == 0), (uint8_t)n, (uint8_t)(n >> 8),
+                                   (uint8_t)~n, (uint8_t)(~n >> 8) };
+                z.insert(z.end(), hdr, hdr + 5);
+                z.insert(z.end(), pending.begin() + at, pending.begin() + at + n);
+                at += n;
+            }
+            pending.erase(pending.begin(), pending.begin() + at);
+            if (y == h - 1) {
+                uint8_t adler[4] = { (uint8_t)(adlerB >> 8), (uint8_t)adlerB, (uint8_t)(adlerA >> 8), (uint8_t)adlerA };
+                z.insert(z.end(), adler, adler + 4);
+            }
+            if (z.size() >= kChunk || y == h - 1) {
+                pngChunk(out, "IDAT", z.data(), z.size());
+                z.clear();
+                if (!flush()) return false;
+            }
+        }
+        pngChunk(out, "IEND", nullptr, 0);
+        return flush();
+    }
+
+    // ── QOI ("Quite OK Image", qoiformat.org) ─────────────────────────────────
+    // Works on packed ARGB directly: the encoder streams rows of the canvas buffer
+    // into a single pre-sized output and the decoder writes canvas pixels, so
+    // neither direction makes an intermediate RGBA copy.
+
+    static const uint8_t kQoiMagic[4] = { 'q', 'o', 'i', 'f' };
+    static const int kQoiHeaderSize = 14;
+    static const int kQoiPaddingSize = 8;  // end marker: 7x 0x00, 0x01
+
+    static inline int qoiHash(uint32_t px) {
+        return (((px >> 16) & 0xFF) * 3 + ((px >> 8) & 0xFF) * 5 +
+                (px & 0xFF) * 7 + (px >> 24) * 11) & 63;
+    }
+
+    static inline void qoiWrite32(uint8_t* p, uint32_t v) {
+        p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+    }
+
+    static inline uint32_t qoiRead32(const uint8_t* p) {
+        return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    }
+
+    static bool isQOI(const uint8_t* data, int dataLen) {
+        return data && dataLen >= kQoiHeaderSize + kQoiPaddingSize && std::memcmp(data, kQoiMagic, 4) == 0;
+    }
+
+    std::vector<uint8_t> encodeQOI(const uint32_t* argbPixels, int w, int h) {
+        KPEN_TRACE_ZONE("encodeQOI");
+        if (!argbPixels || w <= 0 || h <= 0 || (size_t)w * h > kMaxDecodePixels) return {};
+        // Worst case is one QOI_OP_RGBA (5 bytes) per pixel.
+        std::vector<uint8_t> out(kQoiHeaderSize + (size_t)w * h * 5 + kQoiPaddingSize);
+        uint8_t* o = out.data();
+        std::memcpy(o, kQoiMagic, 4);
+        qoiWrite32(o + 4, (uint32_t)w);
+        qoiWrite32(o + 8, (uint32_t)h);
+        o[12] = 4;  // channels: RGBA
+        o[13] = 0;  // colorspace: sRGB with linear alpha
+        o += kQoiHeaderSize;
+
+        uint32_t index[64] = {};
+        uint32_t prev = 0xFF000000u;
+        int run = 0;
+        for (int y = 0; y < h; y++) {
+            const uint32_t* row = argbPixels + (size_t)y * w;
+            for (int x = 0; x < w; x++) {
+                uint32_t px = row[x];
+                if (px == prev) {
+                    if (++run == 62) { *o++ = (uint8_t)(0xC0 | (run - 1)); run = 0; }
+                    continue;
+                }
+                if (run > 0) { *o++ = (uint8_t)(0xC0 | (run - 1)); run = 0; }
+                int hsh = qoiHash(px);
+                if (index[hsh] == px) {
+                    *o++ = (uint8_t)hsh;  // QOI_OP_INDEX
+                } else {
+                    index[hsh] = px;
+                    if ((px >> 24) == (prev >> 24)) {
+                        int8_t vr = (int8_t)(((px >> 16) & 0xFF) - ((prev >> 16) & 0xFF));
+                        int8_t vg = (int8_t)(((px >>  8) & 0xFF) - ((prev >>  8) & 0xFF));
+                        int8_t vb = (int8_t)(( px        & 0xFF) - ( prev        & 0xFF));
+                        int8_t vgr = (int8_t)(vr - vg);
+                        int8_t vgb = (int8_t)(vb - vg);
+                        if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                            *o++ = (uint8_t)(0x40 | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2));
+                        } else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8) {
+                            *o++ = (uint8_t)(0x80 | (vg + 32));
+                            *o++ = (uint8_t)(((vgr + 8) << 4) | (vgb + 8));
+                        } else {
+                            *o++ = 0xFE;
+                            *o++ = (uint8_t)(px >> 16); *o++ = (uint8_t)(px >> 8); *o++ = (uint8_t)px;
+                        }
+                    } else {
+                        *o++ = 0xFF;
+                        *o++ = (uint8_t)(px >> 16); *o++ = (uint8_t)(px >> 8); *o++ = (uint8_t)px;
+                        *o++ = (uint8_t)(px >> 24);
+                    }
+                }
+                prev = px;
+            }
+        }
+        if (run > 0) *o++ = (uint8_t)(0xC0 | (run - 1));
+        for (int i = 0; i < kQoiPaddingSize - 1; i++) *o++ = 0;
+        *o++ = 1;
+        out.resize((size_t)(o - out.data()));
+        return out;
+    }
+
+    static std::vector<uint32_t> decodeQOI(const uint8_t* data, int dataLen, int& outW, int& outH) {
+        uint32_t w = qoiRead32(data + 4), h = qoiRead32(data + 8);
+        if (w == 0 || h == 0 || w > (uint32_t)INT32_MAX || h > (uint32_t)INT32_MAX ||
+            (size_t)w * h > kMaxDecodePixels)
+            return {};
+        std::vector<uint32_t> argb((size_t)w * h);
+        uint32_t index[64] = {};
+        uint32_t px = 0xFF000000u;
+        int run = 0;
+        // Every op is at most 5 bytes and the stream ends with 8 padding bytes,
+        // so checking p against the start of the padding keeps reads in bounds.
+        const uint8_t* p = data + kQoiHeaderSize;
+        const uint8_t* end = data + dataLen - kQoiPaddingSize;
+        for (size_t i = 0, n = argb.size(); i < n; i++) {
+            if (run > 0) {
+                run--;
+            } else if (p < end) {
+                uint8_t b1 = *p++;
+                if (b1 == 0xFE) {
+                    px = (px & 0xFF000000u) | ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+                    p += 3;
+                } else if (b1 == 0xFF) {
+                    px = ((uint32_t)p[3] << 24) | ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+                    p += 4;
+                } else if ((b1 & 0xC0) == 0x00) {
+                    px = index[b1];
+                } else if ((b1 & 0xC0) == 0x40) {
+                    uint32_t r = ((px >> 16) + ((b1 >> 4) & 3) - 2) & 0xFF;
+                    uint32_t g = ((px >>  8) + ((b1 >> 2) & 3) - 2) & 0xFF;
+                    uint32_t b = ( px        + ( b1       & 3) - 2) & 0xFF;
+                    px = (px & 0xFF000000u) | (r << 16) | (g << 8) | b;
+                } else if ((b1 & 0xC0) == 0x80) {
+                    uint8_t b2 = *p++;
+                    int vg = (b1 & 0x3F) - 32;
+                    uint32_t r = ((px >> 16) + vg - 8 + ((b2 >> 4) & 0x0F)) & 0xFF;
+                    uint32_t g = ((px >>  8) + vg) & 0xFF;
+                    uint32_t b = ( px        + vg - 8 + ( b2       & 0x0F)) & 0xFF;
+                    px = (px & 0xFF000000u) | (r << 16) | (g << 8) | b;
+                } else {
+                    run = b1 & 0x3F;
+                }
+                index[qoiHash(px)] = px;
+            }
+            argb[i] = px;
+        }
+        outW = (int)w;
+        outH = (int)h;
+        return argb;
+    }
+
+    // ── Netpbm (PPM P6, PGM P5, PAM P7) ───────────────────────────────────────
+    // Pixels are converted one row at a time, whether the source is a mapped
+    // file or a FILE* (pipe); the only intermediate buffer is a single row.
+
+    struct NetpbmHeader {
+        int w = 0, h = 0;
+        int depth = 0;   // 1 gray, 2 gray+alpha, 3 RGB, 4 RGBA
+        int maxval = 0;  // 1..65535; >255 means 2 bytes per sample, big-endian
+    };
+
+    static bool isNetpbm(const uint8_t* data, int dataLen) {
+        return data && dataLen >= 3 && data[0] == 'P' && (data[1] == '5' || data[1] == '6' || data[1] == '7') &&
+               (data[2] == ' ' || data[2] == '\t' || data[2] == '\n' || data[2] == '\r');
+    }
+
+    // getc() returns the next byte or -1. On success the source is positioned
+    // at the first byte of raster data.
+    template<typename Getc>
+    static bool parseNetpbmHeader(Getc getc, NetpbmHeader& hd) {
+        if (getc() != 'P') return false;
+        int kind = getc();
+        auto isSpace = [](int c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; };
+        auto readNumber = [&](int& out) {
+            int c = getc();
+            for (;;) {
+                if (c == '#') { while (c != '\n' && c != -1) c = getc(); }
+                else if (isSpace(c)) c = getc();
+                else break;
+            }
+            if (c < '0' || c > '9') return false;
+            long long v = 0;
+            while (c >= '0' && c <= '9') {
+                v = v * 10 + (c - '0');
+                if (v > INT32_MAX) return false;
+                c = getc();
+            }
+            out = (int)v;
+            return isSpace(c);  // exactly one whitespace byte precedes the raster
+        };
+
+        if (kind == '5' || kind == '6') {
+            if (!readNumber(hd.w) || !readNumber(hd.h) || !readNumber(hd.maxval)) return false;
+            hd.depth = (kind == '5') ? 1 : 3;
+        } else if (kind == '7') {
+            // Line-oriented: "KEY value" pairs up to ENDHDR.
+            std::string line;
+            int c = getc();
+            if (c != '\n') return false;
+            for (;;) {
+                line.clear();
+                while ((c = getc()) != '\n') {
+                    if (c == -1 || line.size() > 256) return false;
+                    line += (char)c;
+                }
+                if (line.empty() || line[0] == '#') continue;
+                if (line.compare(0, 6, "ENDHDR") == 0) break;
+                auto sp = line.find_first_of(" \t");
+                std::string key = line.substr(0, sp);
+                int val = (sp == std::string::npos) ? 0 : std::atoi(line.c_str() + sp + 1);
+                if      (key == "WIDTH")  hd.w = val;
+                else if (key == "HEIGHT") hd.h = val;
+                else if (key == "DEPTH")  hd.depth = val;
+                else if (key == "MAXVAL") hd.maxval = val;
+                // TUPLTYPE is implied by DEPTH for the types we accept.
+            }
+        } else {
+            return false;
+        }
+        return hd.w > 0 && hd.h > 0 && hd.depth >= 1 && hd.depth <= 4 &&
+               hd.maxval >= 1 && hd.maxval <= 65535 && (size_t)hd.w * hd.h <= kMaxDecodePixels;
+    }
+
+    static size_t netpbmRowBytes(const NetpbmHeader& hd) {
+        return (size_t)hd.w * hd.depth * (hd.maxval > 255 ? 2 : 1);
+    }
+
+    static void netpbmRowToARGB(const uint8_t* src, uint32_t* dst, const NetpbmHeader& hd) {
+        const int depth = hd.depth;
+        if (hd.maxval == 255) {
+            for (int x = 0; x < hd.w; x++, src += depth) {
+                uint32_t r, g, b, a = 255;
+                if (depth <= 2) { r = g = b = src[0]; if (depth == 2) a = src[1]; }
+                else            { r = src[0]; g = src[1]; b = src[2]; if (depth == 4) a = src[3]; }
+                dst[x] = (a << 24) | (r << 16) | (g << 8) | b;
+            }
+            return;
+        }
+        const bool wide = hd.maxval > 255;
+        const uint32_t maxval = (uint32_t)hd.maxval;
+        auto sample = [&](int i) -> uint32_t {
+            uint32_t v = wide ? ((uint32_t)src[i * 2] << 8) | src[i * 2 + 1] : src[i];
+            return (std::min(v, maxval) * 255 + maxval / 2) / maxval;
+        };
+        const int stride = depth * (wide ? 2 : 1);
+        for (int x = 0; x < hd.w; x++, src += stride) {
+            uint32_t r, g, b, a = 255;
+            if (depth <= 2) { r = g = b = sample(0); if (depth == 2) a = sample(1); }
+            else            { r = sample(0); g = sample(1); b = sample(2); if (depth == 4) a = sample(3); }
+            dst[x] = (a << 24) | (r << 16) | (g << 8) | b;
+        }
+    }
+
+    static std::vector<uint32_t> decodeNetpbm(const uint8_t* data, int dataLen, int& outW, int& outH) {
+        const uint8_t* p = data;
+        const uint8_t* end = data + dataLen;
+        NetpbmHeader hd;
+        if (!parseNetpbmHeader([&]() -> int { return p < end ? *p++ : -1; }, hd)) return {};
+        const size_t rowBytes = netpbmRowBytes(hd);
+        if ((size_t)(end - p) / rowBytes < (size_t)hd.h) return {};
+        std::vector<uint32_t> argb((size_t)hd.w * hd.h);
+        for (int y = 0; y < hd.h; y++, p += rowBytes)
+            netpbmRowToARGB(p, argb.data() + (size_t)y * hd.w, hd);
+        outW = hd.w;
+        outH = hd.h;
+        return argb;
+    }
+
+    std::vector<uint32_t> readNetpbm(FILE* f, int& outW, int& outH) {
+        NetpbmHeader hd;
+        if (!f || !parseNetpbmHeader([&]() -> int { return std::fgetc(f); }, hd)) return {};
+        std::vector<uint8_t> row(netpbmRowBytes(hd));
+        std::vector<uint32_t> argb((size_t)hd.w * hd.h);
+        for (int y = 0; y < hd.h; y++) {
+            if (std::fread(row.data(), 1, row.size(), f) != row.size()) return {};
+            netpbmRowToARGB(row.data(), argb.data() + (size_t)y * hd.w, hd);
+        }
+        outW = hd.w;
+        outH = hd.h;
+        return argb;
+    }
+
+    bool writePAM(FILE* f, const uint32_t* argbPixels, int w, int h) {
+        if (!f || !argbPixels || w <= 0 || h <= 0) return false;
+        if (std::fprintf(f, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", w, h) < 0)
+            return false;
+        std::vector<uint8_t> row((size_t)w * 4);
+        for (int y = 0; y < h; y++) {
+            const uint32_t* src = argbPixels + (size_t)y * w;
+            for (int x = 0; x < w; x++) {
+                uint32_t px = src[x];
+                row[x*4+0] = (uint8_t)(px >> 16);
+                row[x*4+1] = (uint8_t)(px >>  8);
+                row[x*4+2] = (uint8_t)(px      );
+                row[x*4+3] = (uint8_t)(px >> 24);
+            }
+            if (std::fwrite(row.data(), 1, row.size(), f) != row.size()) return false;
+        }
+        return true;
+    }
+
+    bool writePPM(FILE* f, const uint32_t* argbPixels, int w, int h) {
+        if (!f || !argbPixels || w <= 0 || h <= 0) return false;
+        if (std::fprintf(f, "P6\n%d %d\n255\n", w, h) < 0) return false;
+        // No alpha channel: composite over white, as encodeJPEG does.
+        std::vector<uint8_t> row((size_t)w * 3);
+        for (int y = 0; y < h; y++) {
+            const uint32_t* src = argbPixels + (size_t)y * w;
+            for (int x = 0; x < w; x++) {
+                uint32_t px = src[x];
+                uint8_t a = (px >> 24) & 0xFF;
+                uint8_t r = (px >> 16) & 0xFF;
+                uint8_t g = (px >>  8) & 0xFF;
+                uint8_t b = (px >>  0) & 0xFF;
+                row[x*3+0] = (uint8_t)(r + (255-r)*(255-a)/255);
+                row[x*3+1] = (uint8_t)(g + (255-g)*(255-a)/255);
+                row[x*3+2] = (uint8_t)(b + (255-b)*(255-a)/255);
+            }
+            if (std::fwrite(row.data(), 1, row.size(), f) != row.size()) return false;
+        }
+        return true;
+    }
+
     std::vector<uint32_t> decodeImage(const uint8_t* data, int dataLen, int& outW, int& outH) {
+        KPEN_TRACE_ZONE("decodeImage");
+        if (isQOI(data, dataLen)) return decodeQOI(data, dataLen, outW, outH);
+        if (isNetpbm(data, dataLen)) return decodeNetpbm(data, dataLen, outW, outH);
         int channels;
         uint8_t* raw = stbi_load_from_memory(data, dataLen, &outW, &outH, &channels, 4);
         if (!raw) return {};
@@ -456,6 +1122,214 @@ namespace DrawingUtils {
         return argb;
     }
 
+    bool probeImage(const uint8_t* data, int dataLen, int& outW, int& outH) {
+        if (isQOI(data, dataLen)) {
+            uint32_t w = qoiRead32(data + 4), h = qoiRead32(data + 8);
+            if (w == 0 || h == 0 || w > (uint32_t)INT32_MAX || h > (uint32_t)INT32_MAX) return false;
+            outW = (int)w;
+            outH = (int)h;
+            return true;
+        }
+        if (isNetpbm(data, dataLen)) {
+            const uint8_t* p = data;
+            const uint8_t* end = data + dataLen;
+            NetpbmHeader hd;
+            if (!parseNetpbmHeader([&]() -> int { return p < end ? *p++ : -1; }, hd)) return false;
+            outW = hd.w;
+            outH = hd.h;
+            return true;
+        }
+        int channels;
+        return stbi_info_from_memory(data, dataLen, &outW, &outH, &channels) && outW > 0 && outH > 0;
+    }
+
+    static std::string lowerExtension(const std::string& path) {
+        auto dot = path.rfind('.');
+        auto sep = path.find_last_of("/\\");
+        if (dot == std::string::npos || (sep != std::string::npos && dot < sep)) return "";
+        std::string ext = path.substr(dot);
+        for (auto& c : ext) c = (char)tolower(c);
+        return ext;
+    }
+
+    bool readImageFile(const std::string& path, std::vector<uint32_t>& outPixels, int& outW, int& outH) {
+        if (path == "-") {
+            outPixels = readNetpbm(stdin, outW, outH);
+            return !outPixels.empty();
+        }
+        MappedFile file;
+        if (!file.open(path) || file.size() > (size_t)INT32_MAX) return false;
+        outPixels = decodeImage(file.data(), (int)file.size(), outW, outH);
+        return !outPixels.empty();
+    }
+
+    bool writeImageFile(const std::string& path, const uint32_t* argbPixels, int w, int h,
+                        int jpegQuality, const char* format) {
+        std::string ext = format ? std::string(".") + format : lowerExtension(path);
+        for (auto& c : ext) c = (char)tolower(c);
+        bool toStdout = (path == "-");
+        FILE* f = toStdout ? stdout : fopen(path.c_str(), "wb");
+        if (!f) return false;
+        bool ok;
+        if (ext == ".pam" || (toStdout && ext.empty())) {
+            ok = writePAM(f, argbPixels, w, h);
+        } else if (ext == ".ppm") {
+            ok = writePPM(f, argbPixels, w, h);
+        } else if (ext != ".jpg" && ext != ".jpeg" && ext != ".qoi" && !fitsPNG(w, h)) {
+            ok = writeStoredPNG(f, argbPixels, w, h);
+        } else {
+            std::vector<uint8_t> bytes;
+            if (ext == ".jpg" || ext == ".jpeg") bytes = encodeJPEG(argbPixels, w, h, jpegQuality);
+            else if (ext == ".qoi")              bytes = encodeQOI(argbPixels, w, h);
+            else                                 bytes = encodePNG(argbPixels, w, h);
+            ok = !bytes.empty() && fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+        }
+        if (toStdout) ok = (fflush(f) == 0) && ok;
+        else          ok = (fclose(f) == 0) && ok;
+        return ok;
+    }
+
+    // ── Pixel operations shared by the canvas and headless mode ───────────────
+
+    std::vector<uint32_t> resizePixels(const uint32_t* src, int srcW, int srcH, int newW, int newH,
+                                       bool scaleContent, int originX, int originY) {
+        // Transparent background.
+        std::vector<uint32_t> dst((size_t)newW * newH, 0x00000000);
+        if (scaleContent) {
+            // Nearest-neighbour scale — origin shift ignored, whole image resampled.
+            for (int y = 0; y < newH; y++) {
+                int srcY = std::min((int)((float)y / newH * srcH), srcH - 1);
+                const uint32_t* srcRow = src + (size_t)srcY * srcW;
+                uint32_t* dstRow = dst.data() + (size_t)y * newW;
+                for (int x = 0; x < newW; x++) {
+                    int srcX = std::min((int)((float)x / newW * srcW), srcW - 1);
+                    dstRow[x] = srcRow[srcX];
+                }
+            }
+        } else {
+            // Crop / pad with origin shift: (originX, originY) is where the new
+            // top-left lands in old canvas coordinates (negative = padding).
+            int x0 = std::max(0, originX), x1 = std::min(srcW, originX + newW);
+            for (int oldY = std::max(0, originY); oldY < std::min(srcH, originY + newH); oldY++) {
+                if (x1 <= x0) break;
+                std::memcpy(dst.data() + (size_t)(oldY - originY) * newW + (x0 - originX),
+                            src + (size_t)oldY * srcW + x0, (size_t)(x1 - x0) * 4);
+            }
+        }
+        return dst;
+    }
+
+    bool floodFill(uint32_t* pixels, int w, int h, int x, int y, uint32_t fill) {
+        KPEN_TRACE_ZONE("floodFill");
+        if (x < 0 || x >= w || y < 0 || y >= h) return false;
+        size_t start = static_cast<size_t>(y) * w + x;  // canvases can pass 2^31 pixels
+        uint32_t target = pixels[start];
+        if (target == fill) return false;  // already that color, nothing to do
+
+        std::queue<size_t> q;
+        q.push(start);
+        pixels[start] = fill;
+        while (!q.empty()) {
+            size_t idx = q.front(); q.pop();
+            int cx = static_cast<int>(idx % w);
+            int cy = static_cast<int>(idx / w);
+            auto tryPush = [&](int nx, int ny) {
+                if (nx < 0 || nx >= w || ny < 0 || ny >= h) return;
+                size_t ni = static_cast<size_t>(ny) * w + nx;
+                if (pixels[ni] == target) {
+                    pixels[ni] = fill;
+                    q.push(ni);
+                }
+            };
+            tryPush(cx-1, cy);
+            tryPush(cx+1, cy);
+            tryPush(cx,   cy-1);
+            tryPush(cx,   cy+1);
+        }
+        return true;
+    }
+
+    SDL_Rect opaqueBounds(const uint32_t* pixels, int w, int h) {
+        int minX = w, minY = h, maxX = -1, maxY = -1;
+        for (int y = 0; y < h; y++) {
+            const uint32_t* row = pixels + (size_t)y * w;
+            int first = 0;
+            while (first < w && !(row[first] >> 24)) first++;
+            if (first == w) continue;
+            int last = w - 1;
+            while (!(row[last] >> 24)) last--;
+            minX = std::min(minX, first);
+            maxX = std::max(maxX, last);
+            if (minY == h) minY = y;
+            maxY = y;
+        }
+        if (maxX < 0) return { 0, 0, 0, 0 };
+        return { minX, minY, maxX - minX + 1, maxY - minY + 1 };
+    }
+
+    // Alpha-weighted mean of four pixels. For opaque pixels this is (sum + 2) / 4
+    // per channel, which the SSE2 path computes directly.
+    static uint32_t average4(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3) {
+        const uint32_t px[4] = { p0, p1, p2, p3 };
+        uint32_t a = 0, r = 0, g = 0, b = 0;
+        for (uint32_t p : px) {
+            uint32_t pa = p >> 24;
+            a += pa;
+            r += ((p >> 16) & 0xFF) * pa;
+            g += ((p >>  8) & 0xFF) * pa;
+            b += ( p        & 0xFF) * pa;
+        }
+        if (!a) return 0;
+        r = (r + a / 2) / a; g = (g + a / 2) / a; b = (b + a / 2) / a;
+        return (((a + 2) / 4) << 24) | (r << 16) | (g << 8) | b;
+    }
+
+    void downsample2x(const uint32_t* src, int w, int h, int srcPitch, uint32_t* dst, int dstPitch) {
+        const int dw = (w + 1) / 2, dh = (h + 1) / 2;
+        for (int y = 0; y < dh; y++) {
+            const uint32_t* r0 = reinterpret_cast<const uint32_t*>(
+                reinterpret_cast<const uint8_t*>(src) + (size_t)(2 * y) * srcPitch);
+            const uint32_t* r1 = reinterpret_cast<const uint32_t*>(
+                reinterpret_cast<const uint8_t*>(src) + (size_t)std::min(2 * y + 1, h - 1) * srcPitch);
+            uint32_t* out = reinterpret_cast<uint32_t*>(reinterpret_cast<uint8_t*>(dst) + (size_t)y * dstPitch);
+            int x = 0;
+#ifdef KPEN_SSE2
+            // Four output pixels at a time while all 16 inputs are opaque (the
+            // common case on a painted canvas); anything else takes the scalar path.
+            const __m128i zero = _mm_setzero_si128(), alpha = _mm_set1_epi32((int)0xFF000000u);
+            const __m128i two = _mm_set1_epi16(2);
+            for (; x + 4 <= w / 2; x += 4) {
+                __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + 2 * x));
+                __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + 2 * x + 4));
+                __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + 2 * x));
+                __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + 2 * x + 4));
+                __m128i all = _mm_and_si128(_mm_and_si128(a0, b0), _mm_and_si128(a1, b1));
+                if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(all, alpha), alpha)) != 0xFFFF) {
+                    for (int i = 0; i < 4; i++)
+                        out[x + i] = average4(r0[2 * (x + i)], r0[2 * (x + i) + 1], r1[2 * (x + i)], r1[2 * (x + i) + 1]);
+                    continue;
+                }
+                // Split each row into even and odd pixels, then add in 16 bits.
+                __m128i e0 = _mm_unpacklo_epi64(_mm_shuffle_epi32(a0, 0x88), _mm_shuffle_epi32(b0, 0x88));
+                __m128i o0 = _mm_unpacklo_epi64(_mm_shuffle_epi32(a0, 0xDD), _mm_shuffle_epi32(b0, 0xDD));
+                __m128i e1 = _mm_unpacklo_epi64(_mm_shuffle_epi32(a1, 0x88), _mm_shuffle_epi32(b1, 0x88));
+                __m128i o1 = _mm_unpacklo_epi64(_mm_shuffle_epi32(a1, 0xDD), _mm_shuffle_epi32(b1, 0xDD));
+                __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(e0, zero), _mm_unpacklo_epi8(o0, zero)),
+                                           _mm_add_epi16(_mm_unpacklo_epi8(e1, zero), _mm_unpacklo_epi8(o1, zero)));
+                __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(e0, zero), _mm_unpackhi_epi8(o0, zero)),
+                                           _mm_add_epi16(_mm_unpackhi_epi8(e1, zero), _mm_unpackhi_epi8(o1, zero)));
+                lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+                hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(lo, hi));
+            }
+#endif
+            for (; x < dw; x++) {
+                int x0 = 2 * x, x1 = std::min(2 * x + 1, w - 1);
+                out[x] = average4(r0[x0], r0[x1], r1[x0], r1[x1]);
+            }
+        }
+    }
+
 #if defined(KPEN_CLIPBOARD_MAC)
 
 #elif defined(KPEN_CLIPBOARD_WIN)
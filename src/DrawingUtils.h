@@ -3,6 +3,8 @@
 #include <SDL2/SDL.h>
 #include <vector>
 #include <cstdint>
+#include <cstdio>
+#include <string>
 
 namespace DrawingUtils {
     void drawFillCircle(SDL_Renderer* renderer, int centerX, int centerY, int radius);
@@ -14,12 +16,64 @@ namespace DrawingUtils {
     void drawOval      (SDL_Renderer* renderer, int x0, int y0, int x1, int y1, int size, int w, int h);
     void drawFilledOval(SDL_Renderer* renderer, int x0, int y0, int x1, int y1, int w, int h);
     SDL_Rect getOvalCenterBounds(int x0, int y0, int x1, int y1);
+    // Canvas-clipped box drawLine / drawSquareLine can touch for this brush size; w == 0 if none.
+    SDL_Rect strokeBounds(int x0, int y0, int x1, int y1, int size, int cw, int ch);
+    // Smallest rect holding both; empty rects (w or h <= 0) are ignored.
+    SDL_Rect unionRect(const SDL_Rect& a, const SDL_Rect& b);
     void drawMarchingRect(SDL_Renderer* renderer, const SDL_Rect* rect);
     void drawMarchingPolyline(SDL_Renderer* renderer, const SDL_Point* points, int count, bool closed, bool whiteOnly = false);
+    // Small 5x7 bitmap text (letters, digits and , . : - +) in the current draw color; 7*scale px tall.
+    void drawText (SDL_Renderer* r, int x, int y, const char* s, int scale = 1);
+    int  textWidth(const char* s, int scale = 1);
+
+    // Canvas primitives: the SDL_Render* call they are named after, except
+    // that while a TiledCanvas is the render target they take canvas
+    // coordinates and reach every tile. Anything that may draw on or read the
+    // canvas or overlay goes through these. rect == nullptr means the whole
+    // target; pitch is in bytes; pixels are ARGB8888.
+    void renderFillRect(SDL_Renderer* r, const SDL_Rect* rect);
+    void renderPoint   (SDL_Renderer* r, int x, int y);
+    void renderLine    (SDL_Renderer* r, int x1, int y1, int x2, int y2);
+    void renderCopyEx  (SDL_Renderer* r, SDL_Texture* tex, const SDL_FRect* dst, double angle,
+                        const SDL_FPoint* center, SDL_RendererFlip flip);
+    void renderClear   (SDL_Renderer* r);
+    void readPixels    (SDL_Renderer* r, const SDL_Rect* rect, uint32_t* out, int pitch);
+    void writePixels   (SDL_Renderer* r, const SDL_Rect* rect, const uint32_t* pixels, int pitch);
 
     std::vector<uint8_t> encodeJPEG(const uint32_t* argbPixels, int w, int h, int quality = 92);
+    // Empty if !fitsPNG(w, h): stb_image_write sizes its buffers with int (up to about 15000²).
+    // writeImageFile still writes larger PNGs, uncompressed.
     std::vector<uint8_t> encodePNG (const uint32_t* argbPixels, int w, int h);
+    bool fitsPNG(int w, int h);
+    std::vector<uint8_t> encodeQOI (const uint32_t* argbPixels, int w, int h);
+    // Palette PNG (color type 3) with tRNS; see PaletteQuantizer for building palette/indices.
+    std::vector<uint8_t> encodeIndexedPNG(const uint32_t* palette, int paletteSize,
+                                          const uint8_t* indices, int w, int h);
+    // PNG, JPEG, QOI or PPM/PGM/PAM (detected from the data, not the file name).
     std::vector<uint32_t> decodeImage(const uint8_t* data, int dataLen, int& outW, int& outH);
+    // Netpbm streamed through f one row at a time (works on pipes). PPM composites alpha over white.
+    bool writePAM(FILE* f, const uint32_t* argbPixels, int w, int h);
+    bool writePPM(FILE* f, const uint32_t* argbPixels, int w, int h);
+    std::vector<uint32_t> readNetpbm(FILE* f, int& outW, int& outH);
+    // Read only the header; returns false if the data is not a decodable image.
+    bool probeImage(const uint8_t* data, int dataLen, int& outW, int& outH);
+    // Whole-file helpers: format chosen by extension (or `format`, e.g. "qoi"); "-" means stdin/stdout (Netpbm).
+    bool readImageFile (const std::string& path, std::vector<uint32_t>& outPixels, int& outW, int& outH);
+    bool writeImageFile(const std::string& path, const uint32_t* argbPixels, int w, int h,
+                        int jpegQuality = 92, const char* format = nullptr);
+
+    // Canvas resize semantics: scaleContent = nearest-neighbour stretch; otherwise crop/pad with
+    // (originX, originY) = new top-left in old coordinates. New area is transparent.
+    std::vector<uint32_t> resizePixels(const uint32_t* src, int srcW, int srcH, int newW, int newH,
+                                       bool scaleContent, int originX = 0, int originY = 0);
+    // 4-connected exact-match fill; returns false if nothing changed.
+    bool floodFill(uint32_t* pixels, int w, int h, int x, int y, uint32_t fill);
+    // Bounding box of pixels with non-zero alpha; w == 0 if the image is fully transparent.
+    SDL_Rect opaqueBounds(const uint32_t* pixels, int w, int h);
+    // 2x2 box filter into a (w+1)/2 x (h+1)/2 image, weighted by alpha so transparent
+    // pixels don't darken edges. An odd last row/column is repeated. Pitches in bytes.
+    void downsample2x(const uint32_t* src, int w, int h, int srcPitch, uint32_t* dst, int dstPitch);
+
     bool setClipboardImage(const uint32_t* argbPixels, int w, int h);
     bool getClipboardImage(std::vector<uint32_t>& outPixels, int& outW, int& outH);
 }
@@ -0,0 +1,286 @@
+#include "EventLog.h"
+#include <cstring>
+
+namespace EventLog {
+
+static const char kMagic[4] = { 'K', 'P', 'E', 'V' };
+static const int  kVersion  = 1;
+
+// ── Writer ────────────────────────────────────────────────────────────────────
+
+void Writer::putVar(uint64_t v) {
+    uint8_t buf[10];
+    int n = 0;
+    do {
+        uint8_t b = v & 0x7F;
+        v >>= 7;
+        buf[n++] = b | (v ? 0x80 : 0);
+    } while (v);
+    fwrite(buf, 1, n, file_);
+}
+
+void Writer::putFloat(float f) {
+    uint32_t u;
+    std::memcpy(&u, &f, 4);
+    uint8_t b[4] = { (uint8_t)u, (uint8_t)(u >> 8), (uint8_t)(u >> 16), (uint8_t)(u >> 24) };
+    fwrite(b, 1, 4, file_);
+}
+
+void Writer::putString(const char* s) {
+    size_t n = s ? strlen(s) : 0;
+    putVar(n);
+    if (n) fwrite(s, 1, n, file_);
+}
+
+bool Writer::open(const std::string& path, const Header& h) {
+    close();
+    file_ = fopen(path.c_str(), "wb");
+    if (!file_) return false;
+    fwrite(kMagic, 1, 4, file_);
+    putVar(kVersion);
+    putVar(h.canvasW); putVar(h.canvasH);
+    putVar(h.winW);    putVar(h.winH);
+    putVar(h.tool);    putVar(h.brushSize);
+    putVar(((uint32_t)h.brushColor.r << 24) | ((uint32_t)h.brushColor.g << 16) |
+           ((uint32_t)h.brushColor.b << 8) | h.brushColor.a);
+    putVar((h.squareBrush ? 1 : 0) | (h.squareEraser ? 2 : 0) | (h.fillRect ? 4 : 0) |
+           (h.fillCircle ? 8 : 0) | (h.lassoSelect ? 16 : 0));
+    lastTicks = SDL_GetTicks();
+    return true;
+}
+
+void Writer::close() {
+    if (file_) fclose(file_);
+    file_ = nullptr;
+}
+
+void Writer::write(const SDL_Event& e) {
+    if (!file_) return;
+    switch (e.type) {
+        case SDL_USEREVENT:
+            if (e.user.data1 || e.user.data2) return;  // async results hold live pointers
+            break;
+        case SDL_DROPFILE: case SDL_TEXTINPUT: case SDL_KEYDOWN: case SDL_KEYUP:
+        case SDL_MOUSEWHEEL: case SDL_FINGERDOWN: case SDL_FINGERUP: case SDL_FINGERMOTION:
+        case SDL_MULTIGESTURE: case SDL_MOUSEBUTTONDOWN: case SDL_MOUSEBUTTONUP: case SDL_MOUSEMOTION:
+            break;
+        case SDL_WINDOWEVENT:
+            if (e.window.event != SDL_WINDOWEVENT_RESIZED) return;
+            break;
+        default:
+            return;
+    }
+
+    Uint32 now = SDL_GetTicks();
+    putVar(e.type);
+    putVar(now - lastTicks);
+    lastTicks = now;
+
+    switch (e.type) {
+        case SDL_USEREVENT:   putInt(e.user.code); break;
+        case SDL_DROPFILE:    putString(e.drop.file); break;
+        case SDL_TEXTINPUT:   putString(e.text.text); break;
+        case SDL_KEYDOWN:
+        case SDL_KEYUP:
+            putVar(e.key.keysym.scancode);
+            putInt(e.key.keysym.sym);
+            putVar(e.key.keysym.mod);
+            putVar(e.key.repeat);
+            break;
+        case SDL_WINDOWEVENT:
+            putInt(e.window.data1);
+            putInt(e.window.data2);
+            break;
+        case SDL_MOUSEWHEEL:
+            putVar(e.wheel.which);
+            putInt(e.wheel.x);
+            putInt(e.wheel.y);
+            putFloat(e.wheel.preciseX);
+            putFloat(e.wheel.preciseY);
+            putVar(e.wheel.direction);
+            break;
+        case SDL_FINGERDOWN:
+        case SDL_FINGERUP:
+        case SDL_FINGERMOTION:
+            putInt(e.tfinger.touchId);
+            putInt(e.tfinger.fingerId);
+            putFloat(e.tfinger.x);  putFloat(e.tfinger.y);
+            putFloat(e.tfinger.dx); putFloat(e.tfinger.dy);
+            putFloat(e.tfinger.pressure);
+            break;
+        case SDL_MULTIGESTURE:
+            putInt(e.mgesture.touchId);
+            putFloat(e.mgesture.dTheta);
+            putFloat(e.mgesture.dDist);
+            putFloat(e.mgesture.x);
+            putFloat(e.mgesture.y);
+            putVar(e.mgesture.numFingers);
+            break;
+        case SDL_MOUSEBUTTONDOWN:
+        case SDL_MOUSEBUTTONUP:
+            putVar(e.button.which);
+            putVar(e.button.button);
+            putVar(e.button.clicks);
+            putInt(e.button.x);
+            putInt(e.button.y);
+            break;
+        case SDL_MOUSEMOTION:
+            putVar(e.motion.which);
+            putVar(e.motion.state);
+            putInt(e.motion.x);    putInt(e.motion.y);
+            putInt(e.motion.xrel); putInt(e.motion.yrel);
+            break;
+    }
+}
+
+// ── Reader ────────────────────────────────────────────────────────────────────
+
+bool Reader::getVar(uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(file_);
+        if (c == EOF) return false;
+        v |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) return true;
+    }
+    return false;
+}
+
+bool Reader::getInt(int64_t& v) {
+    uint64_t u;
+    if (!getVar(u)) return false;
+    v = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+    return true;
+}
+
+bool Reader::getFloat(float& f) {
+    uint8_t b[4];
+    if (fread(b, 1, 4, file_) != 4) return false;
+    uint32_t u = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+    std::memcpy(&f, &u, 4);
+    return true;
+}
+
+bool Reader::getString(std::string& s) {
+    uint64_t n;
+    if (!getVar(n) || n > (1u << 20)) return false;
+    s.resize((size_t)n);
+    return n == 0 || fread(&s[0], 1, (size_t)n, file_) == n;
+}
+
+bool Reader::open(const std::string& path, Header& h) {
+    file_ = fopen(path.c_str(), "rb");
+    if (!file_) return false;
+    char magic[4];
+    uint64_t ver, v[8];
+    if (fread(magic, 1, 4, file_) != 4 || std::memcmp(magic, kMagic, 4) != 0 ||
+        !getVar(ver) || ver != kVersion)
+        return false;
+    for (auto& x : v)
+        if (!getVar(x)) return false;
+    h.canvasW = (int)v[0]; h.canvasH = (int)v[1];
+    h.winW    = (int)v[2]; h.winH    = (int)v[3];
+    h.tool    = (int)v[4]; h.brushSize = (int)v[5];
+    h.brushColor = { (Uint8)(v[6] >> 24), (Uint8)(v[6] >> 16), (Uint8)(v[6] >> 8), (Uint8)v[6] };
+    h.squareBrush  = v[7] & 1;  h.squareEraser = v[7] & 2;
+    h.fillRect     = v[7] & 4;  h.fillCircle   = v[7] & 8;
+    h.lassoSelect  = v[7] & 16;
+    return true;
+}
+
+bool Reader::next(SDL_Event& e, Uint32& deltaMs) {
+    uint64_t type, dt, u;
+    int64_t a, b, c, d;
+    std::string s;
+    if (!getVar(type) || !getVar(dt)) return false;
+    SDL_zero(e);
+    e.type = (Uint32)type;
+    e.common.timestamp = SDL_GetTicks();
+    deltaMs = (Uint32)dt;
+
+    switch (e.type) {
+        case SDL_USEREVENT:
+            if (!getInt(a)) return false;
+            e.user.code = (Sint32)a;
+            return true;
+        case SDL_DROPFILE:
+            if (!getString(s)) return false;
+            e.drop.file = SDL_strdup(s.c_str());
+            return true;
+        case SDL_TEXTINPUT:
+            if (!getString(s)) return false;
+            SDL_strlcpy(e.text.text, s.c_str(), sizeof(e.text.text));
+            return true;
+        case SDL_KEYDOWN:
+        case SDL_KEYUP: {
+            uint64_t mod, rep;
+            if (!getVar(u) || !getInt(a) || !getVar(mod) || !getVar(rep)) return false;
+            e.key.keysym.scancode = (SDL_Scancode)u;
+            e.key.keysym.sym = (SDL_Keycode)a;
+            e.key.keysym.mod = (Uint16)mod;
+            e.key.repeat = (Uint8)rep;
+            e.key.state = e.type == SDL_KEYDOWN ? SDL_PRESSED : SDL_RELEASED;
+            return true;
+        }
+        case SDL_WINDOWEVENT:
+            if (!getInt(a) || !getInt(b)) return false;
+            e.window.event = SDL_WINDOWEVENT_RESIZED;
+            e.window.data1 = (Sint32)a;
+            e.window.data2 = (Sint32)b;
+            return true;
+        case SDL_MOUSEWHEEL: {
+            uint64_t dir;
+            if (!getVar(u) || !getInt(a) || !getInt(b) ||
+                !getFloat(e.wheel.preciseX) || !getFloat(e.wheel.preciseY) || !getVar(dir))
+                return false;
+            e.wheel.which = (Uint32)u;
+            e.wheel.x = (Sint32)a;
+            e.wheel.y = (Sint32)b;
+            e.wheel.direction = (Uint32)dir;
+            return true;
+        }
+        case SDL_FINGERDOWN:
+        case SDL_FINGERUP:
+        case SDL_FINGERMOTION:
+            if (!getInt(a) || !getInt(b) ||
+                !getFloat(e.tfinger.x) || !getFloat(e.tfinger.y) ||
+                !getFloat(e.tfinger.dx) || !getFloat(e.tfinger.dy) || !getFloat(e.tfinger.pressure))
+                return false;
+            e.tfinger.touchId = (SDL_TouchID)a;
+            e.tfinger.fingerId = (SDL_FingerID)b;
+            return true;
+        case SDL_MULTIGESTURE:
+            if (!getInt(a) || !getFloat(e.mgesture.dTheta) || !getFloat(e.mgesture.dDist) ||
+                !getFloat(e.mgesture.x) || !getFloat(e.mgesture.y) || !getVar(u))
+                return false;
+            e.mgesture.touchId = (SDL_TouchID)a;
+            e.mgesture.numFingers = (Uint16)u;
+            return true;
+        case SDL_MOUSEBUTTONDOWN:
+        case SDL_MOUSEBUTTONUP: {
+            uint64_t button, clicks;
+            if (!getVar(u) || !getVar(button) || !getVar(clicks) || !getInt(a) || !getInt(b))
+                return false;
+            e.button.which = (Uint32)u;
+            e.button.button = (Uint8)button;
+            e.button.clicks = (Uint8)clicks;
+            e.button.state = e.type == SDL_MOUSEBUTTONDOWN ? SDL_PRESSED : SDL_RELEASED;
+            e.button.x = (Sint32)a;
+            e.button.y = (Sint32)b;
+            return true;
+        }
+        case SDL_MOUSEMOTION: {
+            uint64_t state;
+            if (!getVar(u) || !getVar(state) || !getInt(a) || !getInt(b) || !getInt(c) || !getInt(d))
+                return false;
+            e.motion.which = (Uint32)u;
+            e.motion.state = (Uint32)state;
+            e.motion.x = (Sint32)a;    e.motion.y = (Sint32)b;
+            e.motion.xrel = (Sint32)c; e.motion.yrel = (Sint32)d;
+            return true;
+        }
+    }
+    return false;  // unknown type: corrupt or newer log
+}
+
+} // namespace EventLog
@@ -0,0 +1,62 @@
+#pragma once
+
+// EventLog — compact binary recording of the SDL events kPen processes.
+//
+// `kPen --record FILE` writes every event handed to kPen::processEvent, with
+// its time since the previous one; `kPen --replay FILE` feeds them back. The
+// header holds what the events depend on: window and canvas size and the tool
+// state at launch (recording always starts from a new blank document).
+//
+// Layout: "KPEV", u8 version, header fields as varints, then per event
+// varint type, varint delta-ms and a type-specific payload (zigzag varints,
+// raw little-endian floats, length-prefixed strings). Event types kPen does
+// not handle, and events carrying pointers (async results), are not written.
+
+#include <SDL2/SDL.h>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace EventLog {
+
+struct Header {
+    int canvasW = 0, canvasH = 0;
+    int winW    = 0, winH    = 0;
+    int tool    = 0;           // ToolType
+    int brushSize = 1;
+    SDL_Color brushColor = { 0, 0, 0, 255 };
+    bool squareBrush = false, squareEraser = false;
+    bool fillRect    = false, fillCircle   = false;
+    bool lassoSelect = false;
+};
+
+class Writer {
+    FILE*  file_     = nullptr;
+    Uint32 lastTicks = 0;
+    void putVar(uint64_t v);
+    void putInt(int64_t v) { putVar(((uint64_t)v << 1) ^ (uint64_t)(v >> 63)); }
+    void putFloat(float f);
+    void putString(const char* s);
+  public:
+    ~Writer() { close(); }
+    bool open(const std::string& path, const Header& h);
+    void close();
+    bool isOpen() const { return file_ != nullptr; }
+    void write(const SDL_Event& e);
+};
+
+class Reader {
+    FILE* file_ = nullptr;
+    bool  getVar(uint64_t& v);
+    bool  getInt(int64_t& v);
+    bool  getFloat(float& f);
+    bool  getString(std::string& s);
+  public:
+    ~Reader() { if (file_) fclose(file_); }
+    bool open(const std::string& path, Header& h);
+    // Next event and the milliseconds since the previous one. A DROPFILE
+    // event's file is SDL_strdup'ed; the receiver frees it as SDL would.
+    bool next(SDL_Event& e, Uint32& deltaMs);
+};
+
+} // namespace EventLog
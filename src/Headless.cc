@@ -0,0 +1,484 @@
+#include "Headless.h"
+#include "DrawingUtils.h"
+#include "OffscreenCanvas.h"
+#include "Parallel.h"
+#include "Script.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int kMaxCanvasSide = 16384;  // OffscreenCanvas is one texture, unlike kPen's tiles
+
+struct Options {
+    std::string command;
+    std::vector<std::string> inputs;
+    std::string output;      // -o: single output file ("-" = stdout)
+    std::string outDir;      // -d: output directory (default: next to each input)
+    std::string format;      // --format: output extension without the dot
+    int  quality  = 92;
+    int  jobs     = 0;       // 0 = one per core
+    bool inPlace  = false;
+
+    // Operations, applied in this order: fill, trim, resize.
+    bool fill     = false;
+    int  fillX    = 0, fillY = 0;
+    uint32_t fillColor = 0;
+    bool colorSet = false;
+    bool trim     = false;
+    bool resize   = false;
+    int  newW     = 0, newH = 0;
+    bool scale    = false;
+    int  originX  = 0, originY = 0;
+
+    // run: verification against golden images and between raster paths.
+    std::string goldenDir;   // --golden: compare each result with DIR/<script>.png
+    bool updateGolden = false;
+    int  tolerance    = 0;   // max per-channel difference still counted as equal
+    enum class Renderer { Software, Gpu, Both } renderer = Renderer::Software;
+};
+
+void printUsage() {
+    fprintf(stderr,
+        "usage: kPen --headless <command> [options] <input>...\n"
+        "\n"
+        "commands:\n"
+        "  convert                 re-encode (use --format or -o to pick the format)\n"
+        "  resize  --size WxH      crop/pad from the top-left, or --origin X,Y;\n"
+        "                          --scale stretches the image instead\n"
+        "  fill    --at X,Y --color RRGGBB[AA]\n"
+        "                          flood fill like the Fill tool\n"
+        "  trim                    crop away fully transparent borders\n"
+        "  export                  any of the above options together\n"
+        "                          (applied as fill, then trim, then resize)\n"
+        "  run SCRIPT...           execute drawing command scripts (- for stdin);\n"
+        "                          --size WxH sets the starting canvas (1200x800),\n"
+        "                          -o FILE saves the result when a script ends\n"
+        "      --golden DIR        compare each result with DIR/<script name>.png;\n"
+        "                          on a mismatch DIR/<script name>.actual.png is written\n"
+        "      --update-golden     write the golden images instead of comparing\n"
+        "      --tolerance N       max per-channel difference to accept (default 0)\n"
+        "      --renderer R        software (default), gpu, or both: run every script\n"
+        "                          on each and require identical pixels\n"
+        "\n"
+        "options:\n"
+        "  -o FILE                 output file (one input only; - for stdout)\n"
+        "  -d DIR                  output directory (default: next to the input)\n"
+        "  --format EXT            png, jpg, qoi, pam or ppm (default: input's)\n"
+        "  --quality N             JPEG quality 1-100 (default 92)\n"
+        "  --jobs N                worker threads (default: one per core)\n"
+        "  --in-place              allow overwriting the input file\n"
+        "\n"
+        "An input of - reads a PAM/PPM/PGM image from stdin.\n");
+}
+
+bool parsePair(const char* s, char sep, int& a, int& b) {
+    char* end;
+    long x = strtol(s, &end, 10);
+    if (end == s || *end != sep) return false;
+    const char* t = end + 1;
+    long y = strtol(t, &end, 10);
+    if (end == t || *end) return false;
+    a = (int)x; b = (int)y;
+    return true;
+}
+
+bool parseColor(const char* s, uint32_t& argb) {
+    if (*s == '#') s++;
+    size_t n = strlen(s);
+    if (n != 6 && n != 8) return false;
+    char* end;
+    unsigned long v = strtoul(s, &end, 16);
+    if (*end) return false;
+    if (n == 6) argb = 0xFF000000u | (uint32_t)v;
+    else        argb = ((uint32_t)v >> 8) | ((uint32_t)v << 24);  // RRGGBBAA -> AARRGGBB
+    return true;
+}
+
+// Returns false (after printing why) on a malformed command line.
+bool parseArgs(int argc, char** argv, Options& o) {
+    if (argc < 1) return false;
+    o.command = argv[0];
+    bool isConvert = o.command == "convert", isResize = o.command == "resize",
+         isFill = o.command == "fill", isTrim = o.command == "trim", isExport = o.command == "export",
+         isRun = o.command == "run";
+    if (!isConvert && !isResize && !isFill && !isTrim && !isExport && !isRun) {
+        fprintf(stderr, "kPen: unknown command '%s'\n", o.command.c_str());
+        return false;
+    }
+    o.trim = isTrim;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        auto value = [&]() -> const char* {
+            if (i + 1 >= argc) { fprintf(stderr, "kPen: %s needs a value\n", a.c_str()); return nullptr; }
+            return argv[++i];
+        };
+        auto allowed = [&](bool ok) {
+            if (!ok) fprintf(stderr, "kPen: %s is not valid for '%s'\n", a.c_str(), o.command.c_str());
+            return ok;
+        };
+        const char* v = nullptr;
+        if (a == "-o") {
+            if (!(v = value())) return false;
+            o.output = v;
+        } else if (a == "-d") {
+            if (!(v = value())) return false;
+            o.outDir = v;
+        } else if (a == "--format") {
+            if (!(v = value())) return false;
+            o.format = v;
+            for (auto& c : o.format) c = (char)tolower(c);
+            if (!o.format.empty() && o.format[0] == '.') o.format.erase(0, 1);
+            if (o.format != "png" && o.format != "jpg" && o.format != "jpeg" &&
+                o.format != "qoi" && o.format != "pam" && o.format != "ppm") {
+                fprintf(stderr, "kPen: unsupported format '%s'\n", v);
+                return false;
+            }
+        } else if (a == "--quality") {
+            if (!(v = value())) return false;
+            o.quality = std::max(1, std::min(100, atoi(v)));
+        } else if (a == "--jobs") {
+            if (!(v = value())) return false;
+            o.jobs = std::max(1, atoi(v));
+        } else if (a == "--in-place") {
+            o.inPlace = true;
+        } else if (a == "--size") {
+            if (!allowed(isResize || isExport || isRun) || !(v = value())) return false;
+            if (!parsePair(v, 'x', o.newW, o.newH) || o.newW < 1 || o.newH < 1) {
+                fprintf(stderr, "kPen: bad --size '%s' (expected WxH)\n", v);
+                return false;
+            }
+            o.newW = std::min(kMaxCanvasSide, o.newW);
+            o.newH = std::min(kMaxCanvasSide, o.newH);
+            o.resize = true;
+        } else if (a == "--origin") {
+            if (!allowed(isResize || isExport) || !(v = value())) return false;
+            if (!parsePair(v, ',', o.originX, o.originY)) {
+                fprintf(stderr, "kPen: bad --origin '%s' (expected X,Y)\n", v);
+                return false;
+            }
+        } else if (a == "--scale") {
+            if (!allowed(isResize || isExport)) return false;
+            o.scale = true;
+        } else if (a == "--at") {
+            if (!allowed(isFill || isExport) || !(v = value())) return false;
+            if (!parsePair(v, ',', o.fillX, o.fillY)) {
+                fprintf(stderr, "kPen: bad --at '%s' (expected X,Y)\n", v);
+                return false;
+            }
+            o.fill = true;
+        } else if (a == "--color") {
+            if (!allowed(isFill || isExport) || !(v = value())) return false;
+            if (!parseColor(v, o.fillColor)) {
+                fprintf(stderr, "kPen: bad --color '%s' (expected RRGGBB or RRGGBBAA)\n", v);
+                return false;
+            }
+            o.colorSet = true;
+        } else if (a == "--golden") {
+            if (!allowed(isRun) || !(v = value())) return false;
+            o.goldenDir = v;
+            if (o.goldenDir.back() != '/' && o.goldenDir.back() != '\\') o.goldenDir += '/';
+        } else if (a == "--update-golden") {
+            if (!allowed(isRun)) return false;
+            o.updateGolden = true;
+        } else if (a == "--tolerance") {
+            if (!allowed(isRun) || !(v = value())) return false;
+            o.tolerance = std::max(0, std::min(255, atoi(v)));
+        } else if (a == "--renderer") {
+            if (!allowed(isRun) || !(v = value())) return false;
+            std::string r = v;
+            if      (r == "software") o.renderer = Options::Renderer::Software;
+            else if (r == "gpu")      o.renderer = Options::Renderer::Gpu;
+            else if (r == "both")     o.renderer = Options::Renderer::Both;
+            else {
+                fprintf(stderr, "kPen: bad --renderer '%s' (software, gpu or both)\n", v);
+                return false;
+            }
+        } else if (a == "--trim") {
+            if (!allowed(isExport)) return false;
+            o.trim = true;
+        } else if (a.size() > 1 && a[0] == '-') {
+            fprintf(stderr, "kPen: unknown option '%s'\n", a.c_str());
+            return false;
+        } else {
+            o.inputs.push_back(a);
+        }
+    }
+
+    if (o.inputs.empty()) { fprintf(stderr, "kPen: no input files\n"); return false; }
+    if (isResize && !o.resize) { fprintf(stderr, "kPen: resize needs --size WxH\n"); return false; }
+    if (o.fill != o.colorSet || (isFill && !o.fill)) {
+        fprintf(stderr, "kPen: fill needs both --at X,Y and --color\n");
+        return false;
+    }
+    if (!o.output.empty() && o.inputs.size() != 1) {
+        fprintf(stderr, "kPen: -o takes a single input; use -d for several\n");
+        return false;
+    }
+    if (isRun && (o.scale || o.fill || o.trim || !o.outDir.empty() || !o.format.empty())) {
+        fprintf(stderr, "kPen: run only takes --size, -o, --quality, --jobs and the golden options\n");
+        return false;
+    }
+    if (o.updateGolden && o.goldenDir.empty()) {
+        fprintf(stderr, "kPen: --update-golden needs --golden DIR\n");
+        return false;
+    }
+    if (std::count(o.inputs.begin(), o.inputs.end(), "-") > 1) {
+        fprintf(stderr, "kPen: stdin can only be read once\n");
+        return false;
+    }
+    return true;
+}
+
+bool isWritableExt(const std::string& ext) {
+    return ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".qoi" ||
+           ext == ".pam" || ext == ".ppm";
+}
+
+std::string outputPathFor(const Options& o, const std::string& input) {
+    if (!o.output.empty()) return o.output;
+    if (input == "-") return "-";
+
+    auto sep = input.find_last_of("/\\");
+    std::string dir  = (sep == std::string::npos) ? "" : input.substr(0, sep + 1);
+    std::string name = (sep == std::string::npos) ? input : input.substr(sep + 1);
+    std::string ext;
+    auto dot = name.rfind('.');
+    if (dot != std::string::npos && dot > 0) { ext = name.substr(dot); name = name.substr(0, dot); }
+    for (auto& c : ext) c = (char)tolower(c);
+
+    if (!o.format.empty())      ext = "." + o.format;
+    else if (!isWritableExt(ext)) ext = ".png";  // e.g. .pgm, .bmp, .gif inputs
+    if (!o.outDir.empty()) {
+        dir = o.outDir;
+        if (dir.back() != '/' && dir.back() != '\\') dir += '/';
+    }
+    return dir + name + ext;
+}
+
+// Decode, apply the requested operations, encode. Returns an error message or "".
+std::string processOne(const Options& o, const std::string& input) {
+    std::string out = outputPathFor(o, input);
+    if (out == input && input != "-" && !o.inPlace)
+        return "output would overwrite the input (use --in-place or -d)";
+
+    std::vector<uint32_t> pixels;
+    int w = 0, h = 0;
+    if (!DrawingUtils::readImageFile(input, pixels, w, h)) return "could not read image";
+
+    if (o.fill && !DrawingUtils::floodFill(pixels.data(), w, h, o.fillX, o.fillY, o.fillColor)
+        && (o.fillX < 0 || o.fillX >= w || o.fillY < 0 || o.fillY >= h))
+        return "fill point is outside the image";
+
+    if (o.trim) {
+        SDL_Rect b = DrawingUtils::opaqueBounds(pixels.data(), w, h);
+        if (b.w == 0) return "image is fully transparent; nothing to keep";
+        if (b.w != w || b.h != h) {
+            pixels = DrawingUtils::resizePixels(pixels.data(), w, h, b.w, b.h, false, b.x, b.y);
+            w = b.w; h = b.h;
+        }
+    }
+
+    if (o.resize && (o.newW != w || o.newH != h)) {
+        pixels = DrawingUtils::resizePixels(pixels.data(), w, h, o.newW, o.newH,
+                                            o.scale, o.originX, o.originY);
+        w = o.newW; h = o.newH;
+    }
+
+    const char* format = o.format.empty() ? nullptr : o.format.c_str();
+    if (!DrawingUtils::writeImageFile(out, pixels.data(), w, h, o.quality, format))
+        return "could not write " + out;
+    return "";
+}
+
+struct Image {
+    std::vector<uint32_t> pixels;
+    int w = 0, h = 0;
+};
+
+// "" if a and b match within `tolerance` per channel, otherwise a summary of
+// how many pixels differ, by how much and where.
+std::string compareImages(const Image& a, const Image& b, int tolerance) {
+    if (a.w != b.w || a.h != b.h)
+        return "size " + std::to_string(a.w) + "x" + std::to_string(a.h) + " vs " +
+               std::to_string(b.w) + "x" + std::to_string(b.h);
+    size_t count = 0;
+    int maxDelta = 0;
+    int x0 = a.w, y0 = a.h, x1 = -1, y1 = -1;
+    for (int y = 0; y < a.h; y++) {
+        const uint32_t* pa = a.pixels.data() + (size_t)y * a.w;
+        const uint32_t* pb = b.pixels.data() + (size_t)y * b.w;
+        for (int x = 0; x < a.w; x++) {
+            if (pa[x] == pb[x]) continue;
+            int d = 0;
+            for (int shift = 0; shift < 32; shift += 8)
+                d = std::max(d, std::abs((int)((pa[x] >> shift) & 0xFF) - (int)((pb[x] >> shift) & 0xFF)));
+            maxDelta = std::max(maxDelta, d);
+            if (d <= tolerance) continue;
+            count++;
+            x0 = std::min(x0, x); x1 = std::max(x1, x);
+            y0 = std::min(y0, y); y1 = std::max(y1, y);
+        }
+    }
+    if (!count) return "";
+    char buf[160];
+    snprintf(buf, sizeof(buf), "%zu pixel%s differ (max channel delta %d) in %dx%d at %d,%d",
+             count, count == 1 ? "" : "s", maxDelta, x1 - x0 + 1, y1 - y0 + 1, x0, y0);
+    return buf;
+}
+
+// Golden image for a script: DIR/<file name without extension>.png
+std::string goldenPathFor(const Options& o, const std::string& script) {
+    std::string name = script == "-" ? "stdin" : script;
+    auto sep = name.find_last_of("/\\");
+    if (sep != std::string::npos) name = name.substr(sep + 1);
+    auto dot = name.rfind('.');
+    if (dot != std::string::npos && dot > 0) name = name.substr(0, dot);
+    return o.goldenDir + name + ".png";
+}
+
+// Execute a command script on its own offscreen canvas. Stops at the first error.
+std::string runScript(const Options& o, const std::string& path, bool accelerated,
+                      size_t& commands, Image& result) {
+    Script::Reader reader;
+    if (!reader.open(path)) return "could not open script";
+    OffscreenCanvas canvas(accelerated);
+    canvas.jpegQuality = o.quality;
+    if (!canvas.isRendererValid())
+        return accelerated ? "could not create a GPU renderer" : "could not create a software renderer";
+    int side = canvas.maxCanvasSide();
+    int w = std::min(side, o.resize ? o.newW : 1200), h = std::min(side, o.resize ? o.newH : 800);
+    if (!canvas.newCanvas(w, h)) return "could not create a " + std::to_string(w) + "x" + std::to_string(h) + " canvas";
+
+    Script::Command cmd;
+    while (reader.next(cmd)) {
+        std::string err = Script::execute(canvas, cmd);
+        if (!err.empty()) return "line " + std::to_string(cmd.line) + ": " + err;
+        commands++;
+    }
+    if (!o.output.empty() && !canvas.saveImage(o.output)) return "could not write " + o.output;
+    canvas.commitTool();
+    result.pixels = canvas.readPixels();
+    canvas.getCanvasSize(&result.w, &result.h);
+    return "";
+}
+
+// Run a script on the requested renderer(s) and check the result.
+std::string verifyScript(const Options& o, const std::string& path, size_t& commands) {
+    using R = Options::Renderer;
+    Image result, gpu;
+    std::string err;
+    // The GPU pass goes first so files saved by the script end up holding the
+    // software result, same as a plain run. Stdin can only be read once.
+    if (o.renderer != R::Software) {
+        if (o.renderer == R::Both && path == "-") return "--renderer both cannot read a script from stdin";
+        err = runScript(o, path, true, commands, gpu);
+        if (!err.empty()) return "gpu: " + err;
+        if (o.renderer == R::Gpu) result = std::move(gpu);
+    }
+    if (o.renderer != R::Gpu) {
+        size_t n = 0;
+        err = runScript(o, path, false, o.renderer == R::Both ? n : commands, result);
+        if (!err.empty()) return err;
+    }
+    if (o.renderer == R::Both) {
+        err = compareImages(result, gpu, o.tolerance);
+        if (!err.empty()) return "gpu and software renderers differ: " + err;
+    }
+
+    if (o.goldenDir.empty()) return "";
+    std::string golden = goldenPathFor(o, path);
+    if (o.updateGolden) {
+        if (!DrawingUtils::writeImageFile(golden, result.pixels.data(), result.w, result.h))
+            return "could not write " + golden;
+        return "";
+    }
+    // On a mismatch or a missing golden the result goes to .actual.png, so
+    // it can be inspected (or, once checked, renamed into place).
+    std::string actual = golden.substr(0, golden.size() - 4) + ".actual.png";
+    Image expected;
+    if (!DrawingUtils::readImageFile(golden, expected.pixels, expected.w, expected.h)) {
+        DrawingUtils::writeImageFile(actual, result.pixels.data(), result.w, result.h);
+        return "could not read golden image " + golden + " (create it with --update-golden); wrote " + actual;
+    }
+    err = compareImages(result, expected, o.tolerance);
+    if (err.empty()) return "";
+    DrawingUtils::writeImageFile(actual, result.pixels.data(), result.w, result.h);
+    return "does not match " + golden + ": " + err + "; wrote " + actual;
+}
+
+} // namespace
+
+namespace Headless {
+
+int run(int argc, char** argv) {
+    // argv[0] is the program, argv[1] is --headless.
+    Options o;
+    if (argc < 3 || !strcmp(argv[2], "--help") || !strcmp(argv[2], "-h")) {
+        printUsage();
+        return argc < 3 ? 2 : 0;
+    }
+    if (!parseArgs(argc - 2, argv + 2, o)) {
+        fprintf(stderr, "Run 'kPen --headless --help' for usage.\n");
+        return 2;
+    }
+
+    int jobs = o.jobs ? o.jobs : Parallel::workerCount(o.inputs.size(), 1);
+    jobs = std::max(1, std::min(jobs, (int)o.inputs.size()));
+    if (o.renderer != Options::Renderer::Software) jobs = 1;  // GPU renderers stay on the main thread
+
+    const bool isRun = o.command == "run";
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> commands{0};
+    std::atomic<int> failures{0};
+    std::mutex logMutex;
+    auto worker = [&]() {
+        // Encoders split only this worker's share of the cores (serial when
+        // the pool already has a job per core).
+        Parallel::Budget budget(Parallel::coreCount() / jobs);
+        for (size_t i; (i = next.fetch_add(1)) < o.inputs.size(); ) {
+            std::string err;
+            if (isRun) {
+                size_t n = 0;
+                err = verifyScript(o, o.inputs[i], n);
+                commands += n;
+            } else {
+                err = processOne(o, o.inputs[i]);
+            }
+            if (err.empty()) continue;
+            failures++;
+            std::lock_guard<std::mutex> lock(logMutex);
+            fprintf(stderr, "kPen: %s: %s\n", o.inputs[i].c_str(), err.c_str());
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (int t = 0; t < jobs - 1; t++) pool.emplace_back(worker);
+    worker();
+    for (auto& th : pool) th.join();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int done = (int)o.inputs.size() - failures.load();
+    if (isRun) {
+        fprintf(stderr, "%d of %zu script%s, %zu commands in %.2fs (%.0f commands/sec, %d job%s)\n",
+                done, o.inputs.size(), o.inputs.size() == 1 ? "" : "s", commands.load(), secs,
+                secs > 0 ? commands.load() / secs : 0.0, jobs, jobs == 1 ? "" : "s");
+        return failures ? 1 : 0;
+    }
+    fprintf(stderr, "%d of %zu image%s in %.2fs (%.1f images/sec, %d job%s)\n",
+            done, o.inputs.size(), o.inputs.size() == 1 ? "" : "s", secs,
+            secs > 0 ? done / secs : 0.0, jobs, jobs == 1 ? "" : "s");
+    return failures ? 1 : 0;
+}
+
+} // namespace Headless
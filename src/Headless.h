@@ -0,0 +1,13 @@
+#pragma once
+
+// Headless — `kPen --headless <command> ...` batch mode.
+//
+// Runs the same decode / canvas / encode paths as the GUI (DrawingUtils) with
+// no window or renderer. Inputs are processed on a worker pool; a summary with
+// throughput goes to stderr. Returns the process exit code.
+
+namespace Headless {
+
+int run(int argc, char** argv);
+
+} // namespace Headless
@@ -0,0 +1,35 @@
+#include "ImageLoader.h"
+#include "DrawingUtils.h"
+#include <SDL2/SDL.h>
+#include <climits>
+#include <thread>
+#include <utility>
+
+namespace {
+
+void loadThread(MappedFile file, std::string path, unsigned generation) {
+    ImageLoader::Result* result = new ImageLoader::Result();
+    result->path = std::move(path);
+    result->generation = generation;
+    if (file.size() <= static_cast<size_t>(INT_MAX))
+        result->pixels = DrawingUtils::decodeImage(file.data(), static_cast<int>(file.size()),
+                                                   result->w, result->h);
+    file.close();
+    SDL_Event ev = {};
+    ev.type = SDL_USEREVENT;
+    ev.user.code = ImageLoader::IMAGE_LOAD_RESULT;
+    ev.user.data1 = result;
+    ev.user.data2 = nullptr;
+    SDL_PushEvent(&ev);
+}
+
+} // namespace
+
+namespace ImageLoader {
+
+void startLoadAsync(MappedFile file, const std::string& path, unsigned generation) {
+    std::thread t(loadThread, std::move(file), path, generation);
+    t.detach();
+}
+
+} // namespace ImageLoader
@@ -0,0 +1,29 @@
+#pragma once
+
+// ImageLoader — decodes an image file on a worker thread so opening a large
+// file never blocks the UI. The file is memory-mapped by the caller (which
+// probes the header for the placeholder size first) and handed over; when
+// decoding finishes an SDL_USEREVENT is pushed:
+//   - code IMAGE_LOAD_RESULT, data1 = ImageLoader::Result* (receiver must delete)
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+
+namespace ImageLoader {
+
+enum : int {
+    IMAGE_LOAD_RESULT = 1104  // data1 = Result*
+};
+
+struct Result {
+    std::string path;
+    unsigned generation = 0;  // matches the request; stale results are discarded
+    int w = 0, h = 0;
+    std::vector<uint32_t> pixels;  // ARGB8888, empty on failure
+};
+
+void startLoadAsync(MappedFile file, const std::string& path, unsigned generation);
+
+} // namespace ImageLoader
@@ -0,0 +1,376 @@
+#include "JpegEncoder.h"
+#include "Parallel.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// Natural (row-major) coefficient index -> position in zigzag order.
+const uint8_t kZigzag[64] = {
+     0,  1,  5,  6, 14, 15, 27, 28,  2,  4,  7, 13, 16, 26, 29, 42,
+     3,  8, 12, 17, 25, 30, 41, 43,  9, 11, 18, 24, 31, 40, 44, 53,
+    10, 19, 23, 32, 39, 45, 52, 54, 20, 22, 33, 38, 46, 51, 55, 60,
+    21, 34, 37, 47, 50, 56, 59, 61, 35, 36, 48, 49, 57, 58, 62, 63
+};
+
+// ITU T.81 Annex K tables.
+const uint8_t kLumQ[64] = {
+    16, 11, 10, 16,  24,  40,  51,  61,  12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16, 24,  40,  57,  69,  56,  14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37, 56,  68, 109, 103,  77,  24, 35, 55, 64,  81, 104, 113,  92,
+    49, 64, 78, 87, 103, 121, 120, 101,  72, 92, 95, 98, 112, 100, 103,  99
+};
+const uint8_t kChromQ[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,  18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,  47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,  99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,  99, 99, 99, 99, 99, 99, 99, 99
+};
+
+const uint8_t kDcLumBits[16]   = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+const uint8_t kDcChromBits[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+const uint8_t kDcVals[12]      = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+const uint8_t kAcLumBits[16]   = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+const uint8_t kAcLumVals[162]  = {
+    0x01,0x02,0x03,0x00,0x04,0x11,0x05,0x12,0x21,0x31,0x41,0x06,0x13,0x51,0x61,0x07,0x22,0x71,0x14,0x32,0x81,0x91,0xa1,0x08,
+    0x23,0x42,0xb1,0xc1,0x15,0x52,0xd1,0xf0,0x24,0x33,0x62,0x72,0x82,0x09,0x0a,0x16,0x17,0x18,0x19,0x1a,0x25,0x26,0x27,0x28,
+    0x29,0x2a,0x34,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,0x59,
+    0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x83,0x84,0x85,0x86,0x87,0x88,0x89,
+    0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,0xb5,0xb6,
+    0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,0xe1,0xe2,
+    0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa
+};
+const uint8_t kAcChromBits[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+const uint8_t kAcChromVals[162] = {
+    0x00,0x01,0x02,0x03,0x11,0x04,0x05,0x21,0x31,0x06,0x12,0x41,0x51,0x07,0x61,0x71,0x13,0x22,0x32,0x81,0x08,0x14,0x42,0x91,
+    0xa1,0xb1,0xc1,0x09,0x23,0x33,0x52,0xf0,0x15,0x62,0x72,0xd1,0x0a,0x16,0x24,0x34,0xe1,0x25,0xf1,0x17,0x18,0x19,0x1a,0x26,
+    0x27,0x28,0x29,0x2a,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,
+    0x59,0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x82,0x83,0x84,0x85,0x86,0x87,
+    0x88,0x89,0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,
+    0xb5,0xb6,0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,
+    0xe2,0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa
+};
+
+// AAN output scale factors (including the sqrt(8) normalisation) per frequency.
+const float kAanScale[8] = {
+    1.0f * 2.828427125f, 1.387039845f * 2.828427125f, 1.306562965f * 2.828427125f, 1.175875602f * 2.828427125f,
+    1.0f * 2.828427125f, 0.785694958f * 2.828427125f, 0.541196100f * 2.828427125f, 0.275899379f * 2.828427125f
+};
+
+struct HuffCode { uint16_t code; uint8_t len; };
+struct HuffTable { HuffCode c[256]; };
+
+HuffTable buildHuffTable(const uint8_t bits[16], const uint8_t* vals) {
+    HuffTable t = {};
+    int code = 0, k = 0;
+    for (int len = 1; len <= 16; len++) {
+        for (int i = 0; i < bits[len - 1]; i++, k++, code++)
+            t.c[vals[k]] = { (uint16_t)code, (uint8_t)len };
+        code <<= 1;
+    }
+    return t;
+}
+
+struct Tables {
+    uint8_t qLum[64], qChrom[64];        // natural order
+    // Indexed by position t in the transposed DCT output (t = v*8 + u).
+    float scaleLum[64], scaleChrom[64];  // 1 / (quant * AAN scale)
+    uint8_t zz[64];                      // zigzag position
+    HuffTable dcLum, acLum, dcChrom, acChrom;
+};
+
+void buildTables(int quality, Tables& t) {
+    quality = std::max(1, std::min(100, quality));
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    for (int n = 0; n < 64; n++) {
+        t.qLum[n]   = (uint8_t)std::max(1, std::min(255, (kLumQ[n]   * scale + 50) / 100));
+        t.qChrom[n] = (uint8_t)std::max(1, std::min(255, (kChromQ[n] * scale + 50) / 100));
+    }
+    for (int tpos = 0; tpos < 64; tpos++) {
+        int u = tpos % 8, v = tpos / 8;  // vertical, horizontal frequency
+        int n = u * 8 + v;
+        t.scaleLum[tpos]   = 1.0f / (t.qLum[n]   * kAanScale[u] * kAanScale[v]);
+        t.scaleChrom[tpos] = 1.0f / (t.qChrom[n] * kAanScale[u] * kAanScale[v]);
+        t.zz[tpos] = kZigzag[n];
+    }
+    t.dcLum   = buildHuffTable(kDcLumBits,   kDcVals);
+    t.acLum   = buildHuffTable(kAcLumBits,   kAcLumVals);
+    t.dcChrom = buildHuffTable(kDcChromBits, kDcVals);
+    t.acChrom = buildHuffTable(kAcChromBits, kAcChromVals);
+}
+
+class BitWriter {
+  public:
+    explicit BitWriter(std::vector<uint8_t>& out) : out_(out) {}
+    void put(uint32_t code, int len) {
+        acc_ = (acc_ << len) | code;
+        n_ += len;
+        while (n_ >= 8) {
+            n_ -= 8;
+            uint8_t b = (uint8_t)(acc_ >> n_);
+            out_.push_back(b);
+            if (b == 0xFF) out_.push_back(0);  // byte stuffing
+        }
+    }
+    void put(const HuffCode& h) { put(h.code, h.len); }
+    // Pad the partial byte with 1-bits, as required before a marker.
+    void align() {
+        if (n_ > 0) put((1u << (8 - n_)) - 1, 8 - n_);
+        acc_ = 0;
+    }
+  private:
+    std::vector<uint8_t>& out_;
+    uint64_t acc_ = 0;
+    int n_ = 0;
+};
+
+inline int bitLength(int v) {
+    int n = 0;
+    while (v) { n++; v >>= 1; }
+    return n;
+}
+
+// 8-point AAN forward DCT down each column of an 8x8 block (d[row*8 + col]).
+// The eight columns are independent lanes with unit stride, so the compiler
+// turns the loop body into SIMD arithmetic (SSE/NEON) without intrinsics.
+void fdctColumns(float* d) {
+    for (int j = 0; j < 8; j++) {
+        float tmp0 = d[0*8+j] + d[7*8+j], tmp7 = d[0*8+j] - d[7*8+j];
+        float tmp1 = d[1*8+j] + d[6*8+j], tmp6 = d[1*8+j] - d[6*8+j];
+        float tmp2 = d[2*8+j] + d[5*8+j], tmp5 = d[2*8+j] - d[5*8+j];
+        float tmp3 = d[3*8+j] + d[4*8+j], tmp4 = d[3*8+j] - d[4*8+j];
+
+        // Even part
+        float tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+        float tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+        float z1 = (tmp12 + tmp13) * 0.707106781f;
+        d[0*8+j] = tmp10 + tmp11;
+        d[4*8+j] = tmp10 - tmp11;
+        d[2*8+j] = tmp13 + z1;
+        d[6*8+j] = tmp13 - z1;
+
+        // Odd part
+        tmp10 = tmp4 + tmp5;
+        tmp11 = tmp5 + tmp6;
+        tmp12 = tmp6 + tmp7;
+        float z5 = (tmp10 - tmp12) * 0.382683433f;
+        float z2 = tmp10 * 0.541196100f + z5;
+        float z4 = tmp12 * 1.306562965f + z5;
+        float z3 = tmp11 * 0.707106781f;
+        float z11 = tmp7 + z3, z13 = tmp7 - z3;
+        d[5*8+j] = z13 + z2;
+        d[3*8+j] = z13 - z2;
+        d[1*8+j] = z11 + z4;
+        d[7*8+j] = z11 - z4;
+    }
+}
+
+inline void transpose8x8(float* d) {
+    for (int i = 0; i < 8; i++)
+        for (int j = i + 1; j < 8; j++) std::swap(d[i*8+j], d[j*8+i]);
+}
+
+// DCT, quantise and Huffman-code one 8x8 block; returns its DC for prediction.
+int encodeBlock(float* blk, const float* scale, const uint8_t* zz, int prevDC,
+                const HuffTable& dc, const HuffTable& ac, BitWriter& bw) {
+    fdctColumns(blk);
+    transpose8x8(blk);
+    fdctColumns(blk);
+
+    int q[64];
+    for (int t = 0; t < 64; t++) {
+        float v = blk[t] * scale[t];
+        q[zz[t]] = (int)(v < 0 ? v - 0.5f : v + 0.5f);
+    }
+
+    int diff = q[0] - prevDC;
+    int n = bitLength(std::abs(diff));
+    bw.put(dc.c[n]);
+    if (n) bw.put((uint32_t)(diff < 0 ? diff - 1 : diff) & ((1u << n) - 1), n);
+
+    int end = 63;
+    while (end > 0 && q[end] == 0) end--;
+    for (int i = 1; i <= end; i++) {
+        int run = 0;
+        while (q[i] == 0) { run++; i++; }
+        for (; run >= 16; run -= 16) bw.put(ac.c[0xF0]);  // ZRL
+        int v = q[i];
+        n = bitLength(std::abs(v));
+        bw.put(ac.c[(run << 4) | n]);
+        bw.put((uint32_t)(v < 0 ? v - 1 : v) & ((1u << n) - 1), n);
+    }
+    if (end != 63) bw.put(ac.c[0x00]);  // EOB
+    return q[0];
+}
+
+inline void loadBlock(const float* plane, int stride, int x, float* blk) {
+    for (int r = 0; r < 8; r++) std::memcpy(blk + r * 8, plane + (size_t)r * stride + x, 8 * sizeof(float));
+}
+
+void putMarker(std::vector<uint8_t>& out, uint8_t marker, int length) {
+    out.push_back(0xFF);
+    out.push_back(marker);
+    if (length >= 0) { out.push_back((uint8_t)(length >> 8)); out.push_back((uint8_t)length); }
+}
+
+} // namespace
+
+namespace JpegEncoder {
+
+std::vector<uint8_t> encode(const uint32_t* argbPixels, int w, int h, int quality) {
+    if (!argbPixels || w <= 0 || h <= 0 || w > 65535 || h > 65535) return {};
+    quality = std::max(1, std::min(100, quality));
+    const bool subsample = quality <= 90;
+    Tables tab;
+    buildTables(quality, tab);
+
+    const int mcuSize = subsample ? 16 : 8;
+    const int mcusX = (w + mcuSize - 1) / mcuSize;
+    const int mcusY = (h + mcuSize - 1) / mcuSize;
+    const int padW = mcusX * mcuSize;
+    const int chromaW = subsample ? padW / 2 : padW;
+
+    // Each MCU row is one restart interval, encoded independently.
+    std::vector<std::vector<uint8_t>> segments(mcusY);
+    const int threads = Parallel::workerCount((size_t)w * h, 1 << 18);
+    Parallel::parallelFor(threads, mcusY, [&](int row0, int row1) {
+        KPEN_TRACE_ZONE("jpeg.encodeRows");
+        std::vector<float> Y((size_t)mcuSize * padW), Cb((size_t)mcuSize * padW), Cr((size_t)mcuSize * padW);
+        std::vector<float> Cb2, Cr2;
+        if (subsample) { Cb2.resize((size_t)8 * chromaW); Cr2.resize((size_t)8 * chromaW); }
+        std::vector<int32_t> iy(padW), icb(padW), icr(padW);
+        float blk[64];
+
+        for (int my = row0; my < row1; my++) {
+            // Color conversion in 16.16 fixed point (alpha composited over white,
+            // edges replicated out to the MCU grid).
+            for (int ry = 0; ry < mcuSize; ry++) {
+                int y = std::min(my * mcuSize + ry, h - 1);
+                const uint32_t* src = argbPixels + (size_t)y * w;
+                for (int x = 0; x < w; x++) {
+                    uint32_t px = src[x];
+                    int32_t a = (int32_t)(px >> 24);
+                    int32_t r = (int32_t)((px >> 16) & 0xFF);
+                    int32_t g = (int32_t)((px >>  8) & 0xFF);
+                    int32_t b = (int32_t)( px        & 0xFF);
+                    r += (255 - r) * (255 - a) / 255;
+                    g += (255 - g) * (255 - a) / 255;
+                    b += (255 - b) * (255 - a) / 255;
+                    iy[x]  = ( 19595 * r + 38470 * g +  7471 * b + 32768) >> 16;
+                    icb[x] = (-11059 * r - 21709 * g + 32768 * b + (128 << 16) + 32768) >> 16;
+                    icr[x] = ( 32768 * r - 27439 * g -  5329 * b + (128 << 16) + 32768) >> 16;
+                }
+                float* yRow  = Y.data()  + (size_t)ry * padW;
+                float* cbRow = Cb.data() + (size_t)ry * padW;
+                float* crRow = Cr.data() + (size_t)ry * padW;
+                for (int x = 0; x < padW; x++) {
+                    int sx = std::min(x, w - 1);
+                    yRow[x]  = (float)(iy[sx]  - 128);
+                    cbRow[x] = (float)(icb[sx] - 128);
+                    crRow[x] = (float)(icr[sx] - 128);
+                }
+            }
+            if (subsample) {
+                for (int ry = 0; ry < 8; ry++) {
+                    const float* c0 = Cb.data() + (size_t)(ry * 2) * padW;
+                    const float* c1 = c0 + padW;
+                    const float* d0 = Cr.data() + (size_t)(ry * 2) * padW;
+                    const float* d1 = d0 + padW;
+                    float* cbOut = Cb2.data() + (size_t)ry * chromaW;
+                    float* crOut = Cr2.data() + (size_t)ry * chromaW;
+                    for (int x = 0; x < chromaW; x++) {
+                        cbOut[x] = (c0[2*x] + c0[2*x+1] + c1[2*x] + c1[2*x+1]) * 0.25f;
+                        crOut[x] = (d0[2*x] + d0[2*x+1] + d1[2*x] + d1[2*x+1]) * 0.25f;
+                    }
+                }
+            }
+
+            std::vector<uint8_t>& out = segments[my];
+            out.reserve((size_t)padW * mcuSize / 2);
+            BitWriter bw(out);
+            int dcY = 0, dcCb = 0, dcCr = 0;  // predictors reset at every restart
+            const float* cbPlane = subsample ? Cb2.data() : Cb.data();
+            const float* crPlane = subsample ? Cr2.data() : Cr.data();
+            for (int mx = 0; mx < mcusX; mx++) {
+                if (subsample) {
+                    for (int by = 0; by < 2; by++)
+                        for (int bx = 0; bx < 2; bx++) {
+                            loadBlock(Y.data() + (size_t)by * 8 * padW, padW, mx * 16 + bx * 8, blk);
+                            dcY = encodeBlock(blk, tab.scaleLum, tab.zz, dcY, tab.dcLum, tab.acLum, bw);
+                        }
+                    loadBlock(cbPlane, chromaW, mx * 8, blk);
+                    dcCb = encodeBlock(blk, tab.scaleChrom, tab.zz, dcCb, tab.dcChrom, tab.acChrom, bw);
+                    loadBlock(crPlane, chromaW, mx * 8, blk);
+                    dcCr = encodeBlock(blk, tab.scaleChrom, tab.zz, dcCr, tab.dcChrom, tab.acChrom, bw);
+                } else {
+                    loadBlock(Y.data(), padW, mx * 8, blk);
+                    dcY = encodeBlock(blk, tab.scaleLum, tab.zz, dcY, tab.dcLum, tab.acLum, bw);
+                    loadBlock(cbPlane, chromaW, mx * 8, blk);
+                    dcCb = encodeBlock(blk, tab.scaleChrom, tab.zz, dcCb, tab.dcChrom, tab.acChrom, bw);
+                    loadBlock(crPlane, chromaW, mx * 8, blk);
+                    dcCr = encodeBlock(blk, tab.scaleChrom, tab.zz, dcCr, tab.dcChrom, tab.acChrom, bw);
+                }
+            }
+            bw.align();
+            if (my != mcusY - 1) { out.push_back(0xFF); out.push_back((uint8_t)(0xD0 + (my & 7))); }
+        }
+    });
+
+    std::vector<uint8_t> out;
+    size_t total = 1024;
+    for (const auto& s : segments) total += s.size();
+    out.reserve(total);
+
+    putMarker(out, 0xD8, -1);  // SOI
+    static const uint8_t jfif[] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+    putMarker(out, 0xE0, 2 + sizeof(jfif));
+    out.insert(out.end(), jfif, jfif + sizeof(jfif));
+
+    putMarker(out, 0xDB, 2 + 2 * 65);  // DQT, tables in zigzag order
+    uint8_t qz[64];
+    out.push_back(0);
+    for (int n = 0; n < 64; n++) qz[kZigzag[n]] = tab.qLum[n];
+    out.insert(out.end(), qz, qz + 64);
+    out.push_back(1);
+    for (int n = 0; n < 64; n++) qz[kZigzag[n]] = tab.qChrom[n];
+    out.insert(out.end(), qz, qz + 64);
+
+    putMarker(out, 0xC0, 17);  // SOF0
+    const uint8_t sof[] = {
+        8, (uint8_t)(h >> 8), (uint8_t)h, (uint8_t)(w >> 8), (uint8_t)w, 3,
+        1, (uint8_t)(subsample ? 0x22 : 0x11), 0,
+        2, 0x11, 1,
+        3, 0x11, 1
+    };
+    out.insert(out.end(), sof, sof + sizeof(sof));
+
+    putMarker(out, 0xC4, 2 + 4 * 17 + 12 + 162 + 12 + 162);  // DHT
+    auto putHuff = [&](uint8_t cls, const uint8_t* bits, const uint8_t* vals, int nvals) {
+        out.push_back(cls);
+        out.insert(out.end(), bits, bits + 16);
+        out.insert(out.end(), vals, vals + nvals);
+    };
+    putHuff(0x00, kDcLumBits,   kDcVals,      12);
+    putHuff(0x10, kAcLumBits,   kAcLumVals,   162);
+    putHuff(0x01, kDcChromBits, kDcVals,      12);
+    putHuff(0x11, kAcChromBits, kAcChromVals, 162);
+
+    putMarker(out, 0xDD, 4);  // DRI: one MCU row per restart interval
+    out.push_back((uint8_t)(mcusX >> 8));
+    out.push_back((uint8_t)mcusX);
+
+    putMarker(out, 0xDA, 12);  // SOS
+    static const uint8_t sos[] = { 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 };
+    out.insert(out.end(), sos, sos + sizeof(sos));
+
+    for (auto& s : segments) {
+        out.insert(out.end(), s.begin(), s.end());
+        std::vector<uint8_t>().swap(s);
+    }
+    putMarker(out, 0xD9, -1);  // EOI
+    return out;
+}
+
+} // namespace JpegEncoder
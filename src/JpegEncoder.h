@@ -0,0 +1,18 @@
+#pragma once
+
+// JpegEncoder — baseline (SOF0) JPEG writer that encodes in parallel.
+//
+// The restart interval is one MCU row, so every MCU row is an independent
+// entropy-coded segment (DC predictors reset, byte aligned, followed by an
+// RSTn marker). Row bands are encoded on worker threads and concatenated in
+// order; any baseline decoder reads the result. Alpha is composited over white.
+// Chroma is 4:2:0 at quality <= 90 and 4:4:4 above.
+
+#include <cstdint>
+#include <vector>
+
+namespace JpegEncoder {
+
+std::vector<uint8_t> encode(const uint32_t* argbPixels, int w, int h, int quality);
+
+} // namespace JpegEncoder
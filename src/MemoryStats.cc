@@ -0,0 +1,117 @@
+#include "MemoryStats.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <unordered_map>
+
+namespace MemoryStats {
+
+namespace {
+
+std::atomic<long long> gBytes[CATEGORY_COUNT];
+std::atomic<size_t>    gSoftLimit{0};
+std::atomic<size_t>    gTrimmed{0};
+std::atomic<long long> gOnDisk{0};
+
+// Headless runs create and destroy tool textures on worker threads.
+struct TextureInfo { Category category; size_t bytes; };
+std::mutex gTexMutex;
+std::unordered_map<SDL_Texture*, TextureInfo> gTextures;
+
+} // namespace
+
+const char* name(Category c) {
+    static const char* names[CATEGORY_COUNT] = {
+        "UNDO TILES", "KEYFRAMES", "REDO", "UNDO CACHE",
+        "CANVAS TEX", "OVERLAY TEX", "SELECT TEX", "TEMP TEX"
+    };
+    return (c >= 0 && c < CATEGORY_COUNT) ? names[c] : "?";
+}
+
+void add(Category c, long long deltaBytes) {
+    gBytes[c].fetch_add(deltaBytes, std::memory_order_relaxed);
+}
+
+size_t bytes(Category c) {
+    long long b = gBytes[c].load(std::memory_order_relaxed);
+    return b > 0 ? (size_t)b : 0;
+}
+
+size_t total() {
+    size_t sum = 0;
+    for (int c = 0; c < CATEGORY_COUNT; c++) sum += bytes((Category)c);
+    return sum;
+}
+
+void setSoftLimit(size_t b) { gSoftLimit.store(b, std::memory_order_relaxed); }
+size_t softLimit()          { return gSoftLimit.load(std::memory_order_relaxed); }
+
+bool overSoftLimit() {
+    size_t limit = softLimit();
+    return limit && total() > limit;
+}
+
+size_t defaultSoftLimit() {
+    if (const char* env = getenv("KPEN_MEMORY_LIMIT_MB"))
+        return (size_t)strtoull(env, nullptr, 10) << 20;
+    int ramMB = SDL_GetSystemRAM();
+    return ramMB > 0 ? ((size_t)ramMB << 20) / 4 : 0;
+}
+
+void noteTrimmed(size_t steps) { gTrimmed.fetch_add(steps, std::memory_order_relaxed); }
+size_t trimmedSteps()          { return gTrimmed.load(std::memory_order_relaxed); }
+
+void addOnDisk(long long deltaBytes) { gOnDisk.fetch_add(deltaBytes, std::memory_order_relaxed); }
+
+size_t onDisk() {
+    long long b = gOnDisk.load(std::memory_order_relaxed);
+    return b > 0 ? (size_t)b : 0;
+}
+
+std::string report() {
+    const double MB = 1024.0 * 1024.0;
+    std::string out = "kPen memory (MB)\n";
+    char line[64];
+    for (int c = 0; c < CATEGORY_COUNT; c++) {
+        snprintf(line, sizeof(line), "  %-12s %10.2f\n", name((Category)c), bytes((Category)c) / MB);
+        out += line;
+    }
+    snprintf(line, sizeof(line), "  %-12s %10.2f\n", "TOTAL", total() / MB);
+    out += line;
+    if (size_t limit = softLimit()) snprintf(line, sizeof(line), "  %-12s %10.2f\n", "SOFT LIMIT", limit / MB);
+    else                            snprintf(line, sizeof(line), "  %-12s %10s\n", "SOFT LIMIT", "none");
+    out += line;
+    snprintf(line, sizeof(line), "  %-12s %10.2f\n", "UNDO ON DISK", onDisk() / MB);
+    out += line;
+    snprintf(line, sizeof(line), "  undo steps trimmed: %zu\n", trimmedSteps());
+    out += line;
+    return out;
+}
+
+SDL_Texture* createTexture(SDL_Renderer* r, Uint32 format, int access, int w, int h, Category c) {
+    SDL_Texture* tex = SDL_CreateTexture(r, format, access, w, h);
+    if (!tex) return nullptr;
+    size_t b = (size_t)w * (size_t)h * SDL_BYTESPERPIXEL(format);
+    {
+        std::lock_guard<std::mutex> lock(gTexMutex);
+        gTextures[tex] = { c, b };
+    }
+    add(c, (long long)b);
+    return tex;
+}
+
+void destroyTexture(SDL_Texture* tex) {
+    if (!tex) return;
+    {
+        std::lock_guard<std::mutex> lock(gTexMutex);
+        auto it = gTextures.find(tex);
+        if (it != gTextures.end()) {
+            add(it->second.category, -(long long)it->second.bytes);
+            gTextures.erase(it);
+        }
+    }
+    SDL_DestroyTexture(tex);
+}
+
+} // namespace MemoryStats
@@ -0,0 +1,62 @@
+#pragma once
+
+// MemoryStats — byte accounting for the big allocations: undo history, its
+// caches, and the GPU textures kPen creates.
+//
+// Counters are process-wide and updated by their owners (UndoManager
+// publishes after every mutation; textures are counted by creating and
+// destroying them through createTexture / destroyTexture). Texture bytes are
+// w * h * bytes-per-pixel, i.e. what the driver must hold, not what it
+// actually reserves.
+//
+// A soft limit (0 = none) lets UndoManager drop its oldest steps once the
+// tracked total goes over it, well before an allocation would fail.
+
+#include <SDL2/SDL.h>
+#include <cstddef>
+#include <string>
+
+namespace MemoryStats {
+
+enum Category {
+    UNDO_TILES,         // changed 32x32 tiles and stroke commands of delta undo steps
+    UNDO_KEYFRAMES,     // full-canvas undo steps
+    REDO,               // undone steps' handle lists and keyframes
+    UNDO_CACHE,         // cached copy of the top undo state
+    CANVAS_TEXTURE,
+    OVERLAY_TEXTURE,
+    SELECTION_TEXTURE,  // floating selection / paste
+    TEMP_TEXTURE,       // short-lived render targets
+    CATEGORY_COUNT
+};
+
+const char* name(Category c);
+
+void   add(Category c, long long deltaBytes);
+size_t bytes(Category c);
+size_t total();
+
+void   setSoftLimit(size_t bytes);
+size_t softLimit();
+bool   overSoftLimit();
+// KPEN_MEMORY_LIMIT_MB if set (0 disables), else a quarter of system RAM.
+size_t defaultSoftLimit();
+
+// Undo steps dropped to stay under the soft limit since startup.
+void   noteTrimmed(size_t steps);
+size_t trimmedSteps();
+
+// Undo history moved out to the scratch file. Not part of total(): it is
+// disk, not RAM.
+void   addOnDisk(long long deltaBytes);
+size_t onDisk();
+
+// Per-category table in MB with the total and soft limit.
+std::string report();
+
+// SDL_CreateTexture / SDL_DestroyTexture that keep the texture categories
+// current. destroyTexture accepts nullptr and untracked textures.
+SDL_Texture* createTexture(SDL_Renderer* r, Uint32 format, int access, int w, int h, Category c);
+void         destroyTexture(SDL_Texture* tex);
+
+} // namespace MemoryStats
@@ -0,0 +1,186 @@
+#include "OffscreenCanvas.h"
+#include "DrawingUtils.h"
+#include "MemoryStats.h"
+#include "TiledCanvas.h"
+#include "Trace.h"
+#include <algorithm>
+
+OffscreenCanvas::OffscreenCanvas(bool accelerated) {
+    if (accelerated) {
+        if (SDL_InitSubSystem(SDL_INIT_VIDEO) != 0) return;
+        window_ = SDL_CreateWindow("kPen", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                                   1, 1, SDL_WINDOW_HIDDEN);
+        if (window_)
+            renderer_ = SDL_CreateRenderer(window_, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
+        return;
+    }
+    surface_ = SDL_CreateRGBSurfaceWithFormat(0, 1, 1, 32, SDL_PIXELFORMAT_ARGB8888);
+    if (surface_) renderer_ = SDL_CreateSoftwareRenderer(surface_);
+}
+
+OffscreenCanvas::~OffscreenCanvas() {
+    tool_.reset();
+    MemoryStats::destroyTexture(canvas_);
+    if (renderer_) SDL_DestroyRenderer(renderer_);
+    if (surface_)  SDL_FreeSurface(surface_);
+    if (window_) {
+        SDL_DestroyWindow(window_);
+        SDL_QuitSubSystem(SDL_INIT_VIDEO);
+    }
+}
+
+const char* OffscreenCanvas::rendererName() {
+    SDL_RendererInfo info;
+    if (!renderer_ || SDL_GetRendererInfo(renderer_, &info) != 0) return "none";
+    return info.name;
+}
+
+std::vector<uint32_t> OffscreenCanvas::readPixels() {
+    std::vector<uint32_t> pixels(static_cast<size_t>(canvasW_) * canvasH_);
+    if (canvas_)
+        SDL_RenderReadPixels(renderer_, nullptr, SDL_PIXELFORMAT_ARGB8888, pixels.data(), canvasW_ * 4);
+    return pixels;
+}
+
+// ── ICoordinateMapper ─────────────────────────────────────────────────────────
+
+void OffscreenCanvas::getCanvasCoords(int winX, int winY, int* cX, int* cY) {
+    *cX = winX - kWindowOffset;
+    *cY = winY - kWindowOffset;
+}
+
+void OffscreenCanvas::getWindowCoords(int canX, int canY, int* wX, int* wY) {
+    *wX = canX + kWindowOffset;
+    *wY = canY + kWindowOffset;
+}
+
+// ── Canvas ────────────────────────────────────────────────────────────────────
+
+// The canvas stays the render target for the renderer's whole life, so tools
+// can be handed renderer_ directly.
+bool OffscreenCanvas::replaceCanvas(int w, int h, const uint32_t* pixels) {
+    if (!renderer_) return false;
+    SDL_Texture* tex = MemoryStats::createTexture(renderer_, SDL_PIXELFORMAT_ARGB8888,
+                                         SDL_TEXTUREACCESS_TARGET, w, h, MemoryStats::CANVAS_TEXTURE);
+    if (!tex) return false;
+    SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderTarget(renderer_, tex);
+    if (pixels) {
+        SDL_UpdateTexture(tex, nullptr, pixels, w * 4);
+    } else {
+        SDL_SetRenderDrawBlendMode(renderer_, SDL_BLENDMODE_NONE);
+        SDL_SetRenderDrawColor(renderer_, 0, 0, 0, 0);
+        SDL_RenderClear(renderer_);
+    }
+    SDL_SetRenderDrawBlendMode(renderer_, SDL_BLENDMODE_BLEND);
+    MemoryStats::destroyTexture(canvas_);
+    canvas_  = tex;
+    canvasW_ = w;
+    canvasH_ = h;
+    return true;
+}
+
+int OffscreenCanvas::maxCanvasSide() {
+    int side = window_ ? TiledCanvas::MAX_SIDE : kSoftwareMaxSide;
+    SDL_RendererInfo info;
+    if (renderer_ && SDL_GetRendererInfo(renderer_, &info) == 0) {
+        if (info.max_texture_width  > 0) side = std::min(side, info.max_texture_width);
+        if (info.max_texture_height > 0) side = std::min(side, info.max_texture_height);
+    }
+    return side;
+}
+
+bool OffscreenCanvas::newCanvas(int w, int h) {
+    tool_.reset();  // nothing worth stamping onto a canvas that is being replaced
+    return replaceCanvas(w, h, nullptr);
+}
+
+void OffscreenCanvas::clearCanvas(SDL_Color c) {
+    commitTool();
+    SDL_SetRenderDrawBlendMode(renderer_, SDL_BLENDMODE_NONE);
+    SDL_SetRenderDrawColor(renderer_, c.r, c.g, c.b, c.a);
+    SDL_RenderClear(renderer_);
+    SDL_SetRenderDrawBlendMode(renderer_, SDL_BLENDMODE_BLEND);
+}
+
+bool OffscreenCanvas::resizeCanvas(int newW, int newH, bool scaleContent, int originX, int originY) {
+    commitTool();
+    if (newW == canvasW_ && newH == canvasH_) return true;
+    std::vector<uint32_t> oldPixels = readPixels();
+    std::vector<uint32_t> newPixels = DrawingUtils::resizePixels(
+        oldPixels.data(), canvasW_, canvasH_, newW, newH, scaleContent, originX, originY);
+    return replaceCanvas(newW, newH, newPixels.data());
+}
+
+bool OffscreenCanvas::saveImage(const std::string& path) {
+    commitTool();
+    std::vector<uint32_t> pixels = readPixels();
+    return DrawingUtils::writeImageFile(path, pixels.data(), canvasW_, canvasH_, jpegQuality);
+}
+
+// ── Tools ─────────────────────────────────────────────────────────────────────
+
+void OffscreenCanvas::selectTool(ToolType t, bool option) {
+    commitTool();
+    toolType_ = t;
+    auto cb = [this](ToolType st, SDL_Rect b, SDL_Rect ob, int sx, int sy, int ex, int ey,
+                     int /*bs*/, SDL_Color /*c*/, bool filled) {
+        // Runs inside ShapeTool::onMouseUp, which returns right after; same as kPen.
+        toolType_ = ToolType::RESIZE;
+        tool_ = std::make_unique<ResizeTool>(this, st, b, ob, sx, sy, ex, ey,
+                                             &brushSize_, &brushColor_, filled);
+    };
+    switch (t) {
+        case ToolType::BRUSH:  tool_ = std::make_unique<BrushTool>(this, option); break;
+        case ToolType::ERASER: tool_ = std::make_unique<EraserTool>(this, option); break;
+        case ToolType::LINE:   tool_ = std::make_unique<ShapeTool>(this, ToolType::LINE, cb, false); break;
+        case ToolType::RECT:
+        case ToolType::CIRCLE: tool_ = std::make_unique<ShapeTool>(this, t, cb, option); break;
+        case ToolType::SELECT: tool_ = std::make_unique<SelectTool>(this, option); break;
+        case ToolType::FILL:   tool_ = std::make_unique<FillTool>(this); break;
+        default:               tool_.reset(); break;
+    }
+}
+
+void OffscreenCanvas::pointerDown(int cX, int cY) {
+    if (!tool_) return;
+    // Pressing outside a floating selection drops it first, as in the app.
+    if (toolType_ == ToolType::SELECT) {
+        auto* st = static_cast<SelectTool*>(tool_.get());
+        if (st->isSelectionActive() && !st->isHit(cX, cY)) st->deactivate(renderer_);
+    }
+    tool_->onMouseDown(cX, cY, renderer_, brushSize_, brushColor_);
+}
+
+void OffscreenCanvas::pointerMove(int cX, int cY) {
+    if (tool_) tool_->onMouseMove(cX, cY, renderer_, brushSize_, brushColor_);
+}
+
+void OffscreenCanvas::pointerUp(int cX, int cY) {
+    if (tool_) tool_->onMouseUp(cX, cY, renderer_, brushSize_, brushColor_);
+}
+
+bool OffscreenCanvas::floatingBounds(SDL_Rect& out) {
+    if (toolType_ == ToolType::SELECT && tool_ &&
+        static_cast<SelectTool*>(tool_.get())->isSelectionActive()) {
+        out = static_cast<SelectTool*>(tool_.get())->getFloatingBounds();
+        return true;
+    }
+    if (toolType_ == ToolType::RESIZE && tool_) {
+        out = static_cast<ResizeTool*>(tool_.get())->getBounds();
+        return true;
+    }
+    return false;
+}
+
+bool OffscreenCanvas::rotateFloating(float radians) {
+    SDL_Rect b;
+    if (!floatingBounds(b)) return false;
+    static_cast<TransformTool*>(tool_.get())->rotateBy(radians);
+    return true;
+}
+
+void OffscreenCanvas::commitTool() {
+    if (tool_) tool_->deactivate(renderer_);
+    tool_.reset();
+}
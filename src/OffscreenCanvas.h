@@ -0,0 +1,72 @@
+#pragma once
+
+// OffscreenCanvas — a canvas with no window, for headless scripts.
+//
+// Draws with an SDL software renderer into an ARGB target texture and drives
+// the regular tool classes, so output matches the app. With `accelerated` it
+// uses the app's GPU renderer on a hidden window instead, so the two raster
+// paths can be compared; that needs a display and the main thread. There is no view: a
+// canvas pixel maps to one "window" pixel, shifted far from the origin so the
+// (absent) mouse at 0,0 is never taken for a transform handle.
+
+#include <SDL2/SDL.h>
+#include <memory>
+#include <vector>
+#include "Script.h"
+#include "Tools.h"
+
+class OffscreenCanvas : public ICoordinateMapper, public Script::Host {
+  public:
+    explicit OffscreenCanvas(bool accelerated = false);
+    ~OffscreenCanvas();
+    OffscreenCanvas(const OffscreenCanvas&) = delete;
+    OffscreenCanvas& operator=(const OffscreenCanvas&) = delete;
+
+    bool isValid() const { return canvas_ != nullptr; }
+    bool isRendererValid() const { return renderer_ != nullptr; }
+    const char* rendererName();
+    std::vector<uint32_t> readPixels();
+
+    // ICoordinateMapper
+    void getCanvasCoords(int winX, int winY, int* cX, int* cY) override;
+    void getWindowCoords(int canX, int canY, int* wX, int* wY) override;
+    int  getWindowSize(int canSize) override { return canSize; }
+    void getCanvasSize(int* w, int* h) override { *w = canvasW_; *h = canvasH_; }
+
+    // Script::Host
+    void selectTool(ToolType t, bool option) override;
+    void setBrushSize(int size) override { brushSize_ = size; }
+    void setBrushColor(SDL_Color color) override { brushColor_ = color; }
+    void pointerDown(int cX, int cY) override;
+    void pointerMove(int cX, int cY) override;
+    void pointerUp  (int cX, int cY) override;
+    bool floatingBounds(SDL_Rect& out) override;
+    bool rotateFloating(float radians) override;
+    void commitTool() override;
+    // One texture, so the renderer's texture limit; 16384 on the software
+    // renderer, whose targets are single surfaces.
+    int  maxCanvasSide() override;
+    bool newCanvas(int w, int h) override;
+    void clearCanvas(SDL_Color color) override;
+    bool resizeCanvas(int newW, int newH, bool scaleContent, int originX = 0, int originY = 0) override;
+    bool saveImage(const std::string& path) override;
+
+    int jpegQuality = 92;
+
+  private:
+    static const int kWindowOffset = 32768;
+    static const int kSoftwareMaxSide = 16384;
+
+    SDL_Surface*  surface_  = nullptr;  // software renderer's default target; never drawn to
+    SDL_Window*   window_   = nullptr;  // hidden; accelerated renderer only
+    SDL_Renderer* renderer_ = nullptr;
+    SDL_Texture*  canvas_   = nullptr;
+    int canvasW_ = 0, canvasH_ = 0;
+
+    int       brushSize_  = 8;
+    SDL_Color brushColor_ = { 0, 0, 0, 255 };
+    ToolType  toolType_   = ToolType::BRUSH;
+    std::unique_ptr<AbstractTool> tool_;
+
+    bool replaceCanvas(int w, int h, const uint32_t* pixels);
+};
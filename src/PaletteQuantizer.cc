@@ -0,0 +1,315 @@
+#include "PaletteQuantizer.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+// Fully transparent pixels are indistinguishable on output; fold them together
+// so they neither inflate the color count nor pull the palette around.
+inline uint32_t normalize(uint32_t px) { return (px >> 24) ? px : 0u; }
+
+// Histogram bins: 5 bits each of R, G, B and 3 bits of alpha.
+constexpr int NUM_BINS = 1 << 18;
+
+inline uint32_t binOf(uint32_t px) {
+    return (((px >> 19) & 0x1F) << 13) | (((px >> 11) & 0x1F) << 8) |
+           (((px >> 3) & 0x1F) << 3) | (px >> 29);
+}
+
+inline int colorDist(uint32_t p, uint32_t q) {
+    int da = (int)(p >> 24) - (int)(q >> 24);
+    int dr = (int)((p >> 16) & 0xFF) - (int)((q >> 16) & 0xFF);
+    int dg = (int)((p >>  8) & 0xFF) - (int)((q >>  8) & 0xFF);
+    int db = (int)( p        & 0xFF) - (int)( q        & 0xFF);
+    return dr * dr + dg * dg + db * db + da * da;
+}
+
+int nearestIndex(const std::vector<uint32_t>& palette, uint32_t px) {
+    int best = 0, bestD = INT32_MAX;
+    for (int i = 0; i < (int)palette.size(); i++) {
+        int d = colorDist(palette[i], px);
+        if (d < bestD) { bestD = d; best = i; if (d == 0) break; }
+    }
+    return best;
+}
+
+struct Point {
+    float c[4];       // mean A, R, G, B of the bin
+    double weight;    // pixel count
+    uint32_t bin;
+};
+
+struct Box {
+    int begin, end;
+    double weight;
+    float lo[4], hi[4];
+};
+
+void measureBox(const std::vector<Point>& pts, Box& box) {
+    box.weight = 0;
+    for (int k = 0; k < 4; k++) { box.lo[k] = 256.f; box.hi[k] = -1.f; }
+    for (int i = box.begin; i < box.end; i++) {
+        box.weight += pts[i].weight;
+        for (int k = 0; k < 4; k++) {
+            box.lo[k] = std::min(box.lo[k], pts[i].c[k]);
+            box.hi[k] = std::max(box.hi[k], pts[i].c[k]);
+        }
+    }
+}
+
+int widestChannel(const Box& box) {
+    int ch = 0;
+    for (int k = 1; k < 4; k++)
+        if (box.hi[k] - box.lo[k] > box.hi[ch] - box.lo[ch]) ch = k;
+    return ch;
+}
+
+uint32_t packColor(const float c[4]) {
+    auto u8 = [](float v) { return (uint32_t)std::min(255.f, std::max(0.f, v + 0.5f)); };
+    uint32_t a = u8(c[0]);
+    if (a == 0) return 0;
+    return (a << 24) | (u8(c[1]) << 16) | (u8(c[2]) << 8) | u8(c[3]);
+}
+
+// Weighted median cut over histogram points, seeding the k-means pass.
+std::vector<uint32_t> medianCut(std::vector<Point>& pts, int maxColors) {
+    std::vector<Box> boxes;
+    Box all = { 0, (int)pts.size(), 0, {}, {} };
+    measureBox(pts, all);
+    boxes.push_back(all);
+    while ((int)boxes.size() < maxColors) {
+        int pick = -1;
+        double bestScore = 0;
+        for (int i = 0; i < (int)boxes.size(); i++) {
+            const Box& b = boxes[i];
+            if (b.end - b.begin < 2) continue;
+            int ch = widestChannel(b);
+            double score = b.weight * (b.hi[ch] - b.lo[ch]);
+            if (score > bestScore) { bestScore = score; pick = i; }
+        }
+        if (pick < 0) break;
+        Box box = boxes[pick];
+        int ch = widestChannel(box);
+        std::sort(pts.begin() + box.begin, pts.begin() + box.end,
+                  [ch](const Point& a, const Point& b) { return a.c[ch] < b.c[ch]; });
+        double half = box.weight / 2, acc = 0;
+        int mid = box.begin + 1;
+        for (int i = box.begin; i < box.end - 1; i++) {
+            acc += pts[i].weight;
+            mid = i + 1;
+            if (acc >= half) break;
+        }
+        Box lo = { box.begin, mid, 0, {}, {} };
+        Box hi = { mid, box.end, 0, {}, {} };
+        measureBox(pts, lo);
+        measureBox(pts, hi);
+        boxes[pick] = lo;
+        boxes.push_back(hi);
+    }
+    std::vector<uint32_t> palette;
+    palette.reserve(boxes.size());
+    for (const Box& b : boxes) {
+        double sum[4] = {};
+        for (int i = b.begin; i < b.end; i++)
+            for (int k = 0; k < 4; k++) sum[k] += pts[i].c[k] * pts[i].weight;
+        float c[4];
+        for (int k = 0; k < 4; k++) c[k] = (float)(sum[k] / b.weight);
+        palette.push_back(packColor(c));
+    }
+    return palette;
+}
+
+// Translucent entries first (so tRNS can be truncated), otherwise by value for stable output.
+void sortPalette(std::vector<uint32_t>& palette) {
+    std::sort(palette.begin(), palette.end(), [](uint32_t a, uint32_t b) {
+        bool ao = (a >> 24) == 0xFF, bo = (b >> 24) == 0xFF;
+        return ao != bo ? !ao : a < b;
+    });
+    palette.erase(std::unique(palette.begin(), palette.end()), palette.end());
+}
+
+} // namespace
+
+namespace PaletteQuantizer {
+
+bool buildExact(const uint32_t* argb, size_t count, Result& out, int maxColors) {
+    out.palette.clear();
+    out.indices.clear();
+    if (!argb || count == 0) return false;
+
+    std::unordered_set<uint32_t> seen;
+    seen.reserve((size_t)maxColors * 2);
+    uint32_t last = ~normalize(argb[0]);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t c = normalize(argb[i]);
+        if (c == last) continue;  // runs are common in drawn art; skip the hash
+        last = c;
+        if (seen.insert(c).second && (int)seen.size() > maxColors) return false;
+    }
+
+    out.palette.assign(seen.begin(), seen.end());
+    sortPalette(out.palette);
+    std::unordered_map<uint32_t, uint8_t> lut;
+    lut.reserve(out.palette.size() * 2);
+    for (size_t i = 0; i < out.palette.size(); i++) lut[out.palette[i]] = (uint8_t)i;
+
+    out.indices.resize(count);
+    last = ~normalize(argb[0]);
+    uint8_t lastIdx = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t c = normalize(argb[i]);
+        if (c != last) { last = c; lastIdx = lut[c]; }
+        out.indices[i] = lastIdx;
+    }
+    return true;
+}
+
+void quantize(const uint32_t* argb, int w, int h, int maxColors, bool dither, Result& out) {
+    out.palette.clear();
+    out.indices.clear();
+    if (!argb || w <= 0 || h <= 0) return;
+    maxColors = std::max(2, std::min(256, maxColors));
+    const size_t count = (size_t)w * h;
+    const int threads = Parallel::workerCount(count, 1 << 20);
+
+    // 1. Histogram. Per-thread 32-bit sums are flushed into the shared 64-bit
+    //    histogram before they can overflow (16M pixels * 255 < 2^32).
+    struct LocalBin { uint32_t n, a, r, g, b; };
+    struct Bin { uint64_t n, a, r, g, b; };
+    std::vector<Bin> hist(NUM_BINS, Bin{0, 0, 0, 0, 0});
+    std::mutex histMutex;
+    const size_t kFlushPixels = (size_t)1 << 24;
+    Parallel::parallelFor(threads, h, [&](int y0, int y1) {
+        std::vector<LocalBin> local(NUM_BINS, LocalBin{0, 0, 0, 0, 0});
+        size_t pending = 0;
+        auto flush = [&] {
+            std::lock_guard<std::mutex> lock(histMutex);
+            for (int i = 0; i < NUM_BINS; i++) {
+                LocalBin& l = local[i];
+                if (!l.n) continue;
+                Bin& g = hist[i];
+                g.n += l.n; g.a += l.a; g.r += l.r; g.g += l.g; g.b += l.b;
+                l = LocalBin{0, 0, 0, 0, 0};
+            }
+            pending = 0;
+        };
+        for (int y = y0; y < y1; y++) {
+            if (pending + (size_t)w > kFlushPixels) flush();
+            const uint32_t* row = argb + (size_t)y * w;
+            for (int x = 0; x < w; x++) {
+                uint32_t px = normalize(row[x]);
+                LocalBin& l = local[binOf(px)];
+                l.n++;
+                l.a += px >> 24;
+                l.r += (px >> 16) & 0xFF;
+                l.g += (px >>  8) & 0xFF;
+                l.b +=  px        & 0xFF;
+            }
+            pending += (size_t)w;
+        }
+        flush();
+    });
+
+    std::vector<Point> pts;
+    for (int i = 0; i < NUM_BINS; i++) {
+        const Bin& b = hist[i];
+        if (!b.n) continue;
+        double n = (double)b.n;
+        pts.push_back({ { (float)(b.a / n), (float)(b.r / n), (float)(b.g / n), (float)(b.b / n) },
+                        n, (uint32_t)i });
+    }
+    std::vector<Bin>().swap(hist);
+
+    // 2. Seed with median cut, then refine with a few weighted k-means passes over the bins.
+    std::vector<uint32_t> palette = medianCut(pts, maxColors);
+    std::vector<int> assign(pts.size());
+    const int ptsThreads = Parallel::workerCount(pts.size() * palette.size(), 1 << 22);
+    auto assignAll = [&] {
+        Parallel::parallelFor(ptsThreads, (int)pts.size(), [&](int i0, int i1) {
+            for (int i = i0; i < i1; i++)
+                assign[i] = nearestIndex(palette, packColor(pts[i].c));
+        });
+    };
+    const int kMeansIterations = 4;
+    for (int iter = 0; iter < kMeansIterations; iter++) {
+        assignAll();
+        std::vector<double> sum(palette.size() * 5, 0.0);
+        for (size_t i = 0; i < pts.size(); i++) {
+            double* s = &sum[(size_t)assign[i] * 5];
+            for (int k = 0; k < 4; k++) s[k] += pts[i].c[k] * pts[i].weight;
+            s[4] += pts[i].weight;
+        }
+        for (size_t j = 0; j < palette.size(); j++) {
+            const double* s = &sum[j * 5];
+            if (s[4] <= 0) continue;  // empty cluster keeps its centre
+            float c[4];
+            for (int k = 0; k < 4; k++) c[k] = (float)(s[k] / s[4]);
+            palette[j] = packColor(c);
+        }
+    }
+    sortPalette(palette);
+    assignAll();
+
+    // Nearest palette entry per occupied bin; bins only reached by dithering fill in lazily.
+    std::vector<int16_t> binNearest(NUM_BINS, -1);
+    for (size_t i = 0; i < pts.size(); i++) binNearest[pts[i].bin] = (int16_t)assign[i];
+
+    out.palette = palette;
+    out.indices.resize(count);
+
+    // 3. Map pixels.
+    if (!dither) {
+        Parallel::parallelFor(threads, h, [&](int y0, int y1) {
+            for (int y = y0; y < y1; y++) {
+                const uint32_t* row = argb + (size_t)y * w;
+                uint8_t* dst = out.indices.data() + (size_t)y * w;
+                for (int x = 0; x < w; x++) dst[x] = (uint8_t)binNearest[binOf(normalize(row[x]))];
+            }
+        });
+        return;
+    }
+
+    // Floyd–Steinberg on RGB (alpha is mapped, not diffused). Errors are kept
+    // in sixteenths; each row depends on the previous one, so this runs serially.
+    std::vector<int> errCur((size_t)(w + 2) * 3, 0), errNext((size_t)(w + 2) * 3, 0);
+    auto clamp8 = [](int v) { return v < 0 ? 0 : (v > 255 ? 255 : v); };
+    for (int y = 0; y < h; y++) {
+        const uint32_t* row = argb + (size_t)y * w;
+        uint8_t* dst = out.indices.data() + (size_t)y * w;
+        std::fill(errNext.begin(), errNext.end(), 0);
+        for (int x = 0; x < w; x++) {
+            uint32_t px = normalize(row[x]);
+            uint32_t a = px >> 24;
+            int* e = &errCur[(size_t)(x + 1) * 3];
+            if (a == 0) {
+                dst[x] = (uint8_t)binNearest[binOf(0)];
+                continue;
+            }
+            int r = clamp8((int)((px >> 16) & 0xFF) + e[0] / 16);
+            int g = clamp8((int)((px >>  8) & 0xFF) + e[1] / 16);
+            int b = clamp8((int)( px        & 0xFF) + e[2] / 16);
+            uint32_t want = (a << 24) | ((uint32_t)r << 16) | ((uint32_t)g << 8) | (uint32_t)b;
+            int16_t& cached = binNearest[binOf(want)];
+            if (cached < 0) cached = (int16_t)nearestIndex(palette, want);
+            dst[x] = (uint8_t)cached;
+            uint32_t got = palette[cached];
+            int er = r - (int)((got >> 16) & 0xFF);
+            int eg = g - (int)((got >>  8) & 0xFF);
+            int eb = b - (int)( got        & 0xFF);
+            int* right = e + 3;
+            int* dl = &errNext[(size_t)x * 3];
+            int* d  = dl + 3;
+            int* dr = dl + 6;
+            right[0] += er * 7; right[1] += eg * 7; right[2] += eb * 7;
+            dl[0] += er * 3;    dl[1] += eg * 3;    dl[2] += eb * 3;
+            d[0]  += er * 5;    d[1]  += eg * 5;    d[2]  += eb * 5;
+            dr[0] += er;        dr[1] += eg;        dr[2] += eb;
+        }
+        std::swap(errCur, errNext);
+    }
+}
+
+} // namespace PaletteQuantizer
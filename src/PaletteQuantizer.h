@@ -0,0 +1,26 @@
+#pragma once
+
+// PaletteQuantizer — reduces ARGB images to at most 256 colors for indexed PNG
+// export. Images that already fit are converted losslessly (buildExact);
+// everything else goes through a threaded histogram, median cut and k-means
+// refinement, with optional Floyd–Steinberg dithering (quantize).
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace PaletteQuantizer {
+
+struct Result {
+    std::vector<uint32_t> palette;  // ARGB; translucent entries first so tRNS can stop early
+    std::vector<uint8_t>  indices;  // one palette index per pixel
+};
+
+// Exact palette if the image has at most maxColors distinct colors (every fully
+// transparent pixel counts as one color). Returns false, leaving out empty, otherwise.
+bool buildExact(const uint32_t* argb, size_t count, Result& out, int maxColors = 256);
+
+// Lossy reduction to at most maxColors (2..256) colors.
+void quantize(const uint32_t* argb, int w, int h, int maxColors, bool dither, Result& out);
+
+} // namespace PaletteQuantizer
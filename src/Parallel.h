@@ -0,0 +1,57 @@
+#pragma once
+
+// Parallel — minimal fork/join helpers for CPU-side image work (encoders,
+// quantizer). Each call spawns its workers and joins them before returning;
+// the calling thread takes the last range. Code that already runs on its own
+// pool (headless batches) gives each worker a Budget, so the encodes it runs
+// split only that worker's share of the cores.
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace Parallel {
+
+inline int coreCount() {
+    unsigned hc = std::thread::hardware_concurrency();
+    return hc ? (int)hc : 4;
+}
+
+// Most threads workerCount may hand out on this thread; 0 = no cap.
+inline int& threadBudget() {
+    static thread_local int budget = 0;
+    return budget;
+}
+
+// Caps workerCount on the current thread while in scope.
+class Budget {
+  public:
+    explicit Budget(int threads) : prev_(threadBudget()) { threadBudget() = std::max(1, threads); }
+    ~Budget() { threadBudget() = prev_; }
+    Budget(const Budget&) = delete;
+    Budget& operator=(const Budget&) = delete;
+  private:
+    int prev_;
+};
+
+// Threads worth using for `work` units when each thread should get at least `grain` units.
+inline int workerCount(size_t work, size_t grain) {
+    size_t n = std::min<size_t>(coreCount(), 16);
+    if (threadBudget() > 0) n = std::min<size_t>(n, threadBudget());
+    return (int)std::max<size_t>(1, std::min(n, work / std::max<size_t>(1, grain)));
+}
+
+// Run f(begin, end) over [0, count) split into `threads` contiguous ranges.
+template<typename F>
+void parallelFor(int threads, int count, F f) {
+    if (threads <= 1 || count < threads) { f(0, count); return; }
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    for (int t = 0; t < threads - 1; t++)
+        pool.emplace_back(f, count * t / threads, count * (t + 1) / threads);
+    f(count * (threads - 1) / threads, count);
+    for (auto& th : pool) th.join();
+}
+
+} // namespace Parallel
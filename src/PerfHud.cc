@@ -0,0 +1,159 @@
+#include "PerfHud.h"
+#include "DrawingUtils.h"
+#include "MemoryStats.h"
+#include <algorithm>
+#include <cstdio>
+
+double PerfHud::toMs(Uint64 ticks) {
+    return ticks * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+void PerfHud::toggle() {
+    bool show = !visible_;
+    *this = PerfHud();  // start clean; samples from before it was hidden are stale
+    visible_ = show;
+}
+
+void PerfHud::Series::add(float x) {
+    v[head] = x;
+    head = (head + 1) % kWindow;
+    count = std::min(count + 1, kWindow);
+}
+
+void PerfHud::Series::summarize(float& avg, float& p95, float& max) const {
+    avg = p95 = max = 0.f;
+    if (!count) return;
+    float sorted[kWindow];
+    std::copy(v, v + count, sorted);
+    std::sort(sorted, sorted + count);
+    float sum = 0.f;
+    for (int i = 0; i < count; i++) sum += sorted[i];
+    avg = sum / count;
+    p95 = sorted[std::min(count - 1, (int)(0.95f * (count - 1) + 0.5f))];
+    max = sorted[count - 1];
+}
+
+void PerfHud::addStage(Stage s, Uint64 start) {
+    stageMs_[s] += toMs(SDL_GetPerformanceCounter() - start);
+}
+
+void PerfHud::noteInput(const SDL_Event& e) {
+    if (!visible_) return;
+    switch (e.type) {
+        case SDL_MOUSEMOTION: case SDL_MOUSEBUTTONDOWN: case SDL_MOUSEBUTTONUP: case SDL_MOUSEWHEEL:
+        case SDL_KEYDOWN: case SDL_KEYUP: case SDL_TEXTINPUT:
+        case SDL_FINGERDOWN: case SDL_FINGERUP: case SDL_FINGERMOTION: case SDL_MULTIGESTURE:
+            if (!oldestInput_ && e.common.timestamp) oldestInput_ = e.common.timestamp;
+            break;
+        default:
+            break;
+    }
+}
+
+void PerfHud::beginFrame() {
+    if (visible_) frameStart_ = SDL_GetPerformanceCounter();
+}
+
+void PerfHud::endFrame() {
+    if (!visible_) return;
+    Uint64 now = SDL_GetPerformanceCounter();
+    if (frameStart_) frame_.add((float)toMs(now - frameStart_));
+    frameStart_ = 0;
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        stages_[s].add((float)stageMs_[s]);
+        stageMs_[s] = 0.0;
+    }
+    if (oldestInput_) {
+        Uint32 ms = SDL_GetTicks() - oldestInput_;
+        int bucket = 0;
+        while (bucket < kBuckets - 1 && ms >= (1u << bucket)) bucket++;
+        histogram_[latency_.head] = bucket;
+        latency_.add((float)ms);
+        oldestInput_ = 0;
+    }
+}
+
+void PerfHud::draw(SDL_Renderer* r, int x, int y) {
+    static const char* names[STAGE_COUNT] = { "EVENTS", "TOOL", "OVERLAY", "PRESENT" };
+    const int lineH = 10, pad = 6, panelW = 236;
+    const int rows = 2 + STAGE_COUNT + 2;  // header, frame, stages, latency, histogram label
+    const int histH = 32;
+    const int memRows = 1 + MemoryStats::CATEGORY_COUNT + 3;  // header, categories, total, limit, trimmed
+    SDL_Rect panel = { x, y, panelW, pad * 2 + rows * lineH + histH + 4 + 6 + memRows * lineH };
+
+    SDL_SetRenderDrawBlendMode(r, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(r, 20, 20, 24, 215);
+    SDL_RenderFillRect(r, &panel);
+    SDL_SetRenderDrawColor(r, 100, 100, 110, 255);
+    SDL_RenderDrawRect(r, &panel);
+
+    char buf[64];
+    int ty = y + pad;
+    auto row = [&](const char* label, const Series& s) {
+        float avg, p95, max;
+        s.summarize(avg, p95, max);
+        snprintf(buf, sizeof(buf), "%-8s%6.2f%7.2f%7.2f", label, avg, p95, max);
+        DrawingUtils::drawText(r, x + pad, ty, buf);
+        ty += lineH;
+    };
+
+    SDL_SetRenderDrawColor(r, 150, 150, 165, 255);
+    snprintf(buf, sizeof(buf), "%-8s%6s%7s%7s", "MS", "AVG", "P95", "MAX");
+    DrawingUtils::drawText(r, x + pad, ty, buf);
+    ty += lineH;
+    SDL_SetRenderDrawColor(r, 230, 230, 240, 255);
+    row("FRAME", frame_);
+    for (int s = 0; s < STAGE_COUNT; s++) row(names[s], stages_[s]);
+    SDL_SetRenderDrawColor(r, 255, 210, 120, 255);
+    row("INPUT", latency_);
+
+    // Latency histogram over the same window: one bar per power-of-two bucket.
+    int counts[kBuckets] = {};
+    for (int i = 0; i < latency_.count; i++) counts[histogram_[i]]++;
+    int peak = std::max(1, *std::max_element(counts, counts + kBuckets));
+    const int barW = (panelW - pad * 2) / kBuckets;
+    int baseY = ty + histH;
+    for (int b = 0; b < kBuckets; b++) {
+        int h = counts[b] * histH / peak;
+        SDL_Rect bar = { x + pad + b * barW + 1, baseY - h, barW - 2, h };
+        if      (b < 4) SDL_SetRenderDrawColor(r, 120, 200, 110, 255);  // under 8 ms
+        else if (b < 5) SDL_SetRenderDrawColor(r, 230, 200, 110, 255);  // under a 60 Hz frame
+        else            SDL_SetRenderDrawColor(r, 240, 110, 110, 255);
+        SDL_RenderFillRect(r, &bar);
+    }
+    ty = baseY + 4;
+    SDL_SetRenderDrawColor(r, 150, 150, 165, 255);
+    for (int b = 0; b < kBuckets; b++) {
+        if (b == kBuckets - 1) snprintf(buf, sizeof(buf), "%d+", 1 << (b - 1));
+        else                   snprintf(buf, sizeof(buf), "%d", 1 << b);
+        DrawingUtils::drawText(r, x + pad + b * barW + 1, ty, buf);
+    }
+
+    // Tracked memory; the total turns red once past the undo soft limit.
+    const double MB = 1024.0 * 1024.0;
+    ty += lineH + 6;
+    snprintf(buf, sizeof(buf), "%-12s%10s", "MEMORY", "MB");
+    DrawingUtils::drawText(r, x + pad, ty, buf);
+    ty += lineH;
+    SDL_SetRenderDrawColor(r, 230, 230, 240, 255);
+    for (int c = 0; c < MemoryStats::CATEGORY_COUNT; c++) {
+        auto cat = (MemoryStats::Category)c;
+        snprintf(buf, sizeof(buf), "%-12s%10.1f", MemoryStats::name(cat), MemoryStats::bytes(cat) / MB);
+        DrawingUtils::drawText(r, x + pad, ty, buf);
+        ty += lineH;
+    }
+    if (MemoryStats::overSoftLimit()) SDL_SetRenderDrawColor(r, 240, 110, 110, 255);
+    else                              SDL_SetRenderDrawColor(r, 255, 210, 120, 255);
+    snprintf(buf, sizeof(buf), "%-12s%10.1f", "TOTAL", MemoryStats::total() / MB);
+    DrawingUtils::drawText(r, x + pad, ty, buf);
+    ty += lineH;
+    SDL_SetRenderDrawColor(r, 150, 150, 165, 255);
+    if (size_t limit = MemoryStats::softLimit())
+        snprintf(buf, sizeof(buf), "%-12s%10.1f", "SOFT LIMIT", limit / MB);
+    else
+        snprintf(buf, sizeof(buf), "%-12s%10s", "SOFT LIMIT", "NONE");
+    DrawingUtils::drawText(r, x + pad, ty, buf);
+    ty += lineH;
+    snprintf(buf, sizeof(buf), "%-12s%10zu", "TRIMMED", MemoryStats::trimmedSteps());
+    DrawingUtils::drawText(r, x + pad, ty, buf);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+// PerfHud — frame-time and input-latency overlay, toggled with F3.
+//
+// Per rendered frame it keeps how long kPen spent in event processing, tool
+// rasterization (a subset of events), overlay render and present, plus the
+// whole frame. Input latency runs from the SDL timestamp of the oldest input
+// event not yet on screen to the end of SDL_RenderPresent. The last kWindow
+// frames are shown as avg / p95 / max with a latency histogram, followed by
+// the MemoryStats categories.
+//
+// While hidden, every hook is a single branch on `visible()`; nothing is
+// timed or stored.
+
+#include <SDL2/SDL.h>
+
+class PerfHud {
+  public:
+    enum Stage { EVENTS, TOOL, OVERLAY, PRESENT, STAGE_COUNT };
+
+    bool visible() const { return visible_; }
+    void toggle();
+
+    // Adds the time since `start` (SDL_GetPerformanceCounter) to this frame's stage.
+    void addStage(Stage s, Uint64 start);
+    // Remember an input event's timestamp until the frame that shows it is presented.
+    void noteInput(const SDL_Event& e);
+    void beginFrame();
+    // After SDL_RenderPresent: close the frame's samples.
+    void endFrame();
+    // Panel at the top-left of the content area.
+    void draw(SDL_Renderer* r, int x, int y);
+
+    // Times a scope into a stage; free when the HUD is hidden.
+    class Timer {
+        PerfHud& hud_;
+        Stage    stage_;
+        Uint64   start_;
+      public:
+        Timer(PerfHud& hud, Stage s)
+            : hud_(hud), stage_(s), start_(hud.visible_ ? SDL_GetPerformanceCounter() : 0) {}
+        ~Timer() { if (start_) hud_.addStage(stage_, start_); }
+    };
+
+  private:
+    static const int kWindow  = 120;  // frames kept
+    static const int kBuckets = 8;    // latency histogram: <1, <2, <4 ... <64, 64+ ms
+
+    struct Series {
+        float v[kWindow] = {};
+        int   count = 0, head = 0;
+        void  add(float x);
+        void  summarize(float& avg, float& p95, float& max) const;
+    };
+
+    bool   visible_     = false;
+    Uint64 frameStart_  = 0;
+    double stageMs_[STAGE_COUNT] = {};
+    Uint32 oldestInput_ = 0;     // SDL ticks; 0 = nothing pending
+    Series stages_[STAGE_COUNT];
+    Series frame_;
+    Series latency_;
+    int    histogram_[kWindow] = {};  // bucket of each latency sample, parallel to latency_
+
+    static double toMs(Uint64 ticks);
+};
@@ -0,0 +1,50 @@
+#include "PerfStats.h"
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef PSAPI_VERSION
+#define PSAPI_VERSION 2  // K32GetProcessMemoryInfo from kernel32, no psapi.lib
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace PerfStats {
+
+size_t peakResidentBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return pmc.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#ifdef __APPLE__
+    return (size_t)ru.ru_maxrss;          // bytes
+#else
+    return (size_t)ru.ru_maxrss * 1024;   // kilobytes
+#endif
+#endif
+}
+
+double percentile(std::vector<double>& samples, double p) {
+    if (samples.empty()) return 0.0;
+    std::sort(samples.begin(), samples.end());
+    size_t i = (size_t)(p * (samples.size() - 1) + 0.5);
+    return samples[std::min(i, samples.size() - 1)];
+}
+
+uint64_t fnv1a(const void* data, size_t len, uint64_t seed) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint64_t h = seed;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+} // namespace PerfStats
@@ -0,0 +1,20 @@
+#pragma once
+
+// PerfStats — small measurement helpers shared by replay and benchmarks.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace PerfStats {
+
+// Peak resident set size of this process in bytes (0 if unavailable).
+size_t peakResidentBytes();
+
+// p in [0, 1]; `samples` is sorted in place. 0 for an empty set.
+double percentile(std::vector<double>& samples, double p);
+
+// 64-bit FNV-1a; chain calls by passing the previous result as `seed`.
+uint64_t fnv1a(const void* data, size_t len, uint64_t seed = 0xcbf29ce484222325ull);
+
+} // namespace PerfStats
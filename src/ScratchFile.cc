@@ -0,0 +1,135 @@
+#include "ScratchFile.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <string>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+// Growth step; also the first size. Doubling past this keeps remaps rare.
+const size_t MIN_GROWTH = size_t(64) << 20;
+}
+
+ScratchFile::~ScratchFile() {
+    close();
+}
+
+uint8_t* ScratchFile::alloc(size_t n, size_t& offset) {
+    for (auto it = free_.begin(); it != free_.end(); ++it) {
+        if (it->second < n) continue;
+        offset = it->first;
+        if (it->second > n) free_.emplace(offset + n, it->second - n);
+        free_.erase(it);
+        used_ += n;
+        return data_ + offset;
+    }
+    if (end_ + n > capacity_ && !grow(std::max(end_ + n, capacity_ + std::max(capacity_, MIN_GROWTH))))
+        return nullptr;
+    offset = end_;
+    end_ += n;
+    used_ += n;
+    return data_ + offset;
+}
+
+void ScratchFile::release(size_t offset, size_t n) {
+    if (n == 0) return;
+    used_ -= n;
+    auto next = free_.lower_bound(offset);
+    if (next != free_.end() && next->first == offset + n) {
+        n += next->second;
+        next = free_.erase(next);
+    }
+    if (next != free_.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            offset = prev->first;
+            n += prev->second;
+            free_.erase(prev);
+        }
+    }
+    if (offset + n == end_) end_ = offset;  // a free tail is just unused space
+    else free_.emplace_hint(next, offset, n);
+}
+
+#ifdef _WIN32
+
+bool ScratchFile::grow(size_t capacity) {
+    if (!file_) {
+        wchar_t dir[MAX_PATH + 1], path[MAX_PATH + 1];
+        if (GetTempPathW(MAX_PATH, dir) == 0 || GetTempFileNameW(dir, L"kpn", 0, path) == 0) return false;
+        HANDLE f = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                               FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+        if (f == INVALID_HANDLE_VALUE) return false;
+        file_ = f;
+    }
+    // Creating a larger mapping extends the file; fails cleanly if the disk is full.
+    ULARGE_INTEGER sz;
+    sz.QuadPart = capacity;
+    HANDLE m = CreateFileMappingW(static_cast<HANDLE>(file_), nullptr, PAGE_READWRITE, sz.HighPart, sz.LowPart, nullptr);
+    if (!m) return false;
+    void* p = MapViewOfFile(m, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (!p) { CloseHandle(m); return false; }
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_) CloseHandle(static_cast<HANDLE>(mapping_));
+    mapping_ = m;
+    data_ = static_cast<uint8_t*>(p);
+    capacity_ = capacity;
+    return true;
+}
+
+void ScratchFile::close() {
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_) CloseHandle(static_cast<HANDLE>(mapping_));
+    if (file_) CloseHandle(static_cast<HANDLE>(file_));
+    data_ = nullptr;
+    mapping_ = nullptr;
+    file_ = nullptr;
+    capacity_ = end_ = used_ = 0;
+    free_.clear();
+}
+
+#else
+
+bool ScratchFile::grow(size_t capacity) {
+    if (fd_ < 0) {
+        const char* dir = getenv("TMPDIR");
+        std::string path = std::string(dir && *dir ? dir : "/tmp") + "/kpen-undo-XXXXXX";
+        fd_ = mkstemp(&path[0]);
+        if (fd_ < 0) return false;
+        unlink(path.c_str());
+    }
+    // Allocate the blocks now: writing to a hole of a full disk through the
+    // mapping would be SIGBUS rather than an error.
+#ifdef __linux__
+    if (posix_fallocate(fd_, 0, static_cast<off_t>(capacity)) != 0) return false;
+#else
+    fstore_t store = { F_ALLOCATEALL, F_PEOFPOSMODE, 0, static_cast<off_t>(capacity - capacity_), 0 };
+    if (fcntl(fd_, F_PREALLOCATE, &store) == -1 || ftruncate(fd_, static_cast<off_t>(capacity)) != 0) return false;
+#endif
+    void* p = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) return false;
+    if (data_) munmap(data_, capacity_);
+    data_ = static_cast<uint8_t*>(p);
+    capacity_ = capacity;
+    return true;
+}
+
+void ScratchFile::close() {
+    if (data_) munmap(data_, capacity_);
+    if (fd_ >= 0) ::close(fd_);
+    data_ = nullptr;
+    fd_ = -1;
+    capacity_ = end_ = used_ = 0;
+    free_.clear();
+}
+
+#endif
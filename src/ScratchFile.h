@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+
+// Scratch space in an unnamed temp file, mapped read-write and grown on
+// demand (mmap on POSIX, file mapping on Windows). Released ranges are
+// reused before the file grows. The file is unlinked as soon as it is
+// created (deleted on close on Windows), so nothing is left behind after a
+// crash. Not thread-safe.
+class ScratchFile {
+public:
+    ScratchFile() = default;
+    ~ScratchFile();
+    ScratchFile(const ScratchFile&) = delete;
+    ScratchFile& operator=(const ScratchFile&) = delete;
+
+    // Room for n bytes: the first released range that fits, else at the end;
+    // the file is created on first use. Returns nullptr (and changes nothing)
+    // if the file cannot be created or the disk is full. Pointers from at()
+    // and alloc() are valid until the next alloc().
+    uint8_t* alloc(size_t n, size_t& offset);
+    const uint8_t* at(size_t offset) const { return data_ + offset; }
+    // Give back n bytes at offset (from alloc) for reuse.
+    void release(size_t offset, size_t n);
+
+    // Bytes allocated and not released.
+    size_t used() const { return used_; }
+    // Release the mapping and the file.
+    void close();
+
+private:
+    bool grow(size_t capacity);
+
+    uint8_t* data_ = nullptr;
+    size_t capacity_ = 0;
+    size_t end_ = 0;   // allocated or released bytes end here
+    size_t used_ = 0;
+    std::map<size_t, size_t> free_;  // released ranges, offset -> length, coalesced
+#ifdef _WIN32
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+};
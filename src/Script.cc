@@ -0,0 +1,237 @@
+#include "Script.h"
+#include "TiledCanvas.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace Script {
+
+// ── Reading ───────────────────────────────────────────────────────────────────
+
+Reader::~Reader() {
+    if (owned_ && file_) fclose(file_);
+}
+
+bool Reader::open(const std::string& path) {
+    if (path == "-") { file_ = stdin; owned_ = false; return true; }
+    file_ = fopen(path.c_str(), "r");
+    owned_ = true;
+    return file_ != nullptr;
+}
+
+bool Reader::next(Command& out) {
+    if (!file_) return false;
+    std::string text;
+    for (;;) {
+        text.clear();
+        int c;
+        while ((c = fgetc(file_)) != EOF && c != '\n') text += (char)c;
+        if (c == EOF && text.empty()) return false;
+        line_++;
+        // Commands, and malformed lines (empty name, text in args) so they get reported.
+        if (parseLine(text, out) || !out.args.empty()) { out.line = line_; return true; }
+    }
+}
+
+// JSON form: ["name", arg, ...]. Strings, numbers, true/false; no nesting.
+static bool parseJsonArray(const std::string& s, Command& out) {
+    size_t i = s.find('[') + 1;
+    std::vector<std::string> tokens;
+    bool expectValue = true;
+    while (i < s.size()) {
+        char c = s[i];
+        if (isspace((unsigned char)c)) { i++; continue; }
+        if (c == ']') break;
+        if (c == ',') {
+            if (expectValue) return false;
+            expectValue = true; i++; continue;
+        }
+        if (!expectValue) return false;
+        std::string tok;
+        if (c == '"') {
+            for (i++; i < s.size() && s[i] != '"'; i++) {
+                if (s[i] == '\\' && i + 1 < s.size()) i++;
+                tok += s[i];
+            }
+            if (i >= s.size()) return false;
+            i++;
+        } else {
+            while (i < s.size() && s[i] != ',' && s[i] != ']' && !isspace((unsigned char)s[i]))
+                tok += s[i++];
+            if (tok == "true") tok = "1";
+            else if (tok == "false") tok = "0";
+        }
+        tokens.push_back(tok);
+        expectValue = false;
+    }
+    if (i >= s.size() || tokens.empty()) return false;
+    out.name = tokens[0];
+    out.args.assign(tokens.begin() + 1, tokens.end());
+    return true;
+}
+
+bool parseLine(const std::string& text, Command& out) {
+    out.name.clear();
+    out.args.clear();
+    size_t start = text.find_first_not_of(" \t\r");
+    if (start == std::string::npos || text[start] == '#') return false;
+
+    if (text[start] == '[') {
+        if (parseJsonArray(text.substr(start), out)) return true;
+        out.args.push_back(text);  // malformed: empty name, original text kept for the error
+        return false;
+    }
+    size_t i = start;
+    while (i < text.size()) {
+        while (i < text.size() && isspace((unsigned char)text[i])) i++;
+        if (i >= text.size() || text[i] == '#') break;
+        size_t j = i;
+        while (j < text.size() && !isspace((unsigned char)text[j])) j++;
+        if (out.name.empty()) out.name = text.substr(i, j - i);
+        else                  out.args.push_back(text.substr(i, j - i));
+        i = j;
+    }
+    for (auto& c : out.name) c = (char)tolower(c);
+    return !out.name.empty();
+}
+
+// ── Execution ─────────────────────────────────────────────────────────────────
+
+static bool toInt(const std::string& s, int& v) {
+    if (s.empty()) return false;
+    char* end;
+    long x = strtol(s.c_str(), &end, 10);
+    if (*end) return false;
+    v = (int)x;
+    return true;
+}
+
+static bool toColor(std::string s, SDL_Color& c) {
+    if (!s.empty() && s[0] == '#') s.erase(0, 1);
+    if (s.size() != 6 && s.size() != 8) return false;
+    char* end;
+    unsigned long v = strtoul(s.c_str(), &end, 16);
+    if (*end) return false;
+    if (s.size() == 6) v = (v << 8) | 0xFF;
+    c = { (Uint8)(v >> 24), (Uint8)(v >> 16), (Uint8)(v >> 8), (Uint8)v };
+    return true;
+}
+
+// Collect integer args from `from`; false if any is not a number.
+static bool ints(const Command& cmd, size_t from, std::vector<int>& out) {
+    out.clear();
+    for (size_t i = from; i < cmd.args.size(); i++) {
+        int v;
+        if (!toInt(cmd.args[i], v)) return false;
+        out.push_back(v);
+    }
+    return true;
+}
+
+static std::string sizeText(int w, int h) {
+    return std::to_string(w) + "x" + std::to_string(h);
+}
+
+static void drag(Host& host, const std::vector<int>& pts) {
+    host.pointerDown(pts[0], pts[1]);
+    for (size_t i = 2; i + 1 < pts.size(); i += 2)
+        host.pointerMove(pts[i], pts[i + 1]);
+    host.pointerUp(pts[pts.size() - 2], pts[pts.size() - 1]);
+}
+
+std::string execute(Host& host, const Command& cmd) {
+    const std::string& n = cmd.name;
+    if (n.empty())
+        return "could not parse: " + (cmd.args.empty() ? std::string() : cmd.args[0]);
+
+    std::vector<int> v;
+    const size_t argc = cmd.args.size();
+    auto flag = [&](const char* word) { return argc > 0 && cmd.args.back() == word; };
+
+    if (n == "new") {
+        if (!ints(cmd, 0, v) || v.size() != 2 || v[0] < 1 || v[1] < 1) return "usage: new W H";
+        int side = host.maxCanvasSide(), w = std::min(side, v[0]), h = std::min(side, v[1]);
+        if (!host.newCanvas(w, h)) return "could not create a " + sizeText(w, h) + " canvas";
+    } else if (n == "clear") {
+        SDL_Color c = { 0, 0, 0, 0 };
+        if (argc > 1 || (argc == 1 && !toColor(cmd.args[0], c))) return "usage: clear [RRGGBB[AA]]";
+        host.clearCanvas(c);
+    } else if (n == "color") {
+        SDL_Color c;
+        if (argc != 1 || !toColor(cmd.args[0], c)) return "usage: color RRGGBB[AA]";
+        host.setBrushColor(c);
+    } else if (n == "size") {
+        if (!ints(cmd, 0, v) || v.size() != 1) return "usage: size N";
+        host.setBrushSize(std::max(1, std::min(99, v[0])));
+    } else if (n == "brush" || n == "eraser") {
+        bool square = argc > 0 && cmd.args[0] == "square";
+        if (!ints(cmd, square ? 1 : 0, v) || v.size() < 2 || v.size() % 2)
+            return "usage: " + n + " [square] X Y [X Y ...]";
+        host.selectTool(n == "brush" ? ToolType::BRUSH : ToolType::ERASER, square);
+        drag(host, v);
+    } else if (n == "line" || n == "rect" || n == "oval") {
+        bool filled = n != "line" && flag("filled");
+        Command c = cmd;
+        if (filled) c.args.pop_back();
+        if (!ints(c, 0, v) || v.size() != 4)
+            return "usage: " + n + " X0 Y0 X1 Y1" + (n == "line" ? "" : " [filled]");
+        host.selectTool(n == "line" ? ToolType::LINE : n == "rect" ? ToolType::RECT : ToolType::CIRCLE,
+                        filled);
+        drag(host, v);
+        host.commitTool();
+    } else if (n == "fill") {
+        if (!ints(cmd, 0, v) || v.size() != 2) return "usage: fill X Y";
+        host.selectTool(ToolType::FILL, false);
+        drag(host, v);
+    } else if (n == "select" || n == "lasso") {
+        bool lasso = n == "lasso";
+        if (!ints(cmd, 0, v) || v.size() % 2 || (lasso ? v.size() < 6 : v.size() != 4))
+            return lasso ? "usage: lasso X Y X Y X Y [...]" : "usage: select X0 Y0 X1 Y1";
+        host.selectTool(ToolType::SELECT, lasso);
+        drag(host, v);
+        SDL_Rect b;
+        if (!host.floatingBounds(b)) return "selection is empty";
+    } else if (n == "move") {
+        SDL_Rect b;
+        if (!ints(cmd, 0, v) || v.size() != 2) return "usage: move DX DY";
+        if (!host.floatingBounds(b)) return "nothing to move";
+        // Grab the middle of the box so no resize/rotate handle is hit.
+        int cx = b.x + b.w / 2, cy = b.y + b.h / 2;
+        drag(host, { cx, cy, cx + v[0], cy + v[1] });
+    } else if (n == "rotate") {
+        char* end = nullptr;
+        double deg = argc == 1 ? strtod(cmd.args[0].c_str(), &end) : 0.0;
+        if (argc != 1 || end == cmd.args[0].c_str() || *end) return "usage: rotate DEGREES";
+        if (!host.rotateFloating((float)(deg * M_PI / 180.0))) return "nothing to rotate";
+    } else if (n == "commit") {
+        if (argc) return "usage: commit";
+        host.commitTool();
+    } else if (n == "resize") {
+        bool scale = false;
+        int ox = 0, oy = 0;
+        std::vector<int> size;
+        for (size_t i = 0; i < argc; i++) {
+            int x;
+            if (cmd.args[i] == "scale") scale = true;
+            else if (cmd.args[i] == "origin" && i + 2 < argc &&
+                     toInt(cmd.args[i + 1], ox) && toInt(cmd.args[i + 2], oy)) i += 2;
+            else if (toInt(cmd.args[i], x)) size.push_back(x);
+            else return "usage: resize W H [scale] [origin X Y]";
+        }
+        if (size.size() != 2 || size[0] < 1 || size[1] < 1) return "usage: resize W H [scale] [origin X Y]";
+        host.commitTool();
+        int side = host.maxCanvasSide(), w = std::min(side, size[0]), h = std::min(side, size[1]);
+        if (!host.resizeCanvas(w, h, scale, ox, oy)) return "could not resize the canvas to " + sizeText(w, h);
+    } else if (n == "save") {
+        if (argc != 1) return "usage: save PATH";
+        host.commitTool();
+        if (!host.saveImage(cmd.args[0])) return "could not write " + cmd.args[0];
+    } else {
+        return "unknown command '" + n + "'";
+    }
+    return "";
+}
+
+} // namespace Script
@@ -0,0 +1,85 @@
+#pragma once
+
+// Script — drawing command stream for automated rendering.
+//
+// One command per line, either as words or as a JSON array:
+//     rect 10 10 200 120 filled          ["rect", 10, 10, 200, 120, "filled"]
+// Blank lines and lines starting with # are skipped. Commands are executed
+// through a Host, which feeds them to the same tools as mouse input: kPen in
+// the window (`kPen --script FILE`) and OffscreenCanvas in headless mode
+// (`kPen --headless run FILE`).
+//
+//   new W H                          blank transparent canvas (sizes clamp to the host's limit)
+//   clear [COLOR]                    fill the canvas (default transparent)
+//   color RRGGBB[AA]   size N        brush color / size (1-99)
+//   brush  [square] X Y [X Y ...]    stroke through the points
+//   eraser [square] X Y [X Y ...]
+//   line X0 Y0 X1 Y1
+//   rect X0 Y0 X1 Y1 [filled]        drag from corner to corner, then commit
+//   oval X0 Y0 X1 Y1 [filled]
+//   fill X Y
+//   select X0 Y0 X1 Y1               rectangle selection (stays floating)
+//   lasso X Y X Y X Y [...]
+//   move DX DY                       drag the floating selection
+//   rotate DEGREES                   turn the floating selection/shape clockwise
+//   commit                           stamp the floating selection
+//   resize W H [scale] [origin X Y]  same as the canvas resize handles
+//   save PATH
+
+#include <SDL2/SDL.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "Tools.h"
+
+namespace Script {
+
+struct Command {
+    std::string name;
+    std::vector<std::string> args;
+    int line = 0;
+};
+
+// What a script can do to a canvas. Coordinates are canvas pixels.
+class Host {
+  public:
+    virtual ~Host() {}
+    // option: square brush/eraser, filled rect/oval, lasso select.
+    virtual void selectTool(ToolType t, bool option) = 0;
+    virtual void setBrushSize(int size) = 0;
+    virtual void setBrushColor(SDL_Color color) = 0;
+    virtual void pointerDown(int cX, int cY) = 0;
+    virtual void pointerMove(int cX, int cY) = 0;
+    virtual void pointerUp  (int cX, int cY) = 0;
+    // Bounds of the floating selection or shape; false if there is none.
+    virtual bool floatingBounds(SDL_Rect& out) = 0;
+    // Rotate the floating selection or shape; false if there is none.
+    virtual bool rotateFloating(float radians) = 0;
+    virtual void commitTool() = 0;
+    // Largest canvas width/height this host can hold; new and resize clamp to it.
+    virtual int  maxCanvasSide() = 0;
+    virtual bool newCanvas(int w, int h) = 0;
+    virtual void clearCanvas(SDL_Color color) = 0;
+    virtual bool resizeCanvas(int newW, int newH, bool scaleContent, int originX = 0, int originY = 0) = 0;
+    virtual bool saveImage(const std::string& path) = 0;
+};
+
+// Reads commands from a file or stdin ("-").
+class Reader {
+    FILE* file_  = nullptr;
+    bool  owned_ = false;
+    int   line_  = 0;
+  public:
+    ~Reader();
+    bool open(const std::string& path);
+    // Next command; false at end of input. Malformed lines come back with an empty name.
+    bool next(Command& out);
+};
+
+// Split one line into a command. False for blank/comment lines.
+bool parseLine(const std::string& text, Command& out);
+
+// Run one command. Returns an error message, or "" on success.
+std::string execute(Host& host, const Command& cmd);
+
+} // namespace Script
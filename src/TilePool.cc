@@ -0,0 +1,148 @@
+#include "TilePool.h"
+#include <algorithm>
+#include <new>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// Throws std::bad_alloc on failure, like the new[] it replaces.
+static uint32_t* mapSlab() {
+#ifdef _WIN32
+    void* p = VirtualAlloc(nullptr, TilePool::SLAB_BYTES, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!p) throw std::bad_alloc();
+#else
+    void* p = mmap(nullptr, TilePool::SLAB_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) throw std::bad_alloc();
+#endif
+    return static_cast<uint32_t*>(p);
+}
+
+void TilePool::SlabUnmap::operator()(uint32_t* p) const {
+#ifdef _WIN32
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, SLAB_BYTES);
+#endif
+}
+
+TilePool::Handle TilePool::alloc() {
+    while (!open_.empty()) {
+        uint32_t id = open_.back();
+        Slab& s = slabs_[id];
+        if (s.pixels && !s.freeSlots.empty()) {
+            uint16_t slot = s.freeSlots.back();
+            s.freeSlots.pop_back();
+            s.refs[slot] = 1;
+            return id * SLAB_TILES + slot;
+        }
+        s.inOpen = false;
+        open_.pop_back();
+    }
+
+    uint32_t id;
+    if (!released_.empty()) {
+        id = released_.back();
+        released_.pop_back();
+    } else {
+        id = static_cast<uint32_t>(slabs_.size());
+        slabs_.emplace_back();
+    }
+    Slab& s = slabs_[id];
+    s.pixels.reset(mapSlab());
+    s.refs.assign(SLAB_TILES, 0);
+    s.refs[0] = 1;
+    liveSlabs_++;
+    // Slot 0 goes out now; hand out the rest in ascending order.
+    s.freeSlots.resize(SLAB_TILES - 1);
+    for (int i = 0; i < SLAB_TILES - 1; i++) s.freeSlots[i] = static_cast<uint16_t>(SLAB_TILES - 1 - i);
+    if (!s.inOpen) {
+        s.inOpen = true;
+        open_.push_back(id);
+    }
+    return id * SLAB_TILES;
+}
+
+bool TilePool::release(Handle h) {
+    uint32_t id = h / SLAB_TILES;
+    Slab& s = slabs_[id];
+    if (--s.refs[h % SLAB_TILES] > 0) return false;
+    s.freeSlots.push_back(static_cast<uint16_t>(h % SLAB_TILES));
+    if (s.freeSlots.size() == static_cast<size_t>(SLAB_TILES)) {
+        s.pixels.reset();
+        std::vector<uint16_t>().swap(s.freeSlots);
+        std::vector<uint32_t>().swap(s.refs);
+        liveSlabs_--;
+        released_.push_back(id);
+        return true;
+    }
+    if (!s.inOpen) {
+        s.inOpen = true;
+        open_.push_back(id);
+    }
+    return true;
+}
+
+// ── TileIndex ─────────────────────────────────────────────────────────────────
+// Hashes come from UndoManager::hashTile, already avalanched, so the low bits
+// pick the home slot directly.
+
+TilePool::Handle TileIndex::find(uint64_t hash) const {
+    if (slots_.empty()) return TilePool::NONE;
+    const size_t mask = slots_.size() - 1;
+    for (size_t i = hash & mask; slots_[i].block != TilePool::NONE; i = (i + 1) & mask)
+        if (slots_[i].hash == hash) return slots_[i].block;
+    return TilePool::NONE;
+}
+
+void TileIndex::insert(uint64_t hash, TilePool::Handle block) {
+    if ((used_ + 1) * 2 > slots_.size()) grow();
+    const size_t mask = slots_.size() - 1;
+    size_t i = hash & mask;
+    for (; slots_[i].block != TilePool::NONE; i = (i + 1) & mask)
+        if (slots_[i].hash == hash) return;
+    slots_[i].hash = hash;
+    slots_[i].block = block;
+    used_++;
+}
+
+// Backward-shift deletion: later entries of the probe run move up into the
+// hole, so lookups never need tombstones.
+void TileIndex::erase(uint64_t hash, TilePool::Handle block) {
+    if (slots_.empty()) return;
+    const size_t mask = slots_.size() - 1;
+    size_t i = hash & mask;
+    for (;; i = (i + 1) & mask) {
+        if (slots_[i].block == TilePool::NONE) return;
+        if (slots_[i].hash == hash) break;
+    }
+    if (slots_[i].block != block) return;
+    for (size_t j = (i + 1) & mask; slots_[j].block != TilePool::NONE; j = (j + 1) & mask) {
+        size_t home = slots_[j].hash & mask;
+        // Leave entries whose home lies cyclically in (i, j].
+        bool stays = i < j ? (home > i && home <= j) : (home > i || home <= j);
+        if (stays) continue;
+        slots_[i] = slots_[j];
+        i = j;
+    }
+    slots_[i] = Slot();
+    used_--;
+}
+
+void TileIndex::clear() {
+    std::vector<Slot>().swap(slots_);
+    used_ = 0;
+}
+
+void TileIndex::grow() {
+    std::vector<Slot> old;
+    old.swap(slots_);
+    slots_.resize(std::max<size_t>(old.size() * 2, TilePool::SLAB_TILES * 2));
+    used_ = 0;
+    for (const Slot& s : old)
+        if (s.block != TilePool::NONE) insert(s.hash, s.block);
+}
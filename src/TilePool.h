@@ -0,0 +1,86 @@
+#pragma once
+
+// TilePool — fixed-size blocks for undo tiles, carved out of 1 MB slabs.
+//
+// Tiles are addressed by 32-bit handles instead of owning their own heap
+// buffer, so a push that changes thousands of tiles costs a slab allocation
+// per SLAB_TILES tiles rather than one malloc each. Slabs are mapped
+// straight from the OS (mmap / VirtualAlloc) rather than taken from the heap,
+// so a slab whose tiles are all freed is unmapped and its memory returned.
+//
+// Blocks are reference counted so identical tiles can be shared between
+// history entries: alloc hands out one reference, retain adds one, and
+// release drops one, returning the block to its slab at zero.
+//
+// Not thread-safe: it belongs to whichever thread owns the UndoManager
+// history at the time.
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class TilePool {
+  public:
+    static constexpr int    TILE_PIXELS = 32 * 32;
+    static constexpr int    SLAB_TILES  = 256;
+    static constexpr size_t SLAB_BYTES  = static_cast<size_t>(TILE_PIXELS) * SLAB_TILES * sizeof(uint32_t);
+
+    using Handle = uint32_t;
+    static constexpr Handle NONE = ~Handle(0);
+
+    Handle    alloc();
+    void      retain(Handle h) { slabs_[h / SLAB_TILES].refs[h % SLAB_TILES]++; }
+    // True when that was the last reference and the block is free again.
+    bool      release(Handle h);
+    uint32_t  refCount(Handle h) const { return slabs_[h / SLAB_TILES].refs[h % SLAB_TILES]; }
+    uint32_t*       data(Handle h)       { return slabs_[h / SLAB_TILES].pixels.get() + (h % SLAB_TILES) * TILE_PIXELS; }
+    const uint32_t* data(Handle h) const { return slabs_[h / SLAB_TILES].pixels.get() + (h % SLAB_TILES) * TILE_PIXELS; }
+
+    size_t liveSlabs() const { return liveSlabs_; }
+    size_t bytes()     const { return liveSlabs_ * SLAB_BYTES; }
+
+  private:
+    struct SlabUnmap {
+        void operator()(uint32_t* p) const;
+    };
+    struct Slab {
+        std::unique_ptr<uint32_t[], SlabUnmap> pixels;   // null once released
+        std::vector<uint16_t>       freeSlots;
+        std::vector<uint32_t>       refs;     // per slot; 0 when free
+        bool                        inOpen = false;  // listed in open_
+    };
+    std::vector<Slab>     slabs_;
+    std::vector<uint32_t> open_;       // slabs that may have free slots (checked lazily)
+    std::vector<uint32_t> released_;   // slab ids to reuse
+    size_t                liveSlabs_ = 0;
+};
+
+// TileIndex — content hash -> pooled block, for sharing identical tiles.
+//
+// Open addressing with linear probing over one flat array, so indexing a tile
+// costs no allocation of its own: the table doubles (at half full) in bulk,
+// a handful of times over a history, much like the pool's slabs. One block
+// per hash; a colliding tile simply is not indexed.
+class TileIndex {
+  public:
+    // The block indexed under hash, or TilePool::NONE.
+    TilePool::Handle find(uint64_t hash) const;
+    // Index block under hash unless the hash is taken.
+    void   insert(uint64_t hash, TilePool::Handle block);
+    // Unindex hash if it maps to block.
+    void   erase(uint64_t hash, TilePool::Handle block);
+    void   clear();
+    size_t size()  const { return used_; }
+    size_t bytes() const { return slots_.capacity() * sizeof(Slot); }
+
+  private:
+    struct Slot {
+        uint64_t         hash  = 0;
+        TilePool::Handle block = TilePool::NONE;  // NONE: empty
+    };
+    void grow();
+
+    std::vector<Slot> slots_;  // power-of-two size
+    size_t            used_ = 0;
+};
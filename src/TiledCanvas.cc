@@ -0,0 +1,319 @@
+#include "TiledCanvas.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "DrawingUtils.h"
+#include "Trace.h"
+
+namespace {
+
+// Canvases created on this thread, for bound().
+thread_local std::vector<TiledCanvas*> tCanvases;
+
+bool isBlank(const uint8_t* rows, int w, int h, int pitch) {
+    for (int y = 0; y < h; y++) {
+        const uint32_t* row = reinterpret_cast<const uint32_t*>(rows + static_cast<size_t>(y) * pitch);
+        for (int x = 0; x < w; x++)
+            if (row[x]) return false;
+    }
+    return true;
+}
+
+} // namespace
+
+TiledCanvas::TiledCanvas(SDL_Renderer* r, MemoryStats::Category category) : r_(r), category_(category) {
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(r_, &info) == 0) {
+        if (info.max_texture_width  > 0) tileSize_ = std::min(tileSize_, info.max_texture_width);
+        if (info.max_texture_height > 0) tileSize_ = std::min(tileSize_, info.max_texture_height);
+    }
+    proxy_ = SDL_CreateTexture(r_, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, 1, 1);
+    tCanvases.push_back(this);
+}
+
+TiledCanvas::~TiledCanvas() {
+    releaseTiles();
+    if (proxy_) SDL_DestroyTexture(proxy_);
+    tCanvases.erase(std::find(tCanvases.begin(), tCanvases.end(), this));
+}
+
+bool TiledCanvas::reset(int w, int h) {
+    if (w < 1 || h < 1 || w > MAX_SIDE || h > MAX_SIDE) return false;
+    releaseTiles();
+    w_ = w;
+    h_ = h;
+    cols_ = (w + tileSize_ - 1) / tileSize_;
+    rows_ = (h + tileSize_ - 1) / tileSize_;
+    tiles_.assign(static_cast<size_t>(cols_) * rows_, Tile());
+    return true;
+}
+
+size_t TiledCanvas::tileCount() const {
+    return std::count_if(tiles_.begin(), tiles_.end(), [](const Tile& t) { return t.tex != nullptr; });
+}
+
+void TiledCanvas::bind() {
+    SDL_SetRenderTarget(r_, current_ ? current_ : proxy_);
+}
+
+TiledCanvas* TiledCanvas::bound(SDL_Renderer* r) {
+    if (tCanvases.empty()) return nullptr;
+    SDL_Texture* target = SDL_GetRenderTarget(r);
+    if (!target) return nullptr;
+    for (TiledCanvas* c : tCanvases)
+        if (c->r_ == r && c->owns(target)) return c;
+    return nullptr;
+}
+
+bool TiledCanvas::owns(SDL_Texture* t) const {
+    return t == proxy_ || t == current_ ||
+           std::any_of(tiles_.begin(), tiles_.end(), [t](const Tile& tile) { return tile.tex == t; });
+}
+
+SDL_Rect TiledCanvas::tileRect(int col, int row) const {
+    int x = col * tileSize_, y = row * tileSize_;
+    return { x, y, std::min(tileSize_, w_ - x), std::min(tileSize_, h_ - y) };
+}
+
+bool TiledCanvas::tileRange(const SDL_Rect& area, int& c0, int& r0, int& c1, int& r1) const {
+    int x0 = std::max(0, area.x), y0 = std::max(0, area.y);
+    int x1 = std::min(w_, area.x + area.w), y1 = std::min(h_, area.y + area.h);
+    if (x1 <= x0 || y1 <= y0) return false;
+    c0 = x0 / tileSize_;
+    r0 = y0 / tileSize_;
+    c1 = (x1 - 1) / tileSize_;
+    r1 = (y1 - 1) / tileSize_;
+    return true;
+}
+
+SDL_Texture* TiledCanvas::tile(int col, int row, bool create) {
+    SDL_Texture*& t = tiles_[static_cast<size_t>(row) * cols_ + col].tex;
+    if (t || !create) return t;
+    SDL_Rect rect = tileRect(col, row);
+    t = MemoryStats::createTexture(r_, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+                                   rect.w, rect.h, category_);
+    if (!t) return nullptr;
+    SDL_SetTextureBlendMode(t, SDL_BLENDMODE_BLEND);
+    // Texture contents start undefined; a new tile is transparent.
+    SDL_Texture* prev = SDL_GetRenderTarget(r_);
+    Uint8 cr, cg, cb, ca;
+    SDL_GetRenderDrawColor(r_, &cr, &cg, &cb, &ca);
+    SDL_SetRenderTarget(r_, t);
+    SDL_SetRenderDrawColor(r_, 0, 0, 0, 0);
+    SDL_RenderClear(r_);
+    SDL_SetRenderDrawColor(r_, cr, cg, cb, ca);
+    SDL_SetRenderTarget(r_, prev);
+    return t;
+}
+
+bool TiledCanvas::select(int col, int row) {
+    SDL_Texture* t = tile(col, row, true);
+    if (!t) return false;
+    if (SDL_GetRenderTarget(r_) != t) SDL_SetRenderTarget(r_, t);
+    current_ = t;
+    return true;
+}
+
+void TiledCanvas::markStale(int col, int row, const SDL_Rect& area) {
+    Tile& t = tiles_[static_cast<size_t>(row) * cols_ + col];
+    SDL_Rect tr = tileRect(col, row), part;
+    if (!SDL_IntersectRect(&area, &tr, &part)) return;
+    part.x -= tr.x;
+    part.y -= tr.y;
+    t.stale = DrawingUtils::unionRect(t.stale, part);
+}
+
+int TiledCanvas::mipLevels(int col, int row) const {
+    SDL_Rect tr = tileRect(col, row);
+    int levels = 0;
+    while (levels < MIP_LEVELS && (tr.w >> (levels + 1)) > 0 && (tr.h >> (levels + 1)) > 0) levels++;
+    return levels;
+}
+
+bool TiledCanvas::refreshMips(int col, int row) {
+    Tile& t = tiles_[static_cast<size_t>(row) * cols_ + col];
+    const int levels = mipLevels(col, row);
+    if (!t.tex || !levels) return false;
+    SDL_Rect tr = tileRect(col, row);
+    if (t.mips.empty()) {
+        // New mip textures start transparent, like the tile did; only what was
+        // drawn since (already in t.stale) needs filtering.
+        SDL_Texture* prev = SDL_GetRenderTarget(r_);
+        Uint8 cr, cg, cb, ca;
+        SDL_GetRenderDrawColor(r_, &cr, &cg, &cb, &ca);
+        SDL_SetRenderDrawColor(r_, 0, 0, 0, 0);
+        int w = tr.w, h = tr.h;
+        for (int l = 1; l <= levels; l++) {
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+            SDL_Texture* m = MemoryStats::createTexture(r_, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+                                                        w, h, category_);
+            if (!m) break;
+            SDL_SetTextureBlendMode(m, SDL_BLENDMODE_BLEND);
+            SDL_SetRenderTarget(r_, m);
+            SDL_RenderClear(r_);
+            t.mips.push_back(m);
+        }
+        SDL_SetRenderDrawColor(r_, cr, cg, cb, ca);
+        SDL_SetRenderTarget(r_, prev);
+        if ((int)t.mips.size() < levels) {
+            for (SDL_Texture* m : t.mips) MemoryStats::destroyTexture(m);
+            t.mips.clear();
+            return false;
+        }
+    }
+    if (t.stale.w <= 0 || t.stale.h <= 0) return true;
+
+    KPEN_TRACE_ZONE("TiledCanvas::refreshMips");
+    // Widen to whole blocks of the smallest level so every output pixel's
+    // inputs are in the read-back.
+    const int block = 1 << levels;
+    int x0 = t.stale.x & ~(block - 1), y0 = t.stale.y & ~(block - 1);
+    int x1 = std::min(tr.w, (t.stale.x + t.stale.w + block - 1) & ~(block - 1));
+    int y1 = std::min(tr.h, (t.stale.y + t.stale.h + block - 1) & ~(block - 1));
+    int w = x1 - x0, h = y1 - y0;
+    std::vector<uint32_t> src(static_cast<size_t>(w) * h), dst(static_cast<size_t>((w + 1) / 2) * ((h + 1) / 2));
+    SDL_Rect area = { x0, y0, w, h };
+    SDL_Texture* prev = SDL_GetRenderTarget(r_);
+    SDL_SetRenderTarget(r_, t.tex);
+    SDL_RenderReadPixels(r_, &area, SDL_PIXELFORMAT_ARGB8888, src.data(), w * 4);
+    SDL_SetRenderTarget(r_, prev);
+    for (int l = 1; l <= levels; l++) {
+        int dw = (w + 1) / 2, dh = (h + 1) / 2;
+        DrawingUtils::downsample2x(src.data(), w, h, w * 4, dst.data(), dw * 4);
+        SDL_Rect lr = { x0 >> l, y0 >> l, dw, dh };
+        SDL_UpdateTexture(t.mips[l - 1], &lr, dst.data(), dw * 4);
+        src.swap(dst);
+        w = dw;
+        h = dh;
+    }
+    t.stale = { 0, 0, 0, 0 };
+    return true;
+}
+
+void TiledCanvas::releaseTiles() {
+    for (Tile& t : tiles_) {
+        MemoryStats::destroyTexture(t.tex);  // SDL resets the target if it was this
+        for (SDL_Texture* m : t.mips) MemoryStats::destroyTexture(m);
+        t = Tile();
+    }
+    current_ = nullptr;
+}
+
+void TiledCanvas::clear(SDL_Color color) {
+    bool blank = !color.r && !color.g && !color.b && !color.a;
+    Uint8 cr, cg, cb, ca;
+    SDL_GetRenderDrawColor(r_, &cr, &cg, &cb, &ca);
+    SDL_SetRenderDrawColor(r_, color.r, color.g, color.b, color.a);
+    SDL_Rect all = { 0, 0, w_, h_ };
+    for (int row = 0; row < rows_; row++) {
+        for (int col = 0; col < cols_; col++) {
+            if ((blank && !tile(col, row, false)) || !select(col, row)) continue;
+            SDL_RenderClear(r_);
+            markStale(col, row, all);
+        }
+    }
+    SDL_SetRenderDrawColor(r_, cr, cg, cb, ca);
+}
+
+void TiledCanvas::read(const SDL_Rect& area, uint32_t* out, int pitch) {
+    int c0, r0, c1, r1;
+    if (!tileRange(area, c0, r0, c1, r1)) return;
+    SDL_Texture* prev = SDL_GetRenderTarget(r_);
+    for (int row = r0; row <= r1; row++) {
+        for (int col = c0; col <= c1; col++) {
+            SDL_Rect t = tileRect(col, row), part;
+            SDL_IntersectRect(&area, &t, &part);
+            uint8_t* dst = reinterpret_cast<uint8_t*>(out) + static_cast<size_t>(part.y - area.y) * pitch
+                         + static_cast<size_t>(part.x - area.x) * 4;
+            if (SDL_Texture* tex = tile(col, row, false)) {
+                SDL_Rect local = { part.x - t.x, part.y - t.y, part.w, part.h };
+                SDL_SetRenderTarget(r_, tex);
+                SDL_RenderReadPixels(r_, &local, SDL_PIXELFORMAT_ARGB8888, dst, pitch);
+            } else {
+                for (int y = 0; y < part.h; y++)
+                    std::memset(dst + static_cast<size_t>(y) * pitch, 0, static_cast<size_t>(part.w) * 4);
+            }
+        }
+    }
+    SDL_SetRenderTarget(r_, prev);
+}
+
+bool TiledCanvas::write(const SDL_Rect& area, const uint32_t* pixels, int pitch) {
+    int c0, r0, c1, r1;
+    if (!tileRange(area, c0, r0, c1, r1)) return true;
+    bool ok = true;
+    for (int row = r0; row <= r1; row++) {
+        for (int col = c0; col <= c1; col++) {
+            SDL_Rect t = tileRect(col, row), part;
+            SDL_IntersectRect(&area, &t, &part);
+            const uint8_t* src = reinterpret_cast<const uint8_t*>(pixels) + static_cast<size_t>(part.y - area.y) * pitch
+                               + static_cast<size_t>(part.x - area.x) * 4;
+            SDL_Texture* tex = tile(col, row, false);
+            if (!tex) {
+                if (isBlank(src, part.w, part.h, pitch)) continue;
+                if (!(tex = tile(col, row, true))) { ok = false; continue; }
+            }
+            SDL_Rect local = { part.x - t.x, part.y - t.y, part.w, part.h };
+            SDL_UpdateTexture(tex, &local, src, pitch);
+            markStale(col, row, part);
+        }
+    }
+    return ok;
+}
+
+void TiledCanvas::copyTo(const SDL_Rect& area, SDL_Texture* dst, int dstX, int dstY) {
+    SDL_Texture* prev = SDL_GetRenderTarget(r_);
+    Uint8 cr, cg, cb, ca;
+    SDL_BlendMode blend;
+    SDL_GetRenderDrawColor(r_, &cr, &cg, &cb, &ca);
+    SDL_GetRenderDrawBlendMode(r_, &blend);
+    SDL_SetRenderTarget(r_, dst);
+    // Clear the destination: missing tiles are transparent.
+    SDL_SetRenderDrawColor(r_, 0, 0, 0, 0);
+    SDL_SetRenderDrawBlendMode(r_, SDL_BLENDMODE_NONE);
+    SDL_Rect clear = { dstX, dstY, area.w, area.h };
+    SDL_RenderFillRect(r_, &clear);
+    SDL_SetRenderDrawBlendMode(r_, blend);
+    int c0, r0, c1, r1;
+    if (tileRange(area, c0, r0, c1, r1)) {
+        for (int row = r0; row <= r1; row++) {
+            for (int col = c0; col <= c1; col++) {
+                SDL_Texture* tex = tile(col, row, false);
+                if (!tex) continue;
+                SDL_Rect t = tileRect(col, row), part;
+                SDL_IntersectRect(&area, &t, &part);
+                SDL_Rect src = { part.x - t.x, part.y - t.y, part.w, part.h };
+                SDL_Rect to  = { dstX + part.x - area.x, dstY + part.y - area.y, part.w, part.h };
+                SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_NONE);  // exact copy, alpha included
+                SDL_RenderCopy(r_, tex, &src, &to);
+                SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
+            }
+        }
+    }
+    SDL_SetRenderDrawColor(r_, cr, cg, cb, ca);
+    SDL_SetRenderTarget(r_, prev);
+}
+
+void TiledCanvas::render(const SDL_FRect& dst, const SDL_Rect& clip, bool mipmapped) {
+    float sx = dst.w / w_, sy = dst.h / h_;
+    // Largest level still at least one texel per window pixel.
+    int level = 0;
+    if (mipmapped && sx < 0.5f)
+        level = std::min(MIP_LEVELS, (int)std::floor(std::log2(1.f / sx)));
+    for (int row = 0; row < rows_; row++) {
+        for (int col = 0; col < cols_; col++) {
+            SDL_Texture* tex = tile(col, row, false);
+            if (!tex) continue;
+            SDL_Rect t = tileRect(col, row);
+            // Edges from canvas coordinates, so neighbours share them exactly.
+            float x0 = dst.x + t.x * sx, x1 = dst.x + (t.x + t.w) * sx;
+            float y0 = dst.y + t.y * sy, y1 = dst.y + (t.y + t.h) * sy;
+            if (x1 <= clip.x || y1 <= clip.y || x0 >= clip.x + clip.w || y0 >= clip.y + clip.h) continue;
+            int l = std::min(level, mipLevels(col, row));
+            if (l > 0 && refreshMips(col, row)) tex = tiles_[static_cast<size_t>(row) * cols_ + col].mips[l - 1];
+            SDL_FRect d = { x0, y0, x1 - x0, y1 - y0 };
+            SDL_RenderCopyF(r_, tex, nullptr, &d);
+        }
+    }
+}
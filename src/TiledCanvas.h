@@ -0,0 +1,121 @@
+#pragma once
+
+// TiledCanvas — a canvas-sized render target stored as a grid of textures.
+//
+// GPUs cap texture sides (often at 8192 or 16384), so the canvas is split into
+// tiles of TILE_SIZE, or the renderer's limit if that is lower. A canvas that
+// fits in one tile is a single texture, as it always was. A tile's texture is
+// created the first time something is drawn into it or non-transparent pixels
+// are written to it, so the blank part of a huge canvas costs no texture
+// memory, and only tiles in view are drawn to the window.
+//
+// bind() makes the canvas the render target. While the canvas (or one of its
+// tiles) is the target, the DrawingUtils canvas primitives (renderFillRect,
+// renderLine, renderCopyEx, readPixels, ...) take canvas coordinates and reach
+// every tile a shape touches, so tools draw across tile boundaries without
+// knowing about them. A plain SDL_Render* call would only reach one tile.
+//
+// Zoomed out, render() can draw each tile from a mip level: a chain of half-
+// size copies (down to 1/64) so the window samples about one texel per pixel
+// instead of skipping most of a full-size tile, which is slow on huge canvases
+// and shimmers as the view moves. Drawing and writes only mark the part of a
+// tile they touch as stale; the next mipmapped render reads that part back
+// once, box-filters it down and uploads each level.
+//
+// Canvases are looked up per thread: a renderer and its canvases belong to
+// the thread that created them.
+
+#include <SDL2/SDL.h>
+#include <cstdint>
+#include <vector>
+#include "MemoryStats.h"
+
+class TiledCanvas {
+  public:
+    static constexpr int TILE_SIZE  = 4096;
+    static constexpr int MAX_SIDE   = 65536;
+    static constexpr int MIP_LEVELS = 6;
+
+    TiledCanvas(SDL_Renderer* r, MemoryStats::Category category);
+    ~TiledCanvas();
+    TiledCanvas(const TiledCanvas&) = delete;
+    TiledCanvas& operator=(const TiledCanvas&) = delete;
+
+    // Drop every tile and become a blank w×h canvas. False (nothing changed)
+    // if a side is outside 1..MAX_SIDE.
+    bool   reset(int w, int h);
+    int    width()     const { return w_; }
+    int    height()    const { return h_; }
+    int    tileSize()  const { return tileSize_; }
+    size_t tileCount() const;  // tiles with a texture
+
+    // Make the canvas the render target; SDL_SetRenderTarget(r, nullptr) ends it.
+    void bind();
+    // The canvas whose tile (or stand-in target) is r's render target, if any.
+    static TiledCanvas* bound(SDL_Renderer* r);
+
+    // Call draw(originX, originY) with each tile that `area` touches as the
+    // render target, creating tiles as needed. draw renders at canvas
+    // coordinates minus the origin. `touches(tileRect)` can rule out tiles
+    // inside `area` that the shape misses, so they are not created.
+    template<typename F, typename P> void forEachTile(const SDL_Rect& area, F draw, P touches) {
+        int c0, r0, c1, r1;
+        if (!tileRange(area, c0, r0, c1, r1)) return;
+        for (int row = r0; row <= r1; row++) {
+            for (int col = c0; col <= c1; col++) {
+                if (!touches(tileRect(col, row)) || !select(col, row)) continue;
+                markStale(col, row, area);
+                draw(col * tileSize_, row * tileSize_);
+            }
+        }
+    }
+    template<typename F> void forEachTile(const SDL_Rect& area, F draw) {
+        forEachTile(area, draw, [](const SDL_Rect&) { return true; });
+    }
+
+    // Fill the whole canvas with `color`. A transparent clear only touches
+    // tiles that exist.
+    void clear(SDL_Color color);
+    // ARGB8888 rows of `area` (inside the canvas); pitch in bytes. Tiles
+    // without a texture read as transparent.
+    void read(const SDL_Rect& area, uint32_t* out, int pitch);
+    // False if a tile that needed a texture could not get one.
+    bool write(const SDL_Rect& area, const uint32_t* pixels, int pitch);
+    // Copy `area` (inside the canvas) into target texture `dst` at (dstX,
+    // dstY), on the GPU: a snapshot that can be read back later without
+    // stalling now. The rest of `dst` is left as it was.
+    void copyTo(const SDL_Rect& area, SDL_Texture* dst, int dstX = 0, int dstY = 0);
+    // Copy to the current render target with the whole canvas mapped to
+    // `dst`, skipping tiles outside `clip`. With `mipmapped`, a canvas shown
+    // at under half size is drawn from the matching mip level.
+    void render(const SDL_FRect& dst, const SDL_Rect& clip, bool mipmapped = false);
+
+  private:
+    struct Tile {
+        SDL_Texture*              tex = nullptr;
+        std::vector<SDL_Texture*> mips;            // level 1.. ; empty until first needed
+        SDL_Rect                  stale = { 0, 0, 0, 0 };  // tile-local; mips out of date here
+    };
+
+    SDL_Renderer*          r_;
+    MemoryStats::Category  category_;
+    SDL_Texture*           proxy_   = nullptr;  // 1x1 target bound while no tile is
+    SDL_Texture*           current_ = nullptr;  // tile last made the target
+    int                    tileSize_ = TILE_SIZE;
+    int                    w_ = 0, h_ = 0, cols_ = 0, rows_ = 0;
+    std::vector<Tile>      tiles_;              // row-major; no texture until used
+
+    bool owns(SDL_Texture* t) const;
+    SDL_Rect tileRect(int col, int row) const;
+    bool tileRange(const SDL_Rect& area, int& c0, int& r0, int& c1, int& r1) const;
+    SDL_Texture* tile(int col, int row, bool create);
+    // Make tile (col, row) the render target, creating it. False if it can't be.
+    bool select(int col, int row);
+    // `area` (canvas coordinates) of tile (col, row) changed.
+    void markStale(int col, int row, const SDL_Rect& area);
+    // Levels kept for a tile: halve until MIP_LEVELS or a side would go under 1.
+    int  mipLevels(int col, int row) const;
+    // Bring tile (col, row)'s mips up to date, creating them. False on failure.
+    bool refreshMips(int col, int row);
+    void releaseTiles();
+};
@@ -1,6 +1,7 @@
 #define _USE_MATH_DEFINES
 #include "Toolbar.h"
 #include "kPen.h"
+#include "DrawingUtils.h"
 #include <SDL2/SDL_timer.h>
 #include <cmath>
 #include <algorithm>
@@ -70,78 +71,10 @@ void Toolbar::rgbToHsv(SDL_Color c, float& h, float& s, float& v) {
     if (h < 0) h += 1.f;
 }
 
-// 5x7 font: 7 rows per char, 5 LSBs per row (row-major). Index 0=space, 1-26=A-Z, 27-36=0-9, 37=comma.
-static const uint8_t FONT_5X7[38][7] = {
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // space
-    { 0x04, 0x0A, 0x11, 0x11, 0x1F, 0x11, 0x11 }, // A
-    { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E }, // B
-    { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E }, // C
-    { 0x1E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x1E }, // D
-    { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F }, // E
-    { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 }, // F
-    { 0x0E, 0x11, 0x10, 0x13, 0x11, 0x11, 0x0F }, // G
-    { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 }, // H
-    { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E }, // I
-    { 0x01, 0x01, 0x01, 0x01, 0x11, 0x11, 0x0E }, // J
-    { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 }, // K
-    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F }, // L
-    { 0x11, 0x1B, 0x15, 0x11, 0x11, 0x11, 0x11 }, // M
-    { 0x11, 0x19, 0x15, 0x13, 0x11, 0x11, 0x11 }, // N
-    { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, // O
-    { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 }, // P
-    { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D }, // Q
-    { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 }, // R
-    { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x11, 0x1E }, // S
-    { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 }, // T
-    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, // U
-    { 0x11, 0x11, 0x11, 0x0A, 0x0A, 0x04, 0x04 }, // V
-    { 0x11, 0x11, 0x11, 0x15, 0x15, 0x1B, 0x11 }, // W
-    { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 }, // X
-    { 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04, 0x04 }, // Y
-    { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F }, // Z
-    // 27-36: 0-9
-    { 0x1F, 0x11, 0x11, 0x11, 0x11, 0x11, 0x1F }, // 0
-    { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x1F }, // 1
-    { 0x1F, 0x01, 0x01, 0x1F, 0x10, 0x10, 0x1F }, // 2
-    { 0x1F, 0x01, 0x01, 0x0F, 0x01, 0x01, 0x1F }, // 3
-    { 0x11, 0x11, 0x11, 0x1F, 0x01, 0x01, 0x01 }, // 4
-    { 0x1F, 0x10, 0x10, 0x1F, 0x01, 0x01, 0x1F }, // 5
-    { 0x1F, 0x10, 0x10, 0x1F, 0x11, 0x11, 0x1F }, // 6
-    { 0x1F, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01 }, // 7
-    { 0x1F, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x1F }, // 8
-    { 0x1F, 0x11, 0x11, 0x1F, 0x01, 0x01, 0x1F }, // 9
-    { 0x00, 0x00, 0x00, 0x00, 0x04, 0x04, 0x08 }, // comma (37)
-};
-
 static void formatRgb(char* buf, size_t size, const SDL_Color& c) {
     snprintf(buf, size, "%d,%d,%d", (int)c.r, (int)c.g, (int)c.b);
 }
 
-static void drawTooltipString(SDL_Renderer* r, int x, int y, const char* s) {
-    const int scale = 1;
-    const int charW = 5 * scale + 2;
-    int cx = x;
-    for (; *s; s++) {
-        char c = *s;
-        int gi = 0;
-        if (c >= 'A' && c <= 'Z') gi = 1 + (c - 'A');
-        else if (c >= 'a' && c <= 'z') gi = 1 + (c - 'a');
-        else if (c >= '0' && c <= '9') gi = 27 + (c - '0');
-        else if (c == ',') gi = 37;
-        if (gi < 0 || gi > 37) continue;
-        const uint8_t* rows = FONT_5X7[gi];
-        for (int row = 0; row < 7; row++) {
-            for (int col = 0; col < 5; col++) {
-                if (rows[row] & (1 << (4 - col))) {
-                    SDL_Rect px = { cx + col * scale, y + row * scale, scale, scale };
-                    SDL_RenderFillRect(r, &px);
-                }
-            }
-        }
-        cx += charW;
-    }
-}
-
 void Toolbar::drawTooltip(int winW, int winH) {
     if (tooltipMouseX < 0 || tooltipMouseY < 0) return;
     if (draggingSwatch) return;
@@ -260,7 +193,7 @@ void Toolbar::drawTooltip(int winW, int winH) {
     SDL_SetRenderDrawColor(renderer, 100, 100, 110, 255);
     SDL_RenderDrawRect(renderer, &box);
     SDL_SetRenderDrawColor(renderer, 230, 230, 240, 255);
-    drawTooltipString(renderer, tipX + padH, tipY + padV, label);
+    DrawingUtils::drawText(renderer, tipX + padH, tipY + padV, label);
 }
 
 int Toolbar::hitCustomSwatch(int x, int y) const {
@@ -1269,7 +1202,7 @@ bool Toolbar::hitResizePanel(int x, int y, bool isDown) {
 
 // Use the focused dimension field and set the other from aspect ratio (resizeLockW/H), with CANVAS_MAX.
 void Toolbar::applyAspectFromFocusedField() {
-    static const int CANVAS_MAX = 16384;
+    static const int CANVAS_MAX = TiledCanvas::MAX_SIDE;
     if (resizeLockW <= 0 || resizeLockH <= 0) return;
     auto parseBuf = [](const char* buf, int len) {
         int v = 0; for (int i = 0; i < len; i++) v = v * 10 + (buf[i] - '0'); return v;
@@ -1317,9 +1250,9 @@ void Toolbar::applyAspectLock(bool srcIsW) {
     }
 }
 
-// Clamp the just-edited dimension to 16384, and if aspect lock is on, also
-// ensure the linked dimension stays within 16384 (back-calculating the source cap).
-static const int CANVAS_MAX = 16384;
+// Clamp the just-edited dimension to CANVAS_MAX, and if aspect lock is on, also
+// ensure the linked dimension stays within it (back-calculating the source cap).
+static const int CANVAS_MAX = TiledCanvas::MAX_SIDE;
 
 void Toolbar::clampResizeInput(bool srcIsW) {
     auto parseBuf = [](const char* buf, int len) {
@@ -2,8 +2,10 @@
 
 #include <SDL2/SDL.h>
 #include <functional>
+#include <memory>
 #include <vector>
 #include "DrawingUtils.h"
+#include "UndoCommand.h"
 
 enum class ToolType { BRUSH, ERASER, LINE, RECT, CIRCLE, SELECT, FILL, PICK, RESIZE, HAND };
 
@@ -26,10 +28,18 @@ class AbstractTool {
     ICoordinateMapper* mapper;
     bool isDrawing = false;
     int  startX = 0, startY = 0, lastX = 0, lastY = 0;
+    SDL_Rect dirtyRect = {0, 0, 0, 0};
+    void markDirty(const SDL_Rect& area) { dirtyRect = DrawingUtils::unionRect(dirtyRect, area); }
   public:
     AbstractTool(ICoordinateMapper* m) : mapper(m) {}
     virtual ~AbstractTool() {}
     bool isActive()  const { return isDrawing; }
+    /** True if every canvas change this tool makes is reported by takeDirtyRect. */
+    virtual bool tracksDirtyRect() const { return false; }
+    /** Canvas area drawn since the last call (w == 0 if none); resets it. */
+    SDL_Rect takeDirtyRect() { SDL_Rect d = dirtyRect; dirtyRect = {0, 0, 0, 0}; return d; }
+    /** The last finished edit as a replayable command, or nullptr; resets it. */
+    virtual std::unique_ptr<UndoCommand> takeCommand() { return nullptr; }
     virtual void onMouseDown(int cX, int cY, SDL_Renderer* r, int brushSize, SDL_Color color);
     virtual void onMouseMove(int cX, int cY, SDL_Renderer* r, int brushSize, SDL_Color color);
     virtual bool onMouseUp  (int cX, int cY, SDL_Renderer* r, int brushSize, SDL_Color color);
@@ -40,12 +50,30 @@ class AbstractTool {
 };
 
 // --- StrokeTool: shared stroke logic for Brush and Eraser ---
+// A finished stroke as its input: replaying it drives a fresh tool through
+// the same pointer events on a software renderer.
+class StrokeCommand : public UndoCommand {
+  public:
+    bool eraser = false, square = false;
+    int  brushSize = 1;
+    SDL_Color color = { 0, 0, 0, 255 };
+    std::vector<SDL_Point> points;  // pointer down, then each move while drawing
+
+    void   apply(uint32_t* pixels, int w, int h) const override;
+    size_t bytes() const override { return sizeof(*this) + points.capacity() * sizeof(SDL_Point); }
+};
+
 class StrokeTool : public AbstractTool {
   protected:
+    std::unique_ptr<StrokeCommand> command;  // null if size or color changed mid-stroke
     virtual void stampAt(SDL_Renderer* r, int cx, int cy, int brushSize, int cw, int ch, SDL_Color color) = 0;
     virtual void drawSegment(SDL_Renderer* r, int x0, int y0, int x1, int y1, int brushSize, int cw, int ch, SDL_Color color) = 0;
   public:
-    using AbstractTool::AbstractTool;
+    bool squareBrush = false;
+    const bool eraser;
+    StrokeTool(ICoordinateMapper* m, bool square, bool erases) : AbstractTool(m), squareBrush(square), eraser(erases) {}
+    bool tracksDirtyRect() const override { return true; }
+    std::unique_ptr<UndoCommand> takeCommand() override;
     void onMouseDown(int cX, int cY, SDL_Renderer* r, int brushSize, SDL_Color color) override;
     void onMouseMove(int cX, int cY, SDL_Renderer* r, int brushSize, SDL_Color color) override;
 };
@@ -110,6 +138,7 @@ class TransformTool : public AbstractTool {
     Handle getHandleForCursor(int cX, int cY) const { return getHandle(cX, cY); }
     Handle getResizingHandle() const { return resizing; }
     void nudge(int dx, int dy);
+    void rotateBy(float radians);
 
   protected:
     virtual void snapBounds(int& /*newX*/, int& /*newY*/, int& /*newW*/, int& /*newH*/) {}
@@ -186,8 +215,7 @@ class ResizeTool : public TransformTool {
 
 class BrushTool : public StrokeTool {
   public:
-    bool squareBrush = false;
-    BrushTool(ICoordinateMapper* m, bool square = false) : StrokeTool(m), squareBrush(square) {}
+    BrushTool(ICoordinateMapper* m, bool square = false) : StrokeTool(m, square, false) {}
     void stampAt(SDL_Renderer* r, int cx, int cy, int brushSize, int cw, int ch, SDL_Color color) override;
     void drawSegment(SDL_Renderer* r, int x0, int y0, int x1, int y1, int brushSize, int cw, int ch, SDL_Color color) override;
     void onPreviewRender(SDL_Renderer* r, int brushSize, SDL_Color color) override;
@@ -195,8 +223,7 @@ class BrushTool : public StrokeTool {
 
 class EraserTool : public StrokeTool {
   public:
-    bool squareBrush = false;
-    EraserTool(ICoordinateMapper* m, bool square = false) : StrokeTool(m), squareBrush(square) {}
+    EraserTool(ICoordinateMapper* m, bool square = false) : StrokeTool(m, square, true) {}
     void stampAt(SDL_Renderer* r, int cx, int cy, int brushSize, int cw, int ch, SDL_Color color) override;
     void drawSegment(SDL_Renderer* r, int x0, int y0, int x1, int y1, int brushSize, int cw, int ch, SDL_Color color) override;
     void onPreviewRender(SDL_Renderer* r, int brushSize, SDL_Color color) override;
@@ -0,0 +1,126 @@
+#include "Trace.h"
+
+#ifdef KPEN_ENABLE_TRACING
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Trace {
+
+namespace {
+
+struct Event {
+    const char* name;
+    uint64_t    start, dur;
+    uint32_t    tid;
+};
+
+constexpr size_t kRingSize = 1 << 16;  // events per thread (2 MB)
+
+struct Ring {
+    Event events[kRingSize];
+    std::atomic<uint64_t> written{0};
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Ring>> rings;  // kept until exit so dump sees finished threads
+    std::vector<Ring*> idle;                   // rings whose thread has ended
+    uint32_t nextTid = 1;
+};
+
+// Leaked on purpose: thread_local slots hand their rings back during exit.
+Registry& registry() {
+    static Registry* r = new Registry;
+    return *r;
+}
+
+// Binds a ring to the calling thread for its lifetime. Parallel::parallelFor
+// starts fresh threads on every call, so rings are recycled rather than
+// allocated per thread; events keep the tid of the thread that wrote them.
+struct ThreadSlot {
+    Ring*    ring = nullptr;
+    uint32_t tid  = 0;
+    ThreadSlot() {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        tid = reg.nextTid++;
+        if (!reg.idle.empty()) {
+            ring = reg.idle.back();
+            reg.idle.pop_back();
+        } else {
+            reg.rings.push_back(std::make_unique<Ring>());
+            ring = reg.rings.back().get();
+        }
+    }
+    ~ThreadSlot() {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.idle.push_back(ring);
+    }
+};
+
+const std::chrono::steady_clock::time_point kEpoch = std::chrono::steady_clock::now();
+std::string gExitPath;
+
+void dumpAtExit() {
+    if (dump(gExitPath)) fprintf(stderr, "kPen: trace written to %s\n", gExitPath.c_str());
+    else                 fprintf(stderr, "kPen: could not write trace %s\n", gExitPath.c_str());
+}
+
+} // namespace
+
+uint64_t nowNs() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - kEpoch).count();
+}
+
+void record(const char* name, uint64_t startNs, uint64_t endNs) {
+    thread_local ThreadSlot slot;
+    Ring& r = *slot.ring;
+    uint64_t n = r.written.load(std::memory_order_relaxed);
+    r.events[n % kRingSize] = { name, startNs, endNs - startNs, slot.tid };
+    r.written.store(n + 1, std::memory_order_release);
+}
+
+// Rings are read without stopping their writers; an event being overwritten
+// while it is copied can come out mixed, which only matters for a full ring.
+bool dump(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (auto& ring : reg.rings) {
+            uint64_t n = ring->written.load(std::memory_order_acquire);
+            uint64_t count = std::min<uint64_t>(n, kRingSize);
+            for (uint64_t i = n - count; i < n; i++) {
+                const Event& e = ring->events[i % kRingSize];
+                fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                        first ? "" : ",\n", e.name, e.tid, e.start / 1000.0, e.dur / 1000.0);
+                first = false;
+            }
+        }
+    }
+    fprintf(f, "\n]}\n");
+    return fclose(f) == 0;
+}
+
+void dumpAtExitFromEnv() {
+    const char* path = getenv("KPEN_TRACE");
+    if (!path || !*path) return;
+    gExitPath = path;
+    atexit(dumpAtExit);
+}
+
+} // namespace Trace
+
+#endif // KPEN_ENABLE_TRACING
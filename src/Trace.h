@@ -0,0 +1,57 @@
+#pragma once
+
+// Trace — scoped timing zones exported as Chrome trace-event JSON (open the
+// file in chrome://tracing or ui.perfetto.dev).
+//
+// Zones compile to nothing unless the build defines KPEN_ENABLE_TRACING
+// (cmake -DKPEN_ENABLE_TRACING=ON). When enabled, each thread appends to its
+// own fixed-size ring, overwriting the oldest events, with no locks on the
+// hot path. The trace is written by File > Save Performance Trace, or at exit
+// when the KPEN_TRACE environment variable names a file.
+//
+//     KPEN_TRACE_ZONE("saveState");   // times the rest of the enclosing scope
+//
+// Zone names must be string literals: only the pointer is kept.
+
+#include <SDL2/SDL.h>
+
+#ifdef KPEN_ENABLE_TRACING
+
+#include <cstdint>
+#include <string>
+
+namespace Trace {
+
+uint64_t nowNs();
+void record(const char* name, uint64_t startNs, uint64_t endNs);
+// Write every thread's buffered events. False if the file can't be written.
+bool dump(const std::string& path);
+// If KPEN_TRACE is set, dump to that path when the process exits.
+void dumpAtExitFromEnv();
+
+class Zone {
+    const char* name_;
+    uint64_t    start_;
+  public:
+    explicit Zone(const char* name) : name_(name), start_(nowNs()) {}
+    ~Zone() { record(name_, start_, nowNs()); }
+    Zone(const Zone&) = delete;
+    Zone& operator=(const Zone&) = delete;
+};
+
+} // namespace Trace
+
+#define KPEN_TRACE_CAT2(a, b) a##b
+#define KPEN_TRACE_CAT(a, b)  KPEN_TRACE_CAT2(a, b)
+#define KPEN_TRACE_ZONE(name) Trace::Zone KPEN_TRACE_CAT(kpenTraceZone_, __LINE__)(name)
+
+// GPU <-> CPU pixel transfers: every call in a file that includes this header
+// gets a zone (the temporary lives until the end of the call's full-expression).
+#define SDL_RenderReadPixels(...) (Trace::Zone("SDL_RenderReadPixels"), SDL_RenderReadPixels(__VA_ARGS__))
+#define SDL_UpdateTexture(...)    (Trace::Zone("SDL_UpdateTexture"), SDL_UpdateTexture(__VA_ARGS__))
+
+#else
+
+#define KPEN_TRACE_ZONE(name) ((void)0)
+
+#endif
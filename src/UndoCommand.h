@@ -0,0 +1,20 @@
+#pragma once
+
+// UndoCommand — an edit UndoManager can keep as its parameters and redraw
+// when a state is needed, instead of storing the pixels it changed.
+//
+// apply must reproduce the edit exactly and be callable from any thread:
+// UndoManager checks it once against the real result before trusting it,
+// then replays it on the undo worker or the main thread.
+
+#include <cstddef>
+#include <cstdint>
+
+class UndoCommand {
+  public:
+    virtual ~UndoCommand() {}
+    // Redraw onto `pixels`, the w×h ARGB state below the step, in place.
+    virtual void apply(uint32_t* pixels, int w, int h) const = 0;
+    // Bytes held, for MemoryStats.
+    virtual size_t bytes() const = 0;
+};
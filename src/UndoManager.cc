@@ -1,7 +1,42 @@
 #include "UndoManager.h"
+#include "MemoryStats.h"
+#include "DrawingUtils.h"
+#include "Trace.h"
 #include <algorithm>
 #include <cstring>
 
+namespace {
+
+// Row-wise kernels over a cols×rows block. memcmp and memcpy are vectorized
+// by the C library, so diffing unchanged tiles runs at memory bandwidth.
+bool blocksEqual(const uint32_t* a, size_t aStride, const uint32_t* b, size_t bStride, int cols, int rows) {
+    size_t bytes = static_cast<size_t>(cols) * sizeof(uint32_t);
+    for (int y = 0; y < rows; y++, a += aStride, b += bStride)
+        if (std::memcmp(a, b, bytes) != 0) return false;
+    return true;
+}
+
+void copyBlock(uint32_t* dst, size_t dstStride, const uint32_t* src, size_t srcStride, int cols, int rows) {
+    size_t bytes = static_cast<size_t>(cols) * sizeof(uint32_t);
+    for (int y = 0; y < rows; y++, dst += dstStride, src += srcStride)
+        std::memcpy(dst, src, bytes);
+}
+
+} // namespace
+
+UndoManager::~UndoManager() {
+    if (worker_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        workCv_.notify_one();
+        worker_.join();
+    }
+    for (int c = 0; c < 4; c++) publish(c, 0);
+    MemoryStats::addOnDisk(-static_cast<long long>(publishedDisk_));
+}
+
 int UndoManager::numTilesX(int w) {
     return (w + TILE - 1) / TILE;
 }
@@ -18,116 +53,449 @@ void UndoManager::invalidateCache() {
     cachedIndex_ = static_cast<size_t>(-1);
 }
 
-void UndoManager::reconstructState(size_t index, std::vector<uint32_t>& out, int& outW, int& outH) {
-    outW = undoStack_[index].w;
-    outH = undoStack_[index].h;
-    size_t n = static_cast<size_t>(outW) * static_cast<size_t>(outH);
-    out.resize(n);
-    for (size_t i = 0; i <= index; i++) {
-        const UndoEntry& e = undoStack_[i];
-        if (e.is_full) {
-            out = e.full_pixels;
+static_assert(UndoManager::TILE * UndoManager::TILE == TilePool::TILE_PIXELS, "pool blocks hold one tile");
+
+// A tile is TILE×TILE; the part past the canvas's right/bottom edge is zero.
+void UndoManager::extractTile(uint32_t* tile, const uint32_t* src, size_t stride, int cols, int rows) {
+    for (int y = 0; y < rows; y++, src += stride, tile += TILE) {
+        std::memcpy(tile, src, static_cast<size_t>(cols) * sizeof(uint32_t));
+        if (cols < TILE) std::memset(tile + cols, 0, static_cast<size_t>(TILE - cols) * sizeof(uint32_t));
+    }
+    if (rows < TILE) std::memset(tile, 0, static_cast<size_t>(TILE - rows) * TILE * sizeof(uint32_t));
+}
+
+// Word-at-a-time FNV-1a with a final avalanche; only used to find
+// candidates, which are then compared in full.
+uint64_t UndoManager::hashTile(const uint32_t* tile) {
+    uint64_t h = 1469598103934665603ull;
+    for (int i = 0; i < TILE * TILE; i += 2) {
+        uint64_t v = static_cast<uint64_t>(tile[i]) | (static_cast<uint64_t>(tile[i + 1]) << 32);
+        h = (h ^ v) * 1099511628211ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+UndoManager::TileRef UndoManager::storeTile(int index, const uint32_t* tile, int cols, int rows) {
+    TileRef ref;
+    ref.index = index;
+    uint32_t c = tile[0];
+    bool uniform = true;
+    for (int y = 0; y < rows && uniform; y++) {
+        const uint32_t* row = tile + static_cast<size_t>(y) * TILE;
+        for (int x = 0; x < cols; x++)
+            if (row[x] != c) { uniform = false; break; }
+    }
+    if (uniform) {
+        ref.color = c;
+        return ref;
+    }
+    uint64_t hash = hashTile(tile);
+    TilePool::Handle shared = sharedTiles_.find(hash);
+    if (shared != TilePool::NONE &&
+        std::memcmp(tilePool_.data(shared), tile, TilePool::TILE_PIXELS * sizeof(uint32_t)) == 0) {
+        tilePool_.retain(shared);
+        ref.block = shared;
+        return ref;
+    }
+    ref.block = tilePool_.alloc();
+    std::memcpy(tilePool_.data(ref.block), tile, TilePool::TILE_PIXELS * sizeof(uint32_t));
+    // On a hash collision the block already indexed keeps the slot.
+    sharedTiles_.insert(hash, ref.block);
+    return ref;
+}
+
+void UndoManager::applyTiles(const UndoEntry& e, std::vector<uint32_t>& out) const {
+    int ntx = numTilesX(e.w);
+    for (const TileRef& t : e.tiles) {
+        int baseX = (t.index % ntx) * TILE;
+        int baseY = (t.index / ntx) * TILE;
+        int cols = std::min(TILE, e.w - baseX);
+        int rows = std::min(TILE, e.h - baseY);
+        uint32_t* dst = out.data() + static_cast<size_t>(baseY) * e.w + baseX;
+        if (t.block == TilePool::NONE) {
+            for (int y = 0; y < rows; y++, dst += e.w) std::fill_n(dst, cols, t.color);
             continue;
         }
-        int ntx = numTilesX(e.w);
-        for (const auto& p : e.tiles) {
-            int ti = p.first;
-            int ty = ti / ntx;
-            int tx = ti % ntx;
-            const std::vector<uint32_t>& tile = p.second;
+        copyBlock(dst, e.w, tileData(e, t), TILE, cols, rows);
+    }
+}
+
+const uint32_t* UndoManager::tileData(const UndoEntry& e, const TileRef& t) const {
+    if (!e.spilled) return tilePool_.data(t.block);
+    return reinterpret_cast<const uint32_t*>(spill_.at(e.spillOffset)) + static_cast<size_t>(t.block) * TilePool::TILE_PIXELS;
+}
+
+void UndoManager::releaseTile(const TileRef& t) {
+    if (t.block == TilePool::NONE) return;
+    if (tilePool_.refCount(t.block) == 1) sharedTiles_.erase(hashTile(tilePool_.data(t.block)), t.block);
+    tilePool_.release(t.block);
+}
+
+void UndoManager::releaseTiles(UndoEntry& e) {
+    if (!e.spilled)
+        for (const TileRef& t : e.tiles) releaseTile(t);
+    std::vector<TileRef>().swap(e.tiles);
+}
+
+// Both lists are in tile order; where they overlap, `changed` wins.
+void UndoManager::mergeTiles(UndoEntry& e, UndoEntry& changed) {
+    std::vector<TileRef> merged;
+    merged.reserve(e.tiles.size() + changed.tiles.size());
+    size_t i = 0, j = 0;
+    while (i < e.tiles.size() || j < changed.tiles.size()) {
+        if (j == changed.tiles.size() || (i < e.tiles.size() && e.tiles[i].index < changed.tiles[j].index)) {
+            merged.push_back(e.tiles[i++]);
+            continue;
+        }
+        if (i < e.tiles.size() && e.tiles[i].index == changed.tiles[j].index) releaseTile(e.tiles[i++]);
+        merged.push_back(changed.tiles[j++]);
+    }
+    e.tiles = std::move(merged);
+    changed.tiles.clear();
+}
+
+// Only for the thread owning the history: redo tiles live in tilePool_ too.
+void UndoManager::releaseRedo() {
+    for (UndoEntry& e : redoStack_) releaseTiles(e);
+    redoStack_.clear();
+}
+
+void UndoManager::diffTiles(UndoEntry& e, const uint32_t* base, const uint32_t* pixels) {
+    int w = e.w, h = e.h;
+    int ntx = numTilesX(w);
+    int nty = numTilesY(h);
+    scratchTiles_.clear();
+    uint32_t tile[TILE * TILE];
+    for (int ty = 0; ty < nty; ty++) {
+        int baseY = ty * TILE;
+        int rows = std::min(TILE, h - baseY);
+        for (int tx = 0; tx < ntx; tx++) {
             int baseX = tx * TILE;
-            int baseY = ty * TILE;
-            for (int dy = 0; dy < TILE; dy++) {
-                int y = baseY + dy;
-                if (y >= e.h) break;
-                for (int dx = 0; dx < TILE; dx++) {
-                    int x = baseX + dx;
-                    if (x >= e.w) break;
-                    out[static_cast<size_t>(y) * e.w + x] = tile[static_cast<size_t>(dy) * TILE + dx];
-                }
-            }
+            int cols = std::min(TILE, w - baseX);
+            size_t off = static_cast<size_t>(baseY) * w + baseX;
+            if (blocksEqual(pixels + off, w, base + off, w, cols, rows)) continue;
+            extractTile(tile, pixels + off, w, cols, rows);
+            scratchTiles_.push_back(storeTile(tileIndex(tx, ty, ntx), tile, cols, rows));
         }
     }
+    e.tiles.assign(scratchTiles_.begin(), scratchTiles_.end());  // one exact-size allocation
+}
+
+// `out` holds the state below e (whatever its size) and becomes e's state.
+void UndoManager::applyEntry(const UndoEntry& e, std::vector<uint32_t>& out) const {
+    if (e.is_full && e.spilled) {
+        const uint32_t* src = reinterpret_cast<const uint32_t*>(spill_.at(e.spillOffset));
+        out.assign(src, src + static_cast<size_t>(e.w) * e.h);
+    } else if (e.is_full)
+        out = e.full_pixels;
+    else if (e.is_resize)
+        out = DrawingUtils::resizePixels(out.data(), e.fromW, e.fromH, e.w, e.h,
+                                         e.scaleContent, e.originX, e.originY);
+    else {
+        if (e.command) e.command->apply(out.data(), e.w, e.h);
+        applyTiles(e, out);
+    }
+}
+
+void UndoManager::reconstructState(size_t index, std::vector<uint32_t>& out, int& outW, int& outH) {
+    KPEN_TRACE_ZONE("UndoManager::reconstructState");
+    outW = undoStack_[index].w;
+    outH = undoStack_[index].h;
+    size_t n = static_cast<size_t>(outW) * static_cast<size_t>(outH);
+    out.resize(n);
+    size_t first = index;
+    while (first > 0 && !undoStack_[first].is_full) first--;
+    for (size_t i = first; i <= index; i++) applyEntry(undoStack_[i], out);
     outW = undoStack_[index].w;
     outH = undoStack_[index].h;
 }
 
 int UndoManager::pushUndo(int w, int h, const std::vector<uint32_t>& pixels) {
+    waitIdle();
+    releaseRedo();
+    publishRedo();
+    int serial = nextStateSerial_++;
+    commitPush(serial, w, h, pixels.data(), nullptr);
+    return serial;
+}
+
+int UndoManager::pushUndoRegion(int w, int h, int rx, int ry, int rw, int rh, const uint32_t* region) {
+    waitIdle();
+    if (undoStack_.empty() || undoStack_.back().w != w || undoStack_.back().h != h) return 0;
+    releaseRedo();
+    publishRedo();
+    int serial = nextStateSerial_++;
+    commitPushRegion(serial, w, h, rx, ry, rw, rh, region, nullptr);
+    return serial;
+}
+
+int UndoManager::pushUndoAsync(int w, int h, std::vector<uint32_t> pixels) {
+    PushJob job;
+    job.staleRedo = std::move(redoStack_);
     redoStack_.clear();
-    invalidateCache();
+    publishRedo();
+    job.w = w;
+    job.h = h;
+    job.serial = nextStateSerial_++;
+    job.pixels = std::move(pixels);
+    return enqueue(std::move(job));
+}
+
+// The state a region applies to is the last queued push, or the top of the
+// history once the queue is empty.
+bool UndoManager::canPushRegion(int w, int h) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return jobs_.empty()
+        ? !undoStack_.empty() && undoStack_.back().w == w && undoStack_.back().h == h
+        : jobs_.back().w == w && jobs_.back().h == h;
+}
+
+int UndoManager::pushUndoRegionAsync(int w, int h, int rx, int ry, int rw, int rh, std::vector<uint32_t> region,
+                                     std::unique_ptr<UndoCommand> command) {
+    if (!canPushRegion(w, h)) return 0;
+    PushJob job;
+    job.staleRedo = std::move(redoStack_);
+    redoStack_.clear();
+    publishRedo();
+    job.w = w;
+    job.h = h;
+    job.serial = nextStateSerial_++;
+    job.region = true;
+    job.rx = rx; job.ry = ry; job.rw = rw; job.rh = rh;
+    job.pixels = std::move(region);
+    if (commandSpacing_) job.command = std::move(command);
+    return enqueue(std::move(job));
+}
+
+int UndoManager::enqueue(PushJob job) {
+    int serial = job.serial;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (jobs_.empty()) appliedSize_ = undoStack_.size();  // worker is idle
+    jobs_.push_back(std::move(job));
+    if (!worker_.joinable()) worker_ = std::thread(&UndoManager::workerLoop, this);
+    workCv_.notify_one();
+    return serial;
+}
+
+// A job leaves the queue only once it is in the history, so waitIdle,
+// currentSerial and getUndoSize count the one being diffed.
+void UndoManager::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        workCv_.wait(lock, [&]{ return stop_ || !jobs_.empty(); });
+        if (jobs_.empty()) return;
+        PushJob& job = jobs_.front();
+        lock.unlock();
+        for (UndoEntry& e : job.staleRedo) releaseTiles(e);
+        if (job.region)
+            commitPushRegion(job.serial, job.w, job.h, job.rx, job.ry, job.rw, job.rh, job.pixels.data(),
+                             std::move(job.command));
+        else
+            commitPush(job.serial, job.w, job.h, job.pixels.data(), &job.pixels);
+        lock.lock();
+        appliedSize_ = undoStack_.size();
+        jobs_.pop_front();
+        if (jobs_.empty()) idleCv_.notify_all();
+    }
+}
+
+void UndoManager::waitIdle() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idleCv_.wait(lock, [&]{ return jobs_.empty(); });
+}
+
+void UndoManager::commitPush(int serial, int w, int h, const uint32_t* pixels, std::vector<uint32_t>* owner) {
+    KPEN_TRACE_ZONE("UndoManager::pushUndo");
     UndoEntry e;
     e.w = w;
     e.h = h;
-    e.serial = nextStateSerial_++;
+    e.serial = serial;
     bool pushFull = undoStack_.empty() ||
         (undoStack_.back().w != w || undoStack_.back().h != h);
     if (pushFull) {
         e.is_full = true;
-        e.full_pixels = pixels;
+        if (owner) e.full_pixels = std::move(*owner);
+        else       e.full_pixels.assign(pixels, pixels + static_cast<size_t>(w) * h);
         undoStack_.push_back(std::move(e));
-        return undoStack_.back().serial;
+        enforceSoftLimit();
+        return;
     }
-    int ntx = numTilesX(w);
-    int nty = numTilesY(h);
-    workBuffer_.resize(static_cast<size_t>(w) * static_cast<size_t>(h));
-    int prevW, prevH;
-    reconstructState(undoStack_.size() - 1, workBuffer_, prevW, prevH);
+    // Diff against the cached top state, which is then patched with the new
+    // tiles, rather than replaying the history for every push.
+    std::vector<uint32_t>& prev = getTopLocked()->pixels;
     e.is_full = false;
-    for (int ty = 0; ty < nty; ty++) {
-        for (int tx = 0; tx < ntx; tx++) {
-            int baseX = tx * TILE;
+    diffTiles(e, prev.data(), pixels);
+    applyTiles(e, prev);
+    undoStack_.push_back(std::move(e));
+    reconstructed_.serial = serial;
+    cachedIndex_ = undoStack_.size() - 1;
+    enforceSoftLimit();
+}
+
+// The command is replayed onto the cached top, which must then match the
+// read-back region; otherwise the region is put back and tiles are stored.
+// Commands only draw inside the dirty rect they were pushed with.
+bool UndoManager::tryCommand(UndoEntry& e, std::vector<uint32_t>& base, int rx, int ry, int rw, int rh,
+                             const uint32_t* region, std::unique_ptr<UndoCommand>& command) {
+    KPEN_TRACE_ZONE("UndoManager::tryCommand");
+    uint32_t* area = base.data() + static_cast<size_t>(ry) * e.w + rx;
+    regionBackup_.resize(static_cast<size_t>(rw) * rh);
+    copyBlock(regionBackup_.data(), rw, area, e.w, rw, rh);
+    command->apply(base.data(), e.w, e.h);
+    if (!blocksEqual(area, e.w, region, rw, rw, rh)) {
+        copyBlock(area, e.w, regionBackup_.data(), rw, rw, rh);
+        return false;
+    }
+    // Count command steps back to the last keyframe.
+    size_t run = 1;
+    for (size_t i = undoStack_.size(); i-- > 0 && !undoStack_[i].is_full;)
+        if (undoStack_[i].command) run++;
+    if (run >= commandSpacing_) {
+        e.is_full = true;
+        e.full_pixels = base;
+    } else {
+        e.command = std::move(command);
+    }
+    return true;
+}
+
+// Same bookkeeping as commitPush; only tiles under the region are visited.
+void UndoManager::commitPushRegion(int serial, int w, int h, int rx, int ry, int rw, int rh, const uint32_t* region,
+                                   std::unique_ptr<UndoCommand> command) {
+    KPEN_TRACE_ZONE("UndoManager::pushUndoRegion");
+    std::vector<uint32_t>& base = getTopLocked()->pixels;
+    UndoEntry e;
+    e.w = w;
+    e.h = h;
+    e.serial = serial;
+    e.is_full = false;
+    bool replayed = command && rw > 0 && rh > 0 && tryCommand(e, base, rx, ry, rw, rh, region, command);
+    if (!replayed && rw > 0 && rh > 0) {
+        int ntx = numTilesX(w);
+        int tx0 = rx / TILE, tx1 = (rx + rw - 1) / TILE;
+        int ty0 = ry / TILE, ty1 = (ry + rh - 1) / TILE;
+        uint32_t tile[TILE * TILE];
+        for (int ty = ty0; ty <= ty1; ty++) {
             int baseY = ty * TILE;
-            bool changed = false;
-            for (int dy = 0; dy < TILE && !changed; dy++) {
-                int y = baseY + dy;
-                if (y >= h) break;
-                for (int dx = 0; dx < TILE; dx++) {
-                    int x = baseX + dx;
-                    if (x >= w) break;
-                    size_t idx = static_cast<size_t>(y) * w + x;
-                    if (pixels[idx] != workBuffer_[idx]) { changed = true; break; }
-                }
-            }
-            if (!changed) continue;
-            std::vector<uint32_t> tile(static_cast<size_t>(TILE) * TILE, 0u);
-            for (int dy = 0; dy < TILE; dy++) {
-                int y = baseY + dy;
-                for (int dx = 0; dx < TILE; dx++) {
-                    int x = baseX + dx;
-                    uint32_t val = 0;
-                    if (x < w && y < h)
-                        val = pixels[static_cast<size_t>(y) * w + x];
-                    tile[static_cast<size_t>(dy) * TILE + dx] = val;
-                }
+            int rows = std::min(TILE, h - baseY);
+            int oy0 = std::max(ry, baseY), oy1 = std::min(ry + rh, baseY + rows);
+            for (int tx = tx0; tx <= tx1; tx++) {
+                int baseX = tx * TILE;
+                int cols = std::min(TILE, w - baseX);
+                int ox0 = std::max(rx, baseX), ox1 = std::min(rx + rw, baseX + cols);
+                // Only the overlap with the region can have changed.
+                const uint32_t* src = region + static_cast<size_t>(oy0 - ry) * rw + (ox0 - rx);
+                uint32_t* old = base.data() + static_cast<size_t>(oy0) * w + ox0;
+                if (blocksEqual(src, rw, old, w, ox1 - ox0, oy1 - oy0)) continue;
+                extractTile(tile, base.data() + static_cast<size_t>(baseY) * w + baseX, w, cols, rows);
+                copyBlock(tile + static_cast<size_t>(oy0 - baseY) * TILE + (ox0 - baseX), TILE,
+                          src, rw, ox1 - ox0, oy1 - oy0);
+                e.tiles.push_back(storeTile(tileIndex(tx, ty, ntx), tile, cols, rows));
             }
-            e.tiles.push_back({ tileIndex(tx, ty, ntx), std::move(tile) });
         }
     }
+    applyTiles(e, base);
     undoStack_.push_back(std::move(e));
-    return undoStack_.back().serial;
+    reconstructed_.serial = serial;
+    cachedIndex_ = undoStack_.size() - 1;
+    enforceSoftLimit();
 }
 
+// Nothing is stored when the pixels match the top. Otherwise a same-size
+// delta top takes the changed tiles into its own list and a keyframe top is
+// overwritten in place; only a changed resize step (or a size change) turns
+// the top into a new keyframe.
 void UndoManager::replaceTopUndo(int w, int h, const std::vector<uint32_t>& pixels) {
+    waitIdle();
     if (undoStack_.empty()) return;
-    invalidateCache();
     UndoEntry& e = undoStack_.back();
+    unspill(e);
+    UndoEntry changed;
+    if (e.w == w && e.h == h) {
+        if (e.is_full && e.full_pixels == pixels) return;
+        if (!e.is_full) {
+            changed.w = w;
+            changed.h = h;
+            changed.is_full = false;
+            diffTiles(changed, getTopLocked()->pixels.data(), pixels.data());
+            if (changed.tiles.empty()) return;
+        }
+    }
+    releaseRedo();  // its deltas were against the old top
+    publishRedo();
+    if (e.w == w && e.h == h && !e.is_full && !e.is_resize) {
+        applyTiles(changed, reconstructed_.pixels);
+        mergeTiles(e, changed);
+        publishMemory();
+        return;
+    }
+    releaseTiles(changed);
+    invalidateCache();
     e.w = w;
     e.h = h;
     e.is_full = true;
+    e.is_resize = false;
+    e.command.reset();
     e.full_pixels = pixels;
-    e.tiles.clear();
+    releaseTiles(e);
+    publishMemory();
+}
+
+int UndoManager::pushResize(int newW, int newH, bool scaleContent, int originX, int originY) {
+    waitIdle();
+    if (undoStack_.empty()) return 0;
+    releaseRedo();
+    publishRedo();
+    UndoEntry e;
+    e.w = newW;
+    e.h = newH;
+    e.serial = nextStateSerial_++;
+    e.is_full = false;
+    e.is_resize = true;
+    e.fromW = undoStack_.back().w;
+    e.fromH = undoStack_.back().h;
+    e.scaleContent = scaleContent;
+    e.originX = originX;
+    e.originY = originY;
+    // Resize the cached top rather than rebuilding it from the keyframe.
+    bool patch = cachedIndex_ == undoStack_.size() - 1;
+    if (patch) {
+        applyEntry(e, reconstructed_.pixels);
+        reconstructed_.w = newW;
+        reconstructed_.h = newH;
+        reconstructed_.serial = e.serial;
+    }
+    undoStack_.push_back(std::move(e));
+    if (patch) cachedIndex_ = undoStack_.size() - 1;
+    enforceSoftLimit();
+    return undoStack_.back().serial;
 }
 
 void UndoManager::setUndoTopPixels(const std::vector<uint32_t>& pixels) {
+    waitIdle();
     if (undoStack_.empty()) return;
     invalidateCache();
     UndoEntry& e = undoStack_.back();
+    unspill(e);
     e.is_full = true;
+    e.is_resize = false;
+    e.command.reset();
     e.full_pixels = pixels;
-    e.tiles.clear();
+    releaseTiles(e);
+    releaseRedo();
+    publishMemory();
+    publishRedo();
 }
 
 CanvasState* UndoManager::getUndoTop() {
+    waitIdle();
+    return getTopLocked();
+}
+
+CanvasState* UndoManager::getTopLocked() {
     if (undoStack_.empty()) return nullptr;
     size_t idx = undoStack_.size() - 1;
     if (cachedIndex_ == idx) return &reconstructed_;
@@ -137,56 +505,271 @@ CanvasState* UndoManager::getUndoTop() {
     reconstructed_.h = h;
     reconstructed_.serial = undoStack_[idx].serial;
     cachedIndex_ = idx;
+    publishMemory();
     return &reconstructed_;
 }
 
 size_t UndoManager::getUndoSize() const {
-    return undoStack_.size();
+    std::lock_guard<std::mutex> lock(mutex_);
+    return jobs_.empty() ? undoStack_.size() : appliedSize_ + jobs_.size();
 }
 
-void UndoManager::popUndo() {
-    if (undoStack_.empty()) return;
+CanvasState* UndoManager::undo() {
+    waitIdle();
+    if (undoStack_.empty()) return nullptr;
     invalidateCache();
+    redoStack_.push_back(std::move(undoStack_.back()));
     undoStack_.pop_back();
+    // The new top may be edited in place (replaceTopUndo, a merge) and is
+    // what redo entries are diffed against; keep it in RAM.
+    if (!undoStack_.empty()) unspill(undoStack_.back());
+    publishMemory();
+    publishRedo();
+    return getTopLocked();
 }
 
-void UndoManager::pushRedo(CanvasState s) {
-    redoStack_.push_back(std::move(s));
-}
-
-void UndoManager::pushUndoKeepSerial(CanvasState s) {
-    invalidateCache();
-    UndoEntry e;
-    e.w = s.w;
-    e.h = s.h;
-    e.serial = s.serial;
-    e.is_full = true;
-    e.full_pixels = std::move(s.pixels);
+// A delta or resize redo entry patches the cached top in place, so
+// undo-then-redo never rebuilds the state it came from.
+CanvasState* UndoManager::redo() {
+    waitIdle();
+    if (redoStack_.empty()) return nullptr;
+    UndoEntry e = std::move(redoStack_.back());
+    redoStack_.pop_back();
+    bool patch = !e.is_full && !undoStack_.empty() && cachedIndex_ == undoStack_.size() - 1;
+    if (patch) {
+        applyEntry(e, reconstructed_.pixels);
+        reconstructed_.w = e.w;
+        reconstructed_.h = e.h;
+        reconstructed_.serial = e.serial;
+    }
     undoStack_.push_back(std::move(e));
+    if (patch) cachedIndex_ = undoStack_.size() - 1;
+    else       invalidateCache();
+    // Like a push: steps leaving SPILL_WINDOW go to disk, and the soft limit
+    // still applies while redoing a long history.
+    enforceSoftLimit();
+    publishRedo();
+    return getTopLocked();
 }
 
-CanvasState* UndoManager::getRedoTop() {
-    return redoStack_.empty() ? nullptr : &redoStack_.back();
-}
-
-void UndoManager::popRedo() {
-    if (!redoStack_.empty()) redoStack_.pop_back();
+void UndoManager::pushRedo(int w, int h, const std::vector<uint32_t>& pixels) {
+    waitIdle();
+    CanvasState* top = getTopLocked();
+    // The old redo top was a delta against `top`; it will be applied on top
+    // of `pixels` instead, so make it self-contained first.
+    if (top && !redoStack_.empty() && !redoStack_.back().is_full) {
+        UndoEntry& next = redoStack_.back();
+        next.full_pixels = top->pixels;
+        applyEntry(next, next.full_pixels);
+        next.is_full = true;
+        next.is_resize = false;
+        next.command.reset();
+        releaseTiles(next);
+    }
+    UndoEntry e;
+    e.w = w;
+    e.h = h;
+    e.serial = nextStateSerial_++;
+    if (top && top->w == w && top->h == h) {
+        e.is_full = false;
+        diffTiles(e, top->pixels.data(), pixels.data());
+    } else {
+        e.full_pixels = pixels;
+    }
+    redoStack_.push_back(std::move(e));
+    publishRedo();
 }
 
+// Called on every mutating pointer move, so it only waits when there is
+// something to free.
 void UndoManager::clearRedo() {
-    redoStack_.clear();
+    if (redoStack_.empty()) return;
+    waitIdle();
+    releaseRedo();
+    publishRedo();
 }
 
 void UndoManager::clear() {
+    waitIdle();
     undoStack_.clear();
+    tilePool_ = TilePool();
+    sharedTiles_.clear();
+    spill_.close();
     redoStack_.clear();
     invalidateCache();
+    publishMemory();
+    publishRedo();
 }
 
 int UndoManager::currentSerial() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!jobs_.empty()) return jobs_.back().serial;
     return undoStack_.empty() ? 0 : undoStack_.back().serial;
 }
 
 bool UndoManager::redoEmpty() const {
     return redoStack_.empty();
 }
+
+size_t UndoManager::memoryBytes() const {
+    return published_[0] + published_[1] + published_[2] + published_[3];
+}
+
+void UndoManager::publish(int slot, size_t bytes) {
+    size_t old = published_[slot].exchange(bytes);
+    if (old != bytes)
+        MemoryStats::add(static_cast<MemoryStats::Category>(MemoryStats::UNDO_TILES + slot),
+                         static_cast<long long>(bytes) - static_cast<long long>(old));
+}
+
+// A walk over entries and tiles, not pixels, so it is cheap enough to run
+// after every mutation. Capacities are counted since that is what is held.
+// Runs on whichever thread owns the history; the redo stack belongs to the
+// caller's thread and is counted by publishRedo.
+void UndoManager::publishMemory() {
+    size_t tiles = 0, keyframes = 0;
+    for (const UndoEntry& e : undoStack_) {
+        tiles += e.tiles.capacity() * sizeof(e.tiles[0]);
+        if (e.command) tiles += e.command->bytes();
+        keyframes += e.full_pixels.capacity() * sizeof(uint32_t);
+    }
+    tiles += sharedTiles_.bytes();
+    publish(0, tiles + tilePool_.bytes());
+    publish(1, keyframes);
+    publish(3, reconstructed_.pixels.capacity() * sizeof(uint32_t));
+    MemoryStats::addOnDisk(static_cast<long long>(spill_.used()) - static_cast<long long>(publishedDisk_));
+    publishedDisk_ = spill_.used();
+}
+
+// Redo tile blocks sit in the shared pool and are counted as UNDO_TILES.
+void UndoManager::publishRedo() {
+    size_t bytes = 0;
+    for (const UndoEntry& e : redoStack_) {
+        bytes += e.tiles.capacity() * sizeof(e.tiles[0]) + e.full_pixels.capacity() * sizeof(uint32_t);
+        if (e.command) bytes += e.command->bytes();
+    }
+    publish(2, bytes);
+}
+
+void UndoManager::enforceSoftLimit() {
+    spillCold();
+    publishMemory();
+    size_t trimmed = 0, next = 0;
+    while (MemoryStats::overSoftLimit() && !undoStack_.empty()) {
+        if (!undoStack_[0].spilled) {
+            if (!dropOldest()) break;
+            trimmed++;
+            next = 0;
+            continue;
+        }
+        // Spilled steps cost no RAM, so dropping them would not help: move
+        // newer steps to disk too, keeping the last MIN_HISTORY loaded.
+        while (next + MIN_HISTORY < undoStack_.size() && undoStack_[next].spilled) next++;
+        if (next + MIN_HISTORY >= undoStack_.size() || !spill(undoStack_[next])) break;
+        publishMemory();
+    }
+    if (trimmed) MemoryStats::noteTrimmed(trimmed);
+}
+
+// undoStack_[0] is always a keyframe. When the next step is a delta it has
+// the same size, so its tiles are applied to that keyframe in place and the
+// buffer is handed over: no full-canvas allocation while trimming (a resize
+// step needs one, for the resized keyframe).
+bool UndoManager::trimOldest() {
+    waitIdle();
+    return dropOldest();
+}
+
+bool UndoManager::dropOldest() {
+    if (undoStack_.size() <= MIN_HISTORY) return false;
+    UndoEntry& first = undoStack_[0];
+    UndoEntry& next  = undoStack_[1];
+    if (!next.is_full) {
+        bool cold = next.spilled;
+        unspill(first);
+        unspill(next);
+        applyEntry(next, first.full_pixels);
+        next.is_full = true;
+        next.is_resize = false;
+        next.command.reset();
+        next.full_pixels = std::move(first.full_pixels);
+        releaseTiles(next);
+        if (cold) spill(next);
+    }
+    if (first.spilled) spill_.release(first.spillOffset, first.spillBytes);
+    undoStack_.erase(undoStack_.begin());
+    if (cachedIndex_ != static_cast<size_t>(-1) && cachedIndex_ > 0) cachedIndex_--;
+    else invalidateCache();
+    publishMemory();
+    return true;
+}
+
+// Space given back by unspill and dropOldest is reused by later spills, so
+// the file holds about one copy of each spilled step.
+void UndoManager::spillCold() {
+    if (undoStack_.size() <= SPILL_WINDOW) return;
+    for (size_t i = 0, n = undoStack_.size() - SPILL_WINDOW; i < n; i++) {
+        UndoEntry& e = undoStack_[i];
+        if (!e.spilled && !spill(e)) return;  // no scratch space: keep the rest in RAM
+    }
+}
+
+// Copies the pixels out and frees them; the tile list itself stays, as the
+// index. False only when the scratch file cannot take the bytes.
+bool UndoManager::spill(UndoEntry& e) {
+    KPEN_TRACE_ZONE("UndoManager::spill");
+    const size_t tileBytes = TilePool::TILE_PIXELS * sizeof(uint32_t);
+    if (e.is_full) {
+        size_t offset;
+        uint8_t* dst = spill_.alloc(e.full_pixels.size() * sizeof(uint32_t), offset);
+        if (!dst) return false;
+        std::memcpy(dst, e.full_pixels.data(), e.full_pixels.size() * sizeof(uint32_t));
+        std::vector<uint32_t>().swap(e.full_pixels);
+        e.spilled = true;
+        e.spillOffset = offset;
+        e.spillBytes = static_cast<size_t>(e.w) * e.h * sizeof(uint32_t);
+        return true;
+    }
+    size_t blocks = 0;
+    for (const TileRef& t : e.tiles) blocks += t.block != TilePool::NONE;
+    if (blocks == 0) {  // nothing but colors, commands or a resize
+        e.spilled = true;
+        e.spillBytes = 0;
+        return true;
+    }
+    size_t offset;
+    uint8_t* dst = spill_.alloc(blocks * tileBytes, offset);
+    if (!dst) return false;
+    TilePool::Handle pos = 0;
+    for (TileRef& t : e.tiles) {
+        if (t.block == TilePool::NONE) continue;
+        std::memcpy(dst + static_cast<size_t>(pos) * tileBytes, tilePool_.data(t.block), tileBytes);
+        releaseTile(t);
+        t.block = pos++;
+    }
+    e.spilled = true;
+    e.spillOffset = offset;
+    e.spillBytes = blocks * tileBytes;
+    return true;
+}
+
+void UndoManager::unspill(UndoEntry& e) {
+    if (!e.spilled) return;
+    KPEN_TRACE_ZONE("UndoManager::unspill");
+    e.spilled = false;
+    if (e.is_full) {
+        const uint32_t* src = reinterpret_cast<const uint32_t*>(spill_.at(e.spillOffset));
+        e.full_pixels.assign(src, src + static_cast<size_t>(e.w) * e.h);
+        spill_.release(e.spillOffset, e.spillBytes);
+        return;
+    }
+    const uint32_t* src = reinterpret_cast<const uint32_t*>(spill_.at(e.spillOffset));
+    int ntx = numTilesX(e.w);
+    for (TileRef& t : e.tiles) {
+        if (t.block == TilePool::NONE) continue;
+        int cols = std::min(TILE, e.w - (t.index % ntx) * TILE);
+        int rows = std::min(TILE, e.h - (t.index / ntx) * TILE);
+        t = storeTile(t.index, src + static_cast<size_t>(t.block) * TilePool::TILE_PIXELS, cols, rows);
+    }
+    spill_.release(e.spillOffset, e.spillBytes);
+}
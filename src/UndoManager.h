@@ -1,7 +1,16 @@
 #pragma once
+#include "ScratchFile.h"
+#include "TilePool.h"
+#include "UndoCommand.h"
 #include <vector>
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <utility>
 
 struct CanvasState {
@@ -13,51 +22,188 @@ struct CanvasState {
 class UndoManager {
 public:
     static constexpr int TILE = 32;
+    // Steps kept however far over the memory soft limit we are.
+    static constexpr size_t MIN_HISTORY = 2;
+    // Most recent steps kept in RAM; older keyframes and tiles are moved to
+    // a scratch file and read back from its mapping when needed.
+    static constexpr size_t SPILL_WINDOW = 64;
+
+    UndoManager() = default;
+    ~UndoManager();
+    UndoManager(const UndoManager&) = delete;
+    UndoManager& operator=(const UndoManager&) = delete;
 
     // Push current canvas state to undo; clears redo. Returns serial.
     int pushUndo(int w, int h, const std::vector<uint32_t>& pixels);
 
+    // Like pushUndo when only the rw×rh area at (rx, ry), inside the canvas,
+    // can differ from the top state; `region` holds that area's pixels, rw
+    // per row. Only tiles under the area are diffed. Returns 0 (nothing
+    // pushed) if the stack is empty or the top is not w×h.
+    int pushUndoRegion(int w, int h, int rx, int ry, int rw, int rh, const uint32_t* region);
+
+    // pushUndo / pushUndoRegion with the diff done on a worker thread. The
+    // serial is assigned and redo cleared before returning. Calls that read
+    // or edit the history wait for queued pushes first; currentSerial,
+    // getUndoSize and redoEmpty do not. getUndoTop's pointer is valid
+    // until the next push.
+    int pushUndoAsync(int w, int h, std::vector<uint32_t> pixels);
+    // `command`, if given, is the edit that produced the region (command
+    // history, see setCommandKeyframeSpacing).
+    // True if pushUndoRegionAsync(w, h, ...) would push now: the last queued
+    // push, or the top once the queue is empty, is w×h.
+    bool canPushRegion(int w, int h) const;
+    int pushUndoRegionAsync(int w, int h, int rx, int ry, int rw, int rh, std::vector<uint32_t> region,
+                            std::unique_ptr<UndoCommand> command = nullptr);
+    // Block until every queued push is in the history.
+    void waitIdle();
+
     // Replace top-of-undo in place (e.g. resizeCanvas pre-resize refresh).
+    // Only tiles that differ from the current top are stored.
     void replaceTopUndo(int w, int h, const std::vector<uint32_t>& pixels);
 
+    // Push a resize of the top state to newW×newH, as DrawingUtils::resizePixels
+    // does it. Stored as the parameters alone: the step is replayed from the
+    // state below. Returns the serial, or 0 (nothing pushed) if the history
+    // is empty.
+    int pushResize(int newW, int newH, bool scaleContent, int originX, int originY);
+
     // Replace only the pixel buffer of the top undo state (e.g. doOpen after load).
     void setUndoTopPixels(const std::vector<uint32_t>& pixels);
 
     CanvasState* getUndoTop();
     size_t getUndoSize() const;
-    void popUndo();
 
-    // Push state to redo; undo() stashes current before applying previous.
-    void pushRedo(CanvasState s);
+    // Move the top step onto the redo stack, as it is (no copy), and return
+    // the state below it; nullptr when the history is empty.
+    CanvasState* undo();
 
-    // Push state to undo keeping its serial; redo() moves redo top back to undo.
-    void pushUndoKeepSerial(CanvasState s);
+    // Move the redo top back onto the history and return the new top state,
+    // or nullptr when there is nothing to redo.
+    CanvasState* redo();
+
+    // Stash a state that was never pushed (a floating selection stamped on
+    // undo) so redo can bring it back. Stored as tiles against the top.
+    void pushRedo(int w, int h, const std::vector<uint32_t>& pixels);
 
-    CanvasState* getRedoTop();
-    void popRedo();
     void clearRedo();
     void clear();
 
     int currentSerial() const;
     bool redoEmpty() const;
 
+    // Command history: a region push whose command redraws exactly the
+    // pushed pixels is kept as the command, not tiles, and replayed from the
+    // nearest keyframe when needed. Every `spacing`-th command step is stored
+    // as a keyframe instead, bounding the replay. 0 (the default) turns it
+    // off. Set before the first push.
+    void setCommandKeyframeSpacing(size_t spacing) { commandSpacing_ = spacing; }
+
+    // Bytes held by history, redo and caches (also published to MemoryStats).
+    size_t memoryBytes() const;
+
+    // Fold the oldest step into the next one and drop it. False when only
+    // MIN_HISTORY steps are left.
+    bool trimOldest();
+
 private:
+    // A changed tile: a pooled TILE×TILE block, possibly shared with other
+    // entries, or (block == NONE) a tile that is `color` throughout.
+    struct TileRef {
+        int index = 0;
+        TilePool::Handle block = TilePool::NONE;
+        uint32_t color = 0;
+    };
     struct UndoEntry {
         int w = 0, h = 0, serial = 0;
         bool is_full = true;
         std::vector<uint32_t> full_pixels;
-        std::vector<std::pair<int, std::vector<uint32_t>>> tiles;
+        // Resize of the fromW×fromH state below to w×h; no pixels stored.
+        bool is_resize = false;
+        int fromW = 0, fromH = 0, originX = 0, originY = 0;
+        bool scaleContent = false;
+        // Replayed onto the state below, before any tiles.
+        std::unique_ptr<UndoCommand> command;
+        // Keyframe pixels, or the non-uniform tiles in order (TileRef::block
+        // is then the position in that run), live in spill_ at spillOffset.
+        bool spilled = false;
+        size_t spillOffset = 0, spillBytes = 0;
+        std::vector<TileRef> tiles;
     };
+    // Redo entries are UndoEntry too: a delta against the undo top (for the
+    // redo top) or against the redo entry above it.
     static int numTilesX(int w);
     static int numTilesY(int h);
     static int tileIndex(int tx, int ty, int numTX);
     void reconstructState(size_t index, std::vector<uint32_t>& out, int& outW, int& outH);
     void invalidateCache();
+    static void extractTile(uint32_t* tile, const uint32_t* src, size_t stride, int cols, int rows);
+    void applyEntry(const UndoEntry& e, std::vector<uint32_t>& out) const;
+    void applyTiles(const UndoEntry& e, std::vector<uint32_t>& out) const;
+    // Store a zero-padded tile: as a color if uniform over cols×rows, else as
+    // a reference to an identical pooled block or a new one.
+    TileRef storeTile(int index, const uint32_t* tile, int cols, int rows);
+    static uint64_t hashTile(const uint32_t* tile);
+    const uint32_t* tileData(const UndoEntry& e, const TileRef& t) const;
+    void releaseTile(const TileRef& t);
+    void releaseTiles(UndoEntry& e);
+    // Take changed.tiles (same size as e) into e, replacing any at the same index.
+    void mergeTiles(UndoEntry& e, UndoEntry& changed);
+    void releaseRedo();
+    // Fill e.tiles with the tiles of w×h `pixels` that differ from `base`.
+    void diffTiles(UndoEntry& e, const uint32_t* base, const uint32_t* pixels);
+    // Recount our MemoryStats categories and trim if over the soft limit.
+    void publish(int slot, size_t bytes);
+    void publishMemory();
+    void publishRedo();
+    void enforceSoftLimit();
+    // Spill steps older than SPILL_WINDOW; load one back before editing it.
+    // Loading or dropping a step gives its scratch space back.
+    void spillCold();
+    bool spill(UndoEntry& e);
+    void unspill(UndoEntry& e);
+    bool dropOldest();
+
+    // Queued async push; `pixels` is the whole canvas or the rw×rh region.
+    struct PushJob {
+        int w = 0, h = 0, serial = 0;
+        bool region = false;
+        int rx = 0, ry = 0, rw = 0, rh = 0;
+        std::vector<uint32_t> pixels;
+        std::unique_ptr<UndoCommand> command;
+        std::vector<UndoEntry> staleRedo;  // redo cleared by this push; freed by the worker
+    };
+    // The commit* calls and getTopLocked run with the history owned by the
+    // caller: the worker while jobs are queued, otherwise the main thread.
+    // commitPush may move *owner (holding `pixels`) into a keyframe.
+    void commitPush(int serial, int w, int h, const uint32_t* pixels, std::vector<uint32_t>* owner);
+    void commitPushRegion(int serial, int w, int h, int rx, int ry, int rw, int rh, const uint32_t* region,
+                          std::unique_ptr<UndoCommand> command);
+    // Keep `command` as e if it redraws the rw×rh region onto `base`.
+    bool tryCommand(UndoEntry& e, std::vector<uint32_t>& base, int rx, int ry, int rw, int rh,
+                    const uint32_t* region, std::unique_ptr<UndoCommand>& command);
+    CanvasState* getTopLocked();
+    int  enqueue(PushJob job);
+    void workerLoop();
 
     std::vector<UndoEntry> undoStack_;
-    std::vector<CanvasState> redoStack_;
+    std::vector<UndoEntry> redoStack_;
+    TilePool tilePool_;  // owned with the history (worker while jobs are queued)
+    TileIndex sharedTiles_;  // content hash -> pooled block
+    std::vector<TileRef> scratchTiles_;  // commitPush's changed tiles
+    std::vector<uint32_t> regionBackup_;  // tryCommand's copy of the region before replay
+    size_t commandSpacing_ = 0;
+    ScratchFile spill_;
+    size_t publishedDisk_ = 0;
     int nextStateSerial_ = 1;
     CanvasState reconstructed_;
     size_t cachedIndex_ = static_cast<size_t>(-1);
-    std::vector<uint32_t> workBuffer_;
+    std::atomic<size_t> published_[4] = {};  // UNDO_TILES, UNDO_KEYFRAMES, REDO, UNDO_CACHE
+
+    mutable std::mutex      mutex_;   // guards jobs_, appliedSize_, stop_
+    std::condition_variable workCv_, idleCv_;
+    std::deque<PushJob>     jobs_;
+    size_t                  appliedSize_ = 0;  // undoStack_.size() after the last finished job
+    bool                    stop_ = false;
+    std::thread             worker_;           // started by the first async push
 };
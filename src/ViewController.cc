@@ -21,6 +21,12 @@ SDL_Rect ViewController::getFitViewport(int winW, int winH, int canvasW, int can
     return v;
 }
 
+float ViewController::maxZoom(int winW, int winH, int canvasW, int canvasH) {
+    SDL_Rect fit = getFitViewport(winW, winH, canvasW, canvasH);
+    // Enough to show 16 window pixels per canvas pixel.
+    return std::max(MAX_ZOOM, 16.f * canvasW / std::max(1, fit.w));
+}
+
 void ViewController::getMaxPan(int winW, int winH, int canvasW, int canvasH,
                                float* maxPanX, float* maxPanY) const {
     SDL_Rect fit = getFitViewport(winW, winH, canvasW, canvasH);
@@ -87,17 +93,18 @@ void ViewController::onCanvasScroll(int winX, int winY, float dy, bool ctrl,
     viewScrollRawZoom_ += dy * 0.1f;
 
     float rawZoom = viewScrollBaseZoom_ * expf(viewScrollRawZoom_);
+    const float maxZ = maxZoom(winW, winH, canvasW, canvasH);
     const float kz = 0.3f;
     if (rawZoom < MIN_ZOOM) {
         float rawOver = MIN_ZOOM / rawZoom - 1.f;
         float dispOver = rawOver * kz / (rawOver + kz);
         rawZoom = MIN_ZOOM / (1.f + dispOver);
-    } else if (rawZoom > MAX_ZOOM) {
-        float rawOver = rawZoom / MAX_ZOOM - 1.f;
+    } else if (rawZoom > maxZ) {
+        float rawOver = rawZoom / maxZ - 1.f;
         float dispOver = rawOver * kz / (rawOver + kz);
-        rawZoom = MAX_ZOOM * (1.f + dispOver);
+        rawZoom = maxZ * (1.f + dispOver);
     }
-    zoomTarget_ = std::max(MIN_ZOOM, std::min(MAX_ZOOM, rawZoom));
+    zoomTarget_ = std::max(MIN_ZOOM, std::min(maxZ, rawZoom));
 }
 
 void ViewController::onWheelPan(float dx, float dy) {
@@ -119,7 +126,7 @@ bool ViewController::tickView(int winW, int winH, int canvasW, int canvasH,
     int pivotX = (pinchActive && twoFingerPivotSet) ? (int)twoFingerPivotX : mousePivotX;
     int pivotY = (pinchActive && twoFingerPivotSet) ? (int)twoFingerPivotY : mousePivotY;
 
-    float clamped = std::max(MIN_ZOOM, std::min(MAX_ZOOM, zoomTarget_));
+    float clamped = std::max(MIN_ZOOM, std::min(maxZoom(winW, winH, canvasW, canvasH), zoomTarget_));
     float diff = clamped - zoom_;
     if (std::abs(diff) > 0.0002f) {
         zoomAround(zoom_ + diff * k, pivotX, pivotY, winW, winH, canvasW, canvasH);
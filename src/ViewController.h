@@ -30,6 +30,8 @@ public:
     void setScrollFromMouseWheel(bool v) { scrollFromMouseWheel_ = v; }
 
     static SDL_Rect getFitViewport(int winW, int winH, int canvasW, int canvasH);
+    // MAX_ZOOM, raised for canvases so large that it would not reach pixel level.
+    static float maxZoom(int winW, int winH, int canvasW, int canvasH);
 
     SDL_Rect getViewport(int winW, int winH, int canvasW, int canvasH) const;
     SDL_FRect getViewportF(int winW, int winH, int canvasW, int canvasH) const;
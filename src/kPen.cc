@@ -6,7 +6,14 @@
 #include <cmath>
 #include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <climits>
 #include <string>
+#include "MappedFile.h"
+#include "PaletteQuantizer.h"
+#include "MemoryStats.h"
+#include "PerfStats.h"
+#include "Trace.h"
 #include "menu/MacMenu.h"
 #include "menu/WinMenu.h"
 #include "menu/WinUpdate.h"
@@ -39,17 +46,14 @@ kPen::kPen() : toolbar(nullptr, this), canvasResizer(this) {
 
     toolbar = Toolbar(renderer, this);
 
-    canvas  = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-                                SDL_TEXTUREACCESS_TARGET, canvasW, canvasH);
-    overlay = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-                                SDL_TEXTUREACCESS_TARGET, canvasW, canvasH);
-    SDL_SetTextureBlendMode(overlay, SDL_BLENDMODE_BLEND);
-
-    SDL_SetTextureBlendMode(canvas, SDL_BLENDMODE_BLEND);
-    SDL_SetRenderTarget(renderer, canvas);
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
-    SDL_RenderClear(renderer);
-    SDL_SetRenderTarget(renderer, nullptr);
+    MemoryStats::setSoftLimit(MemoryStats::defaultSoftLimit());
+    // KPEN_STROKE_HISTORY=N keeps brush strokes as commands, a keyframe every N.
+    if (const char* env = getenv("KPEN_STROKE_HISTORY"))
+        undoManager.setCommandKeyframeSpacing(strtoul(env, nullptr, 10));
+    canvas  = std::make_unique<TiledCanvas>(renderer, MemoryStats::CANVAS_TEXTURE);
+    overlay = std::make_unique<TiledCanvas>(renderer, MemoryStats::OVERLAY_TEXTURE);
+    canvas->reset(canvasW, canvasH);
+    overlay->reset(canvasW, canvasH);
 
     toolbar.syncCanvasSize(canvasW, canvasH);
     SDL_GetWindowSize(window, &winW_, &winH_);
@@ -70,22 +74,23 @@ kPen::kPen() : toolbar(nullptr, this), canvasResizer(this) {
         withCanvas([&]{
             SDL_SetRenderDrawColor(renderer, c.r, c.g, c.b, c.a);
             SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
-            SDL_RenderClear(renderer);
+            DrawingUtils::renderClear(renderer);
             SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
         });
         saveState();
-        savedStateId = undoManager.currentSerial();
+        savedStateId = history().currentSerial();
         updateWindowTitle();
     };
 
     saveState();
-    savedStateId = undoManager.currentSerial();
+    savedStateId = history().currentSerial();
     updateWindowTitle();
 }
 
 kPen::~kPen() {
-    SDL_DestroyTexture(canvas);
-    SDL_DestroyTexture(overlay);
+    MemoryStats::destroyTexture(snapshotTarget_);
+    canvas.reset();
+    overlay.reset();
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -190,7 +195,30 @@ bool kPen::tickView() {
 
 // Helper: set render target to canvas, run f, restore to nullptr
 template<typename F> void kPen::withCanvas(F f) {
-    SDL_SetRenderTarget(renderer, canvas); f(); SDL_SetRenderTarget(renderer, nullptr);
+    canvas->bind(); f(); SDL_SetRenderTarget(renderer, nullptr);
+    unsavedAll_ = true;
+}
+
+// withCanvas for the current tool's mouse handlers: keeps the next snapshot to
+// the tool's dirty rect when it reports one.
+template<typename F> void kPen::withToolCanvas(F f) {
+    canvas->bind(); f(); SDL_SetRenderTarget(renderer, nullptr);
+    if (currentTool && currentTool->tracksDirtyRect())
+        unsavedRect_ = DrawingUtils::unionRect(unsavedRect_, currentTool->takeDirtyRect());
+    else
+        unsavedAll_ = true;
+}
+
+void kPen::readCanvas(const SDL_Rect* area, uint32_t* out) {
+    SDL_Rect all = { 0, 0, canvasW, canvasH };
+    if (!area) area = &all;
+    canvas->read(*area, out, area->w * 4);
+}
+
+void kPen::writeCanvas(const SDL_Rect* area, const uint32_t* pixels) {
+    SDL_Rect all = { 0, 0, canvasW, canvasH };
+    if (!area) area = &all;
+    canvas->write(*area, pixels, area->w * 4);
 }
 
 void kPen::setTool(ToolType t) {
@@ -253,14 +281,97 @@ void kPen::updateWindowTitle() {
         return std::string("kPen — ") + (s != std::string::npos
                ? currentFilePath.substr(s + 1) : currentFilePath);
     }();
+    if (loading_) base += " (loading…)";
     SDL_SetWindowTitle(window,
         hasUnsavedChanges() ? (base + " •").c_str() : base.c_str());
 }
 
+// Reads back only what changed since the last snapshot when that is known
+// (brush and eraser strokes), so the cost follows the stroke, not the canvas.
+// Up to a tile, even the read-back waits for flushSnapshots after present;
+// UndoManager diffs on its worker thread while the next stroke starts.
+// Whether the step can be a region push is settled here, while the canvas
+// still holds exactly this state: by the flush it may hold later strokes.
 void kPen::saveState() {
-    std::vector<uint32_t> pixels(static_cast<size_t>(canvasW) * canvasH);
-    withCanvas([&]{ SDL_RenderReadPixels(renderer, nullptr, SDL_PIXELFORMAT_ARGB8888, pixels.data(), canvasW * 4); });
-    undoManager.pushUndo(canvasW, canvasH, pixels);
+    KPEN_TRACE_ZONE("saveState");
+    bool pushed = false;
+    std::unique_ptr<UndoCommand> command = currentTool ? currentTool->takeCommand() : nullptr;
+    SDL_Rect r = unsavedRect_;
+    SDL_Point at;
+    if (!unsavedAll_ && r.w > 0 && r.h > 0 && r.w <= canvas->tileSize() && r.h <= canvas->tileSize() &&
+        undoManager.canPushRegion(canvasW, canvasH)) {
+        if (placeSnapshot(r.w, r.h, at)) {
+            canvas->copyTo(r, snapshotTarget_, at.x, at.y);
+            snapshots_.push_back({ r, at, std::move(command) });
+            unsavedRect_ = {0, 0, 0, 0};
+            unsavedAll_  = false;
+            updateWindowTitle();
+            return;
+        }
+    }
+    flushSnapshots();
+    if (!unsavedAll_) {
+        std::vector<uint32_t> region(static_cast<size_t>(std::max(0, r.w)) * std::max(0, r.h));
+        if (!region.empty()) readCanvas(&r, region.data());
+        pushed = undoManager.pushUndoRegionAsync(canvasW, canvasH, r.x, r.y, r.w, r.h, std::move(region),
+                                                 std::move(command)) != 0;
+    }
+    if (!pushed) {
+        std::vector<uint32_t> pixels(static_cast<size_t>(canvasW) * canvasH);
+        readCanvas(nullptr, pixels.data());
+        undoManager.pushUndoAsync(canvasW, canvasH, std::move(pixels));
+    }
+    unsavedRect_ = {0, 0, 0, 0};
+    unsavedAll_  = false;
+    updateWindowTitle();
+}
+
+// Room for a w×h snapshot in snapshotTarget_: next on the current row, else
+// on a new row, else after flushing the queue. A larger target (power of two,
+// at most a tile) replaces the old one only when w or h does not fit at all.
+bool kPen::placeSnapshot(int w, int h, SDL_Point& at) {
+    if (w > snapshotSide_ || h > snapshotSide_) {
+        flushSnapshots();
+        int side = 256;
+        while (side < std::max(w, h)) side *= 2;
+        side = std::min(side, canvas->tileSize());
+        MemoryStats::destroyTexture(snapshotTarget_);
+        snapshotTarget_ = MemoryStats::createTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+                                                     side, side, MemoryStats::TEMP_TEXTURE);
+        snapshotSide_ = snapshotTarget_ ? side : 0;
+        if (!snapshotTarget_) return false;
+    }
+    if (shelfX_ + w > snapshotSide_) {
+        shelfX_ = 0;
+        shelfY_ += shelfH_;
+        shelfH_ = 0;
+    }
+    if (shelfY_ + h > snapshotSide_) flushSnapshots();
+    at = { shelfX_, shelfY_ };
+    shelfX_ += w;
+    shelfH_ = std::max(shelfH_, h);
+    return true;
+}
+
+void kPen::flushSnapshots() {
+    if (snapshots_.empty()) return;
+    KPEN_TRACE_ZONE("flushSnapshots");
+    std::vector<PendingSnapshot> queued;
+    queued.swap(snapshots_);
+    shelfX_ = shelfY_ = shelfH_ = 0;
+    SDL_Texture* prev = SDL_GetRenderTarget(renderer);
+    SDL_SetRenderTarget(renderer, snapshotTarget_);
+    for (PendingSnapshot& s : queued) {
+        const SDL_Rect& r = s.area;
+        SDL_Rect src = { s.at.x, s.at.y, r.w, r.h };
+        std::vector<uint32_t> region(static_cast<size_t>(r.w) * r.h);
+        SDL_RenderReadPixels(renderer, &src, SDL_PIXELFORMAT_ARGB8888, region.data(), r.w * 4);
+        // Cannot fail: canPushRegion held when this was queued, and the
+        // canvas size only changes after a flush (replaceCanvasTextures).
+        undoManager.pushUndoRegionAsync(canvasW, canvasH, r.x, r.y, r.w, r.h, std::move(region),
+                                        std::move(s.command));
+    }
+    SDL_SetRenderTarget(renderer, prev);
     updateWindowTitle();
 }
 
@@ -269,56 +380,47 @@ void kPen::applyState(CanvasState& s) {
         currentTool.reset(); // prevent setTool from deactivating+saving
         setTool(originalType);
     }
-    if (s.w != canvasW || s.h != canvasH) {
-        SDL_Texture* newCanvas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-                                    SDL_TEXTUREACCESS_TARGET, s.w, s.h);
-        SDL_Texture* newOverlay = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-                                    SDL_TEXTUREACCESS_TARGET, s.w, s.h);
-        if (!newCanvas || !newOverlay) {
-            if (newCanvas) SDL_DestroyTexture(newCanvas);
-            if (newOverlay) SDL_DestroyTexture(newOverlay);
-            return;
-        }
-        SDL_DestroyTexture(canvas);
-        SDL_DestroyTexture(overlay);
-        canvas = newCanvas;
-        overlay = newOverlay;
-        canvasW = s.w;
-        canvasH = s.h;
-        SDL_SetTextureBlendMode(canvas,  SDL_BLENDMODE_BLEND);
-        SDL_SetTextureBlendMode(overlay, SDL_BLENDMODE_BLEND);
-        SDL_SetRenderTarget(renderer, overlay);
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
-        SDL_RenderClear(renderer);
-        SDL_SetRenderTarget(renderer, nullptr);
-        toolbar.syncCanvasSize(canvasW, canvasH);
-    }
-    SDL_UpdateTexture(canvas, nullptr, s.pixels.data(), canvasW * 4);
+    if ((s.w != canvasW || s.h != canvasH) && !replaceCanvasTextures(s.w, s.h))
+        return;
+    writeCanvas(nullptr, s.pixels.data());
+}
+
+// Tile textures are created as they are drawn into, so a failed allocation
+// shows up later as a missing tile, not here.
+bool kPen::replaceCanvasTextures(int w, int h) {
+    if (w < 1 || h < 1 || w > TiledCanvas::MAX_SIDE || h > TiledCanvas::MAX_SIDE) return false;
+    flushSnapshots();  // queued steps belong to the old canvas
+    canvas->reset(w, h);
+    overlay->reset(w, h);
+    unsavedAll_ = true;
+    canvasW = w;
+    canvasH = h;
+    toolbar.syncCanvasSize(canvasW, canvasH);
+    return true;
 }
 
 // Stamp the active SELECT or RESIZE tool onto redo, then restore canvas from undo top.
 void kPen::stampForRedo(AbstractTool* tool) {
-    CanvasState s;
-    s.w = canvasW; s.h = canvasH;
-    s.pixels.resize(static_cast<size_t>(canvasW) * canvasH);
+    std::vector<uint32_t> pixels(static_cast<size_t>(canvasW) * canvasH);
     withCanvas([&]{
         tool->deactivate(renderer);
-        SDL_RenderReadPixels(renderer, nullptr, SDL_PIXELFORMAT_ARGB8888, s.pixels.data(), canvasW * 4);
+        DrawingUtils::readPixels(renderer, nullptr, pixels.data(), canvasW * 4);
     });
-    undoManager.pushRedo(std::move(s));
-    CanvasState* prev = undoManager.getUndoTop();
+    history().pushRedo(canvasW, canvasH, pixels);
+    CanvasState* prev = history().getUndoTop();
     if (prev)
-        SDL_UpdateTexture(canvas, nullptr, prev->pixels.data(), canvasW * 4);
+        writeCanvas(nullptr, prev->pixels.data());
 }
 
 void kPen::undo() {
+    KPEN_TRACE_ZONE("undo");
     if (toolbar.currentType == ToolType::SELECT) {
         auto* st = static_cast<SelectTool*>(currentTool.get());
         if (st->isSelectionActive()) {
             if (st->isDirty()) stampForRedo(st);
             currentTool.reset();
             setTool(originalType);
-            CanvasState* top = undoManager.getUndoTop();
+            CanvasState* top = history().getUndoTop();
             if (top) applyState(*top);
             return;
         }
@@ -326,38 +428,33 @@ void kPen::undo() {
     if (toolbar.currentType == ToolType::RESIZE) {
         currentTool.reset();
         setTool(originalType);
-        CanvasState* top = undoManager.getUndoTop();
+        CanvasState* top = history().getUndoTop();
         if (top) applyState(*top);
         return;
     }
-    if (undoManager.getUndoSize() > 1) {
-        CanvasState current;
-        current.w = canvasW; current.h = canvasH;
-        current.pixels.resize(static_cast<size_t>(canvasW) * canvasH);
-        withCanvas([&]{ SDL_RenderReadPixels(renderer, nullptr, SDL_PIXELFORMAT_ARGB8888, current.pixels.data(), canvasW * 4); });
-        undoManager.pushRedo(std::move(current));
-        undoManager.popUndo();
-        CanvasState* top = undoManager.getUndoTop();
+    // saveState runs after every edit, so the canvas is the undo top and the
+    // step moves to redo as stored, without a read-back.
+    if (history().getUndoSize() > 1) {
+        CanvasState* top = history().undo();
         if (top) applyState(*top);
     }
     updateWindowTitle();
 }
 
 void kPen::redo() {
-    if (undoManager.redoEmpty()) return;
-    CanvasState* r = undoManager.getRedoTop();
-    if (!r) return;
-    applyState(*r);
-    undoManager.pushUndoKeepSerial(*r);
-    undoManager.popRedo();
+    KPEN_TRACE_ZONE("redo");
+    if (history().redoEmpty()) return;
+    CanvasState* top = history().redo();
+    if (!top) return;
+    applyState(*top);
     updateWindowTitle();
 }
 
 // ── Canvas resize ─────────────────────────────────────────────────────────────
 
 bool kPen::resizeCanvas(int newW, int newH, bool scaleContent, int originX, int originY) {
-    newW = std::max(1, std::min(16384, newW));
-    newH = std::max(1, std::min(16384, newH));
+    newW = std::max(1, std::min(TiledCanvas::MAX_SIDE, newW));
+    newH = std::max(1, std::min(TiledCanvas::MAX_SIDE, newH));
     if (newW == canvasW && newH == canvasH) return true;
 
     // Commit any active tool so its pixels are stamped onto the canvas before
@@ -369,71 +466,24 @@ bool kPen::resizeCanvas(int newW, int newH, bool scaleContent, int originX, int
     // We do NOT push a pre-resize state — replaceTopUndo refreshes the current
     // state. We only push the post-resize
     // state below, so one undo step correctly returns to this pre-resize state.
-    std::vector<uint32_t> oldPixels(canvasW * canvasH);
-    withCanvas([&]{
-        SDL_RenderReadPixels(renderer, nullptr, SDL_PIXELFORMAT_ARGB8888,
-                             oldPixels.data(), canvasW * 4);
-    });
+    std::vector<uint32_t> oldPixels(static_cast<size_t>(canvasW) * canvasH);
+    readCanvas(nullptr, oldPixels.data());
     // Refresh top undo entry with current pixels (commitActiveTool stamped them).
-    undoManager.replaceTopUndo(canvasW, canvasH, oldPixels);
-
-    // Build new pixel buffer — transparent background.
-    std::vector<uint32_t> newPixels(newW * newH, 0x00000000);
-
-    if (scaleContent) {
-        // Nearest-neighbour scale — origin shift ignored, whole image resampled.
-        for (int y = 0; y < newH; y++) {
-            int srcY = std::min((int)((float)y / newH * canvasH), canvasH - 1);
-            for (int x = 0; x < newW; x++) {
-                int srcX = std::min((int)((float)x / newW * canvasW), canvasW - 1);
-                newPixels[y * newW + x] = oldPixels[srcY * canvasW + srcX];
-            }
-        }
-    } else {
-        // Crop / pad with origin shift.
-        // originX/Y: how much the old top-left corner moved in canvas pixels.
-        // Positive origin means the old content shifts right/down in the new buffer
-        // (i.e. padding is added on the left/top). Negative means content is cropped.
-        int dstOffX = -originX;
-        int dstOffY = -originY;
-        for (int oldY = 0; oldY < canvasH; oldY++) {
-            int newY = oldY + dstOffY;
-            if (newY < 0 || newY >= newH) continue;
-            for (int oldX = 0; oldX < canvasW; oldX++) {
-                int newX = oldX + dstOffX;
-                if (newX < 0 || newX >= newW) continue;
-                newPixels[newY * newW + newX] = oldPixels[oldY * canvasW + oldX];
-            }
-        }
-    }
+    history().replaceTopUndo(canvasW, canvasH, oldPixels);
 
-    SDL_Texture* newCanvas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-                                SDL_TEXTUREACCESS_TARGET, newW, newH);
-    SDL_Texture* newOverlay = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-                                SDL_TEXTUREACCESS_TARGET, newW, newH);
-    if (!newCanvas || !newOverlay) {
-        if (newCanvas) SDL_DestroyTexture(newCanvas);
-        if (newOverlay) SDL_DestroyTexture(newOverlay);
-        return false;
-    }
-    SDL_DestroyTexture(canvas);
-    SDL_DestroyTexture(overlay);
-    canvas = newCanvas;
-    overlay = newOverlay;
-    canvasW = newW;
-    canvasH = newH;
-    SDL_SetTextureBlendMode(canvas,  SDL_BLENDMODE_BLEND);
-    SDL_SetTextureBlendMode(overlay, SDL_BLENDMODE_BLEND);
-    SDL_UpdateTexture(canvas, nullptr, newPixels.data(), canvasW * 4);
-
-    SDL_SetRenderTarget(renderer, overlay);
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
-    SDL_RenderClear(renderer);
-    SDL_SetRenderTarget(renderer, nullptr);
+    // Build new pixel buffer. originX/Y: where the new top-left lands in old
+    // canvas coordinates (positive crops, negative pads on the left/top).
+    std::vector<uint32_t> newPixels = DrawingUtils::resizePixels(
+        oldPixels.data(), canvasW, canvasH, newW, newH, scaleContent, originX, originY);
+
+    if (!replaceCanvasTextures(newW, newH)) return false;
+    writeCanvas(nullptr, newPixels.data());
 
     // Push post-resize state; one undo restores pre-resize (replaceTopUndo above).
-    undoManager.pushUndo(canvasW, canvasH, newPixels);
-    toolbar.syncCanvasSize(canvasW, canvasH);
+    // The step is kept as the resize parameters, not pixels, unless there is
+    // no history yet to resize (new document).
+    if (!history().pushResize(canvasW, canvasH, scaleContent, originX, originY))
+        history().pushUndo(canvasW, canvasH, newPixels);
     return true;
 }
 
@@ -524,13 +574,14 @@ void kPen::pasteFromClipboard() {
     };
 
     // Upload pixels into a streaming texture and hand it to SelectTool
-    SDL_Texture* tex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-                                         SDL_TEXTUREACCESS_STREAMING, w, h);
+    SDL_Texture* tex = MemoryStats::createTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                         SDL_TEXTUREACCESS_STREAMING, w, h,
+                                         MemoryStats::SELECTION_TEXTURE);
     if (!tex) return;
     SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
     void* texPixels; int pitch;
     if (SDL_LockTexture(tex, nullptr, &texPixels, &pitch) != 0) {
-        SDL_DestroyTexture(tex);
+        MemoryStats::destroyTexture(tex);
         return;
     }
     for (int row = 0; row < h; ++row)
@@ -578,22 +629,51 @@ static std::string nativeSaveDialog(const std::string& defaultPath) {
     if (gDialogOpen) return "";
     gDialogOpen = true;
     resetCursorForDialog();
-    const char* filters[] = { "*.png", "*.jpg", "*.jpeg" };
+    const char* filters[] = { "*.png", "*.jpg", "*.jpeg", "*.qoi", "*.pam", "*.ppm" };
     const char* result = tinyfd_saveFileDialog(
         "Save image", defaultPath.empty() ? "untitled.png" : defaultPath.c_str(),
-        3, filters, "Image files (PNG, JPEG)");
+        6, filters, "Image files (PNG, JPEG, QOI, PAM, PPM)");
     gDialogOpen = false;
     postDialogCleanup();
     return result ? result : "";
 }
 
+// Print the MemoryStats table to stderr and show it in a message box.
+void kPen::doMemoryReport() {
+    std::string text = MemoryStats::report();
+    fputs(text.c_str(), stderr);
+    if (gDialogOpen) return;
+    gDialogOpen = true;
+    resetCursorForDialog();
+    tinyfd_messageBox("Memory", text.c_str(), "ok", "info", 1);
+    gDialogOpen = false;
+    postDialogCleanup();
+}
+
+#ifdef KPEN_ENABLE_TRACING
+void kPen::doSaveTrace() {
+    if (gDialogOpen) return;
+    gDialogOpen = true;
+    resetCursorForDialog();
+    const char* filters[] = { "*.json" };
+    const char* result = tinyfd_saveFileDialog("Save performance trace", "kpen-trace.json",
+                                               1, filters, "Chrome trace (JSON)");
+    gDialogOpen = false;
+    postDialogCleanup();
+    if (!result) return;
+    if (!Trace::dump(result))
+        tinyfd_messageBox("Save failed", (std::string("Could not write to:\n") + result).c_str(),
+                          "ok", "error", 1);
+}
+#endif
+
 static std::string nativeOpenDialog() {
     if (gDialogOpen) return "";
     gDialogOpen = true;
     resetCursorForDialog();
-    const char* filters[] = { "*.png", "*.jpg", "*.jpeg" };
+    const char* filters[] = { "*.png", "*.jpg", "*.jpeg", "*.qoi", "*.pam", "*.ppm", "*.pgm" };
     const char* result = tinyfd_openFileDialog(
-        "Open image", "", 3, filters, "Image files", 0);
+        "Open image", "", 7, filters, "Image files", 0);
     gDialogOpen = false;
     postDialogCleanup();
     return result ? result : "";
@@ -619,44 +699,33 @@ void kPen::doSave(bool forceSaveAs) {
     commitActiveTool();
 
     std::string path = (!forceSaveAs && !currentFilePath.empty()) ? currentFilePath : "";
-    if (path.empty()) {
+    bool pickedPath = path.empty();
+    if (pickedPath) {
         path = nativeSaveDialog(currentFilePath);
         if (path.empty()) return;  // user cancelled
     }
 
     // Read canvas pixels
-    std::vector<uint32_t> pixels(canvasW * canvasH);
-    withCanvas([&]{
-        SDL_RenderReadPixels(renderer, nullptr, SDL_PIXELFORMAT_ARGB8888,
-                             pixels.data(), canvasW * 4);
-    });
+    std::vector<uint32_t> pixels(static_cast<size_t>(canvasW) * canvasH);
+    readCanvas(nullptr, pixels.data());
 
     // Encode and write
-    bool ok = false;
     auto lower = [](std::string s){ for (auto& c : s) c = (char)tolower(c); return s; };
     std::string ext;
     auto dot = path.rfind('.');
     if (dot != std::string::npos) ext = lower(path.substr(dot));
 
-    if (ext == ".jpg" || ext == ".jpeg") {
-        auto bytes = DrawingUtils::encodeJPEG(pixels.data(), canvasW, canvasH);
-        if (!bytes.empty()) {
-            FILE* f = fopen(path.c_str(), "wb");
-            if (f) { fwrite(bytes.data(), 1, bytes.size(), f); fclose(f); ok = true; }
-        }
-    } else {
-        // Default to PNG
-        if (ext != ".png") path += ".png";
-        auto bytes = DrawingUtils::encodePNG(pixels.data(), canvasW, canvasH);
-        if (!bytes.empty()) {
-            FILE* f = fopen(path.c_str(), "wb");
-            if (f) { fwrite(bytes.data(), 1, bytes.size(), f); fclose(f); ok = true; }
-        }
-    }
+    // Ask for quality when a JPEG path is chosen; plain Save reuses the last value.
+    if ((ext == ".jpg" || ext == ".jpeg") && pickedPath && !promptJpegQuality()) return;
+    // Anything that isn't a known format is written as PNG.
+    if (ext != ".jpg" && ext != ".jpeg" && ext != ".qoi" && ext != ".pam" && ext != ".ppm" &&
+        ext != ".png")
+        path += ".png";
+    bool ok = DrawingUtils::writeImageFile(path, pixels.data(), canvasW, canvasH, jpegQuality_);
 
     if (ok) {
         currentFilePath  = path;
-        savedStateId = undoManager.currentSerial();
+        savedStateId = history().currentSerial();
         updateWindowTitle();
     } else {
         tinyfd_messageBox("Save failed", ("Could not write to:\n" + path).c_str(),
@@ -664,10 +733,71 @@ void kPen::doSave(bool forceSaveAs) {
     }
 }
 
+bool kPen::promptJpegQuality() {
+    if (gDialogOpen) return false;
+    gDialogOpen = true;
+    resetCursorForDialog();
+    std::string current = std::to_string(jpegQuality_);
+    const char* answer = tinyfd_inputBox("JPEG quality", "Quality (1-100):", current.c_str());
+    gDialogOpen = false;
+    postDialogCleanup();
+    if (!answer) return false;
+    int q = std::atoi(answer);
+    if (q > 0) jpegQuality_ = std::max(1, std::min(100, q));
+    return true;
+}
+
+// Export a palette PNG: lossless when the canvas has at most 256 colors,
+// otherwise quantized (the user chooses whether to dither).
+void kPen::doExportIndexed() {
+    commitActiveTool();
+
+    std::string defaultPath = currentFilePath;
+    auto dot = defaultPath.rfind('.');
+    if (dot != std::string::npos) defaultPath = defaultPath.substr(0, dot) + ".png";
+    std::string path = nativeSaveDialog(defaultPath);
+    if (path.empty()) return;  // user cancelled
+    auto lower = [](std::string s){ for (auto& c : s) c = (char)tolower(c); return s; };
+    if (path.size() < 4 || lower(path.substr(path.size() - 4)) != ".png") path += ".png";
+
+    std::vector<uint32_t> pixels(static_cast<size_t>(canvasW) * canvasH);
+    readCanvas(nullptr, pixels.data());
+
+    PaletteQuantizer::Result q;
+    if (!PaletteQuantizer::buildExact(pixels.data(), pixels.size(), q)) {
+        if (gDialogOpen) return;
+        gDialogOpen = true;
+        resetCursorForDialog();
+        int choice = tinyfd_messageBox(
+            "Export Indexed PNG",
+            "The image has more than 256 colors and will be reduced.\nUse dithering?",
+            "yesnocancel", "question", 1);
+        gDialogOpen = false;
+        postDialogCleanup();
+        if (choice == 0) return;
+        PaletteQuantizer::quantize(pixels.data(), canvasW, canvasH, 256, choice == 1, q);
+    }
+
+    bool ok = false;
+    auto bytes = DrawingUtils::encodeIndexedPNG(q.palette.data(), (int)q.palette.size(),
+                                                q.indices.data(), canvasW, canvasH);
+    if (!bytes.empty()) {
+        FILE* f = fopen(path.c_str(), "wb");
+        if (f) { fwrite(bytes.data(), 1, bytes.size(), f); fclose(f); ok = true; }
+    }
+    // An export does not become the document's file or mark it saved.
+    if (!ok)
+        tinyfd_messageBox("Export failed", ("Could not write to:\n" + path).c_str(),
+                          "ok", "error", 1);
+}
+
 void kPen::doOpen() {
     std::string path = nativeOpenDialog();
     if (path.empty()) return;
+    openPath(path);
+}
 
+void kPen::openPath(const std::string& path) {
     // Reject unsupported formats
     auto lower = [](std::string s){ for (auto& c : s) c = (char)tolower(c); return s; };
     std::string ext = (path.size() >= 4) ? lower(path.substr(path.size() - 4)) : "";
@@ -680,40 +810,344 @@ void kPen::doOpen() {
         return;
     }
 
-    // Read and decode the file
-    FILE* f = fopen(path.c_str(), "rb");
-    if (!f) return;
-    fseek(f, 0, SEEK_END); long sz = ftell(f); rewind(f);
-    std::vector<uint8_t> raw(sz);
-    fread(raw.data(), 1, sz, f);
-    fclose(f);
-
+    // Map the file and read just the header so the canvas can be sized right away;
+    // the full decode happens on the loader thread.
+    MappedFile file;
     int iw = 0, ih = 0;
-    auto pixels = DrawingUtils::decodeImage(raw.data(), (int)sz, iw, ih);
-    if (pixels.empty() || iw <= 0 || ih <= 0) {
+    if (!file.open(path) || file.size() > static_cast<size_t>(INT_MAX) ||
+        !DrawingUtils::probeImage(file.data(), static_cast<int>(file.size()), iw, ih)) {
         tinyfd_messageBox("Open failed", ("Could not read image:\n" + path).c_str(),
                           "ok", "error", 1);
         return;
     }
 
+    cancelLoad();
     commitActiveTool();
 
-    undoManager.clear();
-    if (!resizeCanvas(iw, ih, /*scaleContent=*/false)) {
+    if (!replaceCanvasTextures(iw, ih)) {
         tinyfd_messageBox("Open failed", "Could not resize canvas.", "ok", "error", 1);
         return;
     }
-    if (undoManager.getUndoSize() == 0) saveState();
-
-    SDL_UpdateTexture(canvas, nullptr, pixels.data(), iw * 4);
-    undoManager.setUndoTopPixels(pixels);
+    // Blank placeholder until the decoded pixels arrive.
+    withCanvas([&]{
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+        DrawingUtils::renderClear(renderer);
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    });
+    history().clear();
 
     currentFilePath = path;
-    savedStateId = undoManager.currentSerial();
+    loading_ = true;
+    ImageLoader::startLoadAsync(std::move(file), path, ++loadGeneration_);
     updateWindowTitle();
     resetViewAndGestureState();
 }
 
+void kPen::cancelLoad() {
+    if (!loading_) return;
+    loading_ = false;
+    ++loadGeneration_;  // result of the in-flight decode will be discarded
+    std::vector<uint32_t>().swap(pendingPixels_);
+    pendingRow_ = 0;
+}
+
+void kPen::handleImageLoaded(ImageLoader::Result* r, bool& needsRedraw) {
+    if (!loading_ || r->generation != loadGeneration_) return;  // superseded
+    if (r->pixels.empty() || r->w != canvasW || r->h != canvasH) {
+        loading_ = false;
+        tinyfd_messageBox("Open failed", ("Could not read image:\n" + r->path).c_str(),
+                          "ok", "error", 1);
+        newDocument();
+    } else {
+        pendingPixels_ = std::move(r->pixels);
+        pendingRow_ = 0;
+    }
+    needsRedraw = true;
+}
+
+// Upload the next band of decoded rows; after the last band the image becomes
+// the base undo state and the document is marked clean.
+void kPen::uploadPendingRows(bool& needsRedraw) {
+    const int kPixelsPerFrame = 1 << 21;
+    int rows = std::max(1, kPixelsPerFrame / canvasW);
+    rows = std::min(rows, canvasH - pendingRow_);
+    SDL_Rect band = { 0, pendingRow_, canvasW, rows };
+    writeCanvas(&band, pendingPixels_.data() + static_cast<size_t>(pendingRow_) * canvasW);
+    pendingRow_ += rows;
+    unsavedAll_ = true;
+    needsRedraw = true;
+    if (pendingRow_ < canvasH) return;
+
+    history().clear();
+    history().pushUndo(canvasW, canvasH, pendingPixels_);
+    std::vector<uint32_t>().swap(pendingPixels_);
+    pendingRow_ = 0;
+    loading_ = false;
+    savedStateId = history().currentSerial();
+    updateWindowTitle();
+}
+
+void kPen::newDocument() {
+    cancelLoad();
+    commitActiveTool();
+    history().clear();
+    currentFilePath.clear();
+    withCanvas([&]{
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+        DrawingUtils::renderClear(renderer);
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    });
+    resizeCanvas(1200, 800, false);
+    if (history().getUndoSize() == 0) saveState();
+    savedStateId = history().currentSerial();
+    updateWindowTitle();
+    resetViewAndGestureState();
+}
+
+// ── Script playback ───────────────────────────────────────────────────────────
+
+bool kPen::startScript(const std::string& path) {
+    auto reader = std::make_unique<Script::Reader>();
+    if (!reader->open(path)) return false;
+    script_ = std::move(reader);
+    scriptCommands_ = 0;
+    return true;
+}
+
+// Run script commands until the frame budget is spent, so the window keeps
+// redrawing while long scripts play.
+void kPen::stepScript(Uint32 budgetMs, bool& needsRedraw, bool& overlayDirty) {
+    Uint32 start = SDL_GetTicks();
+    Script::Command cmd;
+    do {
+        if (!script_->next(cmd)) {
+            fprintf(stderr, "kPen: script finished (%zu commands)\n", scriptCommands_);
+            script_.reset();
+            break;
+        }
+        std::string err = Script::execute(*this, cmd);
+        if (!err.empty()) {
+            std::string msg = "Line " + std::to_string(cmd.line) + ": " + err;
+            tinyfd_messageBox("Script stopped", msg.c_str(), "ok", "error", 1);
+            script_.reset();
+            break;
+        }
+        scriptCommands_++;
+    } while (SDL_GetTicks() - start < budgetMs);
+    toolbar.syncCanvasSize(canvasW, canvasH);
+    needsRedraw = true; overlayDirty = true;
+}
+
+void kPen::selectTool(ToolType t, bool option) {
+    switch (t) {
+        case ToolType::BRUSH:  toolbar.squareBrush  = option; break;
+        case ToolType::ERASER: toolbar.squareEraser = option; break;
+        case ToolType::RECT:   toolbar.fillRect     = option; break;
+        case ToolType::CIRCLE: toolbar.fillCircle   = option; break;
+        case ToolType::SELECT: toolbar.lassoSelect  = option; break;
+        default: break;
+    }
+    setTool(t);
+}
+
+void kPen::setBrushSize(int size) {
+    toolbar.brushSize = size;
+    toolbar.syncBrushSize();
+}
+
+void kPen::setBrushColor(SDL_Color color) {
+    toolbar.selectedPresetSlot = -1;
+    toolbar.brushColor = color;
+    Toolbar::rgbToHsv(color, toolbar.hue, toolbar.sat, toolbar.val);
+}
+
+bool kPen::floatingBounds(SDL_Rect& out) {
+    if (toolbar.currentType == ToolType::SELECT) {
+        auto* st = static_cast<SelectTool*>(currentTool.get());
+        if (!st->isSelectionActive()) return false;
+        out = st->getFloatingBounds();
+        return true;
+    }
+    if (toolbar.currentType == ToolType::RESIZE) {
+        out = static_cast<ResizeTool*>(currentTool.get())->getBounds();
+        return true;
+    }
+    return false;
+}
+
+bool kPen::rotateFloating(float radians) {
+    SDL_Rect b;
+    if (!floatingBounds(b)) return false;
+    static_cast<TransformTool*>(currentTool.get())->rotateBy(radians);
+    return true;
+}
+
+// setTool stamps a floating selection/shape or pending line and records the undo step.
+void kPen::commitTool() {
+    setTool(originalType);
+}
+
+int kPen::maxCanvasSide() {
+    return TiledCanvas::MAX_SIDE;
+}
+
+bool kPen::newCanvas(int w, int h) {
+    cancelLoad();
+    commitActiveTool();
+    if ((w != canvasW || h != canvasH) && !replaceCanvasTextures(w, h)) return false;
+    withCanvas([&]{
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+        DrawingUtils::renderClear(renderer);
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    });
+    history().clear();
+    saveState();
+    resetViewAndGestureState();
+    return true;
+}
+
+void kPen::clearCanvas(SDL_Color c) {
+    commitTool();
+    withCanvas([&]{
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+        SDL_SetRenderDrawColor(renderer, c.r, c.g, c.b, c.a);
+        DrawingUtils::renderClear(renderer);
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    });
+    saveState();
+}
+
+// Writes a copy; the document keeps its own path and saved state.
+bool kPen::saveImage(const std::string& path) {
+    commitTool();
+    std::vector<uint32_t> pixels(static_cast<size_t>(canvasW) * canvasH);
+    readCanvas(nullptr, pixels.data());
+    return DrawingUtils::writeImageFile(path, pixels.data(), canvasW, canvasH, jpegQuality_);
+}
+
+// ── Event record / replay ─────────────────────────────────────────────────────
+
+bool kPen::startRecording(const std::string& path) {
+    EventLog::Header h;
+    h.canvasW = canvasW;  h.canvasH = canvasH;
+    h.winW    = winW_;    h.winH    = winH_;
+    h.tool    = (int)toolbar.currentType;
+    h.brushSize  = toolbar.brushSize;
+    h.brushColor = toolbar.brushColor;
+    h.squareBrush = toolbar.squareBrush;  h.squareEraser = toolbar.squareEraser;
+    h.fillRect    = toolbar.fillRect;     h.fillCircle   = toolbar.fillCircle;
+    h.lassoSelect = toolbar.lassoSelect;
+    auto writer = std::make_unique<EventLog::Writer>();
+    if (!writer->open(path, h)) return false;
+    recorder_ = std::move(writer);
+    return true;
+}
+
+// Opening an image decodes on a worker; during replay wait for it so the next
+// event sees the same canvas it did while recording.
+void kPen::finishLoadForReplay(bool& running, bool& needsRedraw, bool& overlayDirty) {
+    while (loading_) {
+        if (!pendingPixels_.empty()) { uploadPendingRows(needsRedraw); continue; }
+        SDL_Event ev;
+        if (SDL_WaitEventTimeout(&ev, 50) && ev.type == SDL_USEREVENT &&
+            ev.user.code == ImageLoader::IMAGE_LOAD_RESULT)
+            processEvent(ev, running, needsRedraw, overlayDirty);
+    }
+}
+
+uint64_t kPen::canvasChecksum() {
+    std::vector<uint32_t> pixels(static_cast<size_t>(canvasW) * canvasH);
+    readCanvas(nullptr, pixels.data());
+    int dims[2] = { canvasW, canvasH };
+    uint64_t h = PerfStats::fnv1a(dims, sizeof(dims));
+    return PerfStats::fnv1a(pixels.data(), pixels.size() * 4, h);
+}
+
+int kPen::replay(const std::string& path, bool realtime, const std::string& expectChecksum) {
+    EventLog::Reader log;
+    EventLog::Header h;
+    if (!log.open(path, h)) {
+        fprintf(stderr, "kPen: %s is not a kPen event log\n", path.c_str());
+        return 2;
+    }
+
+    // Start from the state the recording started from.
+    SDL_SetWindowSize(window, h.winW, h.winH);
+    SDL_GetWindowSize(window, &winW_, &winH_);
+    toolbar.squareBrush = h.squareBrush;  toolbar.squareEraser = h.squareEraser;
+    toolbar.fillRect    = h.fillRect;     toolbar.fillCircle   = h.fillCircle;
+    toolbar.lassoSelect = h.lassoSelect;
+    setBrushSize(h.brushSize);
+    setBrushColor(h.brushColor);
+    if (!newCanvas(h.canvasW, h.canvasH)) {
+        fprintf(stderr, "kPen: could not create a %dx%d canvas\n", h.canvasW, h.canvasH);
+        return 2;
+    }
+    setTool(static_cast<ToolType>(h.tool));
+    toolbar.syncCanvasSize(canvasW, canvasH);
+    savedStateId = history().currentSerial();
+
+    bool running = true, needsRedraw = true, overlayDirty = true;
+    std::vector<double> latencies;
+    const double msPerTick = 1000.0 / (double)SDL_GetPerformanceFrequency();
+    const Uint64 start = SDL_GetPerformanceCounter();
+    Uint64 logMs = 0, lastFrameLogMs = 0;
+    SDL_Event e;
+    Uint32 deltaMs;
+    while (running && log.next(e, deltaMs)) {
+        logMs += deltaMs;
+        if (realtime) {
+            double elapsed = (SDL_GetPerformanceCounter() - start) * msPerTick;
+            if (elapsed < logMs) SDL_Delay((Uint32)(logMs - elapsed));
+        }
+        // Tools read the pointer and modifiers from SDL, not just from the event.
+        if (e.type == SDL_MOUSEMOTION)
+            SDL_WarpMouseInWindow(window, e.motion.x, e.motion.y);
+        else if (e.type == SDL_MOUSEBUTTONDOWN || e.type == SDL_MOUSEBUTTONUP)
+            SDL_WarpMouseInWindow(window, e.button.x, e.button.y);
+        else if (e.type == SDL_KEYDOWN || e.type == SDL_KEYUP)
+            SDL_SetModState((SDL_Keymod)e.key.keysym.mod);
+
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        processEvent(e, running, needsRedraw, overlayDirty);
+        finishLoadForReplay(running, needsRedraw, overlayDirty);
+        // Draw at most one frame per 16 ms of recorded time, as the live loop would.
+        if (needsRedraw && logMs - lastFrameLogMs >= 16) {
+            renderFrame(overlayDirty);
+            needsRedraw = false;
+            lastFrameLogMs = logMs;
+        }
+        latencies.push_back((SDL_GetPerformanceCounter() - t0) * msPerTick);
+
+        // Live input (and the warps' own motion events) must not leak into the replay.
+        SDL_PumpEvents();
+        SDL_FlushEvents(SDL_FIRSTEVENT, SDL_LASTEVENT);
+    }
+    double totalMs = (SDL_GetPerformanceCounter() - start) * msPerTick;
+
+    commitActiveTool();
+    renderFrame(overlayDirty);
+    char checksum[17];
+    snprintf(checksum, sizeof(checksum), "%016llx", (unsigned long long)canvasChecksum());
+
+    size_t n = latencies.size();
+    printf("replay: %zu events in %.3f s (%s)\n", n, totalMs / 1000.0, realtime ? "real time" : "fast");
+    printf("latency ms: p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+           PerfStats::percentile(latencies, 0.50), PerfStats::percentile(latencies, 0.90),
+           PerfStats::percentile(latencies, 0.99), PerfStats::percentile(latencies, 1.0));
+    printf("peak memory: %.1f MB\n", PerfStats::peakResidentBytes() / (1024.0 * 1024.0));
+    printf("canvas: %dx%d checksum %s\n", canvasW, canvasH, checksum);
+
+    if (!expectChecksum.empty() && expectChecksum != checksum) {
+        printf("checksum MISMATCH (expected %s)\n", expectChecksum.c_str());
+        return 1;
+    }
+    return 0;
+}
+
 // ── Run loop ──────────────────────────────────────────────────────────────────
 
 // ── dispatchCommand ───────────────────────────────────────────────────────────
@@ -722,23 +1156,16 @@ void kPen::doOpen() {
 // Windows/Linux, synthesised from SDL_KEYDOWN modifier shortcuts.
 
 void kPen::dispatchCommand(int code, bool& running, bool& needsRedraw, bool& overlayDirty) {
+    // The canvas is only a placeholder while an open is in flight; allow
+    // commands that replace or leave the document, ignore the editing ones.
+    if (loading_ && code != MacMenu::FILE_NEW && code != MacMenu::FILE_OPEN &&
+        code != MacMenu::FILE_CLOSE && code != MacMenu::QUIT &&
+        code != MacMenu::ABOUT && code != MacMenu::CHECK_FOR_UPDATES)
+        return;
     switch (code) {
         case MacMenu::FILE_NEW:
             if (promptSaveIfNeeded()) {
-                commitActiveTool();
-                undoManager.clear();
-                currentFilePath.clear();
-                withCanvas([&]{
-                    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
-                    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
-                    SDL_RenderClear(renderer);
-                    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-                });
-                resizeCanvas(1200, 800, false);
-                if (undoManager.getUndoSize() == 0) saveState();
-                savedStateId = undoManager.currentSerial();
-                updateWindowTitle();
-                resetViewAndGestureState();
+                newDocument();
                 needsRedraw = true;
                 overlayDirty = true;
             }
@@ -748,6 +1175,10 @@ void kPen::dispatchCommand(int code, bool& running, bool& needsRedraw, bool& ove
             break;
         case MacMenu::FILE_SAVE:    doSave(currentFilePath.empty()); needsRedraw = true; break;
         case MacMenu::FILE_SAVE_AS: doSave(true); needsRedraw = true; break;
+        case MacMenu::FILE_EXPORT_INDEXED: doExportIndexed(); needsRedraw = true; break;
+#ifdef KPEN_ENABLE_TRACING
+        case MacMenu::FILE_SAVE_TRACE: doSaveTrace(); needsRedraw = true; break;
+#endif
         case MacMenu::FILE_CLOSE:
         case MacMenu::QUIT:
             if (promptSaveIfNeeded()) { running = false; }
@@ -784,8 +1215,16 @@ void kPen::dispatchCommand(int code, bool& running, bool& needsRedraw, bool& ove
 }
 
 void kPen::processEvent(SDL_Event& e, bool& running, bool& needsRedraw, bool& overlayDirty) {
+    KPEN_TRACE_ZONE("processEvent");
     if (e.type == SDL_QUIT) { handleQuit(running); return; }
     if (e.type == SDL_USEREVENT) { handleUserEvent(e, running, needsRedraw, overlayDirty); return; }
+    if (e.type == SDL_DROPFILE) { handleDropFile(e, needsRedraw); return; }
+    // Drop editing input while an opened image is still loading; modifier
+    // shortcuts still reach dispatchCommand, which filters them.
+    if (loading_ && (e.type == SDL_TEXTINPUT || e.type == SDL_MOUSEBUTTONDOWN ||
+                     e.type == SDL_MOUSEBUTTONUP ||
+                     (e.type == SDL_KEYDOWN && !(e.key.keysym.mod & (KMOD_GUI | KMOD_CTRL)))))
+        return;
     if (e.type == SDL_TEXTINPUT) { handleTextInput(e, needsRedraw); return; }
     if (e.type == SDL_KEYDOWN) { handleKeyDown(e, running, needsRedraw, overlayDirty); return; }
     if (e.type == SDL_KEYUP) { handleKeyUp(e, needsRedraw); return; }
@@ -814,6 +1253,12 @@ void kPen::handleQuit(bool& running) {
 }
 
 void kPen::handleUserEvent(SDL_Event& e, bool& running, bool& needsRedraw, bool& overlayDirty) {
+    if (e.user.code == ImageLoader::IMAGE_LOAD_RESULT && e.user.data1) {
+        ImageLoader::Result* r = static_cast<ImageLoader::Result*>(e.user.data1);
+        handleImageLoaded(r, needsRedraw);
+        delete r;
+        return;
+    }
 #ifdef _WIN32
     if (e.user.code == WinUpdate::WIN_UPDATE_RESULT && e.user.data1) {
         WinUpdate::WinUpdateResult* r = static_cast<WinUpdate::WinUpdateResult*>(e.user.data1);
@@ -847,6 +1292,14 @@ void kPen::handleUserEvent(SDL_Event& e, bool& running, bool& needsRedraw, bool&
     dispatchCommand(e.user.code, running, needsRedraw, overlayDirty);
 }
 
+void kPen::handleDropFile(SDL_Event& e, bool& needsRedraw) {
+    if (!e.drop.file) return;
+    std::string path = e.drop.file;
+    SDL_free(e.drop.file);
+    if (gDialogOpen) return;
+    if (promptSaveIfNeeded()) { openPath(path); needsRedraw = true; }
+}
+
 void kPen::handleTextInput(SDL_Event& e, bool& needsRedraw) {
     if (toolbar.onTextInput(e.text.text)) { needsRedraw = true; }
 }
@@ -935,6 +1388,13 @@ void kPen::handleKeyDown(SDL_Event& e, bool& running, bool& needsRedraw, bool& o
             if (originalType == ToolType::RECT)   toolbar.fillRect     = !toolbar.fillRect;
             setTool(ToolType::RECT);   needsRedraw = true; break;
         case SDLK_e:
+            if (e.key.keysym.mod & (KMOD_GUI | KMOD_CTRL)) {
+#ifndef __APPLE__
+                if (e.key.keysym.mod & KMOD_SHIFT)
+                    dispatchCommand(MacMenu::FILE_EXPORT_INDEXED, running, needsRedraw, overlayDirty);
+#endif
+                break;
+            }
             if (originalType == ToolType::ERASER) toolbar.squareEraser = !toolbar.squareEraser;
             setTool(ToolType::ERASER); needsRedraw = true; break;
         case SDLK_f: setTool(ToolType::FILL);   needsRedraw = true; break;
@@ -946,6 +1406,14 @@ void kPen::handleKeyDown(SDL_Event& e, bool& running, bool& needsRedraw, bool& o
             }
             break;
         case SDLK_SPACE: spaceHeld = true; break;
+        case SDLK_F3:  // frame-time / latency / memory HUD
+            hud_.toggle();
+            needsRedraw = true;
+            break;
+        case SDLK_F4:  // memory report
+            doMemoryReport();
+            needsRedraw = true;
+            break;
         case SDLK_BACKSPACE:
         case SDLK_DELETE:
             deleteSelection();
@@ -1265,7 +1733,8 @@ void kPen::handleMultiGesture(SDL_Event& e, bool& needsRedraw) {
             }
             pinchRawDist += e.mgesture.dDist * 6.f;
             float rawZoom = pinchBaseZoom * expf(pinchRawDist);
-            view_.setZoomTarget(std::max(ViewController::MIN_ZOOM, std::min(ViewController::MAX_ZOOM, rawZoom)));
+            float maxZ = ViewController::maxZoom(winW_, winH_, canvasW, canvasH);
+            view_.setZoomTarget(std::max(ViewController::MIN_ZOOM, std::min(maxZ, rawZoom)));
         }
 
         if (multiGestureActive && !gestureNeedsRecenter && zoomPriorityEvents == 0 && !overToolbar && !ctrlHeld) {
@@ -1337,7 +1806,12 @@ void kPen::handleMouseButtonDown(SDL_Event& e, bool& needsRedraw, bool& overlayD
     }
     int cX, cY;
     getCanvasCoords(e.button.x, e.button.y, &cX, &cY);
+    pointerDown(cX, cY);
+    needsRedraw = true; overlayDirty = true;
+}
 
+// Press on the canvas at canvas coordinates (mouse or script).
+void kPen::pointerDown(int cX, int cY) {
     if (toolbar.currentType == ToolType::SELECT) {
         auto* st = static_cast<SelectTool*>(currentTool.get());
         if (st->isSelectionActive() && !st->isHit(cX, cY)) {
@@ -1358,9 +1832,12 @@ void kPen::handleMouseButtonDown(SDL_Event& e, bool& needsRedraw, bool& overlayD
         }
     }
 
-    withCanvas([&]{ currentTool->onMouseDown(cX, cY, renderer, toolbar.brushSize, toolbar.brushColor); });
+    withToolCanvas([&]{
+        PerfHud::Timer t(hud_, PerfHud::TOOL);
+        KPEN_TRACE_ZONE("tool.onMouseDown");
+        currentTool->onMouseDown(cX, cY, renderer, toolbar.brushSize, toolbar.brushColor);
+    });
     if (toolbar.currentType == ToolType::FILL) saveState();
-    needsRedraw = true; overlayDirty = true;
 }
 
 void kPen::handleMouseButtonUp(SDL_Event& e, bool& needsRedraw, bool& overlayDirty) {
@@ -1388,11 +1865,19 @@ void kPen::handleMouseButtonUp(SDL_Event& e, bool& needsRedraw, bool& overlayDir
     toolbar.onMouseUp(e.button.x, e.button.y);
     int cX, cY;
     getCanvasCoords(e.button.x, e.button.y, &cX, &cY);
+    pointerUp(cX, cY);
+    needsRedraw = true; overlayDirty = true;
+}
+
+void kPen::pointerUp(int cX, int cY) {
     bool changed = false;
-    withCanvas([&]{ changed = currentTool->onMouseUp(cX, cY, renderer, toolbar.brushSize, toolbar.brushColor); });
+    withToolCanvas([&]{
+        PerfHud::Timer t(hud_, PerfHud::TOOL);
+        KPEN_TRACE_ZONE("tool.onMouseUp");
+        changed = currentTool->onMouseUp(cX, cY, renderer, toolbar.brushSize, toolbar.brushColor);
+    });
     if (changed && toolbar.currentType != ToolType::SELECT && toolbar.currentType != ToolType::RESIZE)
         saveState();
-    needsRedraw = true; overlayDirty = true;
 }
 
 void kPen::handleMouseMotion(SDL_Event& e, bool& needsRedraw, bool& overlayDirty) {
@@ -1421,12 +1906,7 @@ void kPen::handleMouseMotion(SDL_Event& e, bool& needsRedraw, bool& overlayDirty
     if (toolbar.onMouseMotion(e.motion.x, e.motion.y)) { needsRedraw = true; overlayDirty = true; return; }
     int cX, cY;
     getCanvasCoords(e.motion.x, e.motion.y, &cX, &cY);
-    withCanvas([&]{ currentTool->onMouseMove(cX, cY, renderer, toolbar.brushSize, toolbar.brushColor); });
-
-    if (toolbar.currentType == ToolType::SELECT || toolbar.currentType == ToolType::RESIZE) {
-        if (static_cast<TransformTool*>(currentTool.get())->isMutating())
-            undoManager.clearRedo();
-    }
+    pointerMove(cX, cY);
 
     bool canvasPosChanged = (cX != lastMotionCX || cY != lastMotionCY);
     lastMotionCX = cX;
@@ -1437,6 +1917,19 @@ void kPen::handleMouseMotion(SDL_Event& e, bool& needsRedraw, bool& overlayDirty
     }
 }
 
+void kPen::pointerMove(int cX, int cY) {
+    withToolCanvas([&]{
+        PerfHud::Timer t(hud_, PerfHud::TOOL);
+        KPEN_TRACE_ZONE("tool.onMouseMove");
+        currentTool->onMouseMove(cX, cY, renderer, toolbar.brushSize, toolbar.brushColor);
+    });
+
+    if (toolbar.currentType == ToolType::SELECT || toolbar.currentType == ToolType::RESIZE) {
+        if (static_cast<TransformTool*>(currentTool.get())->isMutating())
+            history().clearRedo();
+    }
+}
+
 void kPen::tickScrollbarFade(bool& needsRedraw) {
     int mx, my;
     SDL_GetMouseState(&mx, &my);
@@ -1481,7 +1974,7 @@ void kPen::updateCursor(bool& /* needsRedraw */, bool& /* overlayDirty */) {
                     withCanvas([&] {
                         SDL_Rect r = { px, py, 1, 1 };
                         Uint32 pixel = 0;
-                        SDL_RenderReadPixels(renderer, &r, SDL_PIXELFORMAT_ARGB8888, &pixel, 4);
+                        DrawingUtils::readPixels(renderer, &r, &pixel, 4);
                         lastPickHoverColor.a = (pixel >> 24) & 0xFF;
                         lastPickHoverColor.r = (pixel >> 16) & 0xFF;
                         lastPickHoverColor.g = (pixel >>  8) & 0xFF;
@@ -1503,12 +1996,14 @@ void kPen::updateCursor(bool& /* needsRedraw */, bool& /* overlayDirty */) {
 }
 
 void kPen::renderFrame(bool& overlayDirty) {
+    KPEN_TRACE_ZONE("renderFrame");
     bool hasOverlay = currentTool->hasOverlayContent();
     if (overlayDirty) {
+        PerfHud::Timer t(hud_, PerfHud::OVERLAY);
         currentTool->onPreviewRender(renderer, toolbar.brushSize, toolbar.brushColor);
-        SDL_SetRenderTarget(renderer, overlay);
+        overlay->bind();
         SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
-        SDL_RenderClear(renderer);
+        DrawingUtils::renderClear(renderer);
         if (hasOverlay) currentTool->onOverlayRender(renderer);
         SDL_SetRenderTarget(renderer, nullptr);
         overlayDirty = false;
@@ -1530,10 +2025,15 @@ void kPen::renderFrame(bool& overlayDirty) {
         float tileW = vf.w / canvasW * cs;
         float tileH = vf.h / canvasH * cs;
         if (tileW > 0.f && tileH > 0.f) {
+            // Only the cells in the window; a zoomed-in 65536² canvas has millions.
             int numCols = (int)std::ceil((float)canvasW / cs) + 1;
             int numRows = (int)std::ceil((float)canvasH / cs) + 1;
-            for (int row = 0; row < numRows; ++row) {
-                for (int col = 0; col < numCols; ++col) {
+            int col0 = std::max(0, (int)std::floor(-vf.x / tileW));
+            int row0 = std::max(0, (int)std::floor(-vf.y / tileH));
+            int col1 = std::min(numCols, (int)std::ceil((winW_ - vf.x) / tileW));
+            int row1 = std::min(numRows, (int)std::ceil((winH_ - vf.y) / tileH));
+            for (int row = row0; row < row1; ++row) {
+                for (int col = col0; col < col1; ++col) {
                     bool light = ((col + row) % 2) == 0;
                     SDL_SetRenderDrawColor(renderer,
                         light ? 200 : 190, light ? 200 : 190, light ? 200 : 190, 255);
@@ -1558,8 +2058,9 @@ void kPen::renderFrame(bool& overlayDirty) {
         (int)std::floor(vf.y + vf.h) - (int)std::ceil(vf.y)
     };
     SDL_RenderSetClipRect(renderer, &viewClip);
-    SDL_RenderCopyF(renderer, canvas, nullptr, &vf);
-    if (hasOverlay) SDL_RenderCopyF(renderer, overlay, nullptr, &vf);
+    // The overlay is redrawn every frame it is shown, so only the canvas keeps mips.
+    canvas->render(vf, viewClip, true);
+    if (hasOverlay) overlay->render(vf, viewClip);
     SDL_RenderSetClipRect(renderer, nullptr);
 
     // Clip to content area (exclude toolbar) so handles/bounding boxes can show in letterbox but not in toolbar
@@ -1710,7 +2211,15 @@ void kPen::renderFrame(bool& overlayDirty) {
         }
     }
 
-    SDL_RenderPresent(renderer);
+    if (hud_.visible()) hud_.draw(renderer, Toolbar::TB_W + 8, 8);
+
+    {
+        PerfHud::Timer t(hud_, PerfHud::PRESENT);
+        SDL_RenderPresent(renderer);
+    }
+    hud_.endFrame();
+    // The frame is out; now read back what saveState queued.
+    flushSnapshots();
 }
 
 void kPen::run() {
@@ -1743,22 +2252,41 @@ void kPen::run() {
     SDL_EventState(SDL_MULTIGESTURE, SDL_ENABLE);
 
     while (running) {
+        SDL_GetWindowSize(window, &winW_, &winH_);
+        bool hadEvent = false;
+        // Until the next frame is due, handle input as it arrives instead of
+        // sleeping: strokes are rasterized while waiting, and the frame shows
+        // everything up to its deadline.
         if (lastFrameTicks != 0) {
-            Uint32 now = SDL_GetTicks();
-            Uint32 elapsed = now - lastFrameTicks;
-            if (elapsed < minFrameIntervalMs)
-                SDL_Delay(minFrameIntervalMs - elapsed);
+            Uint32 due = lastFrameTicks + minFrameIntervalMs;
+            for (Uint32 now = SDL_GetTicks(); running && (Sint32)(due - now) > 0; now = SDL_GetTicks()) {
+                if (!SDL_WaitEventTimeout(&e, (int)(due - now))) break;
+                PerfHud::Timer t(hud_, PerfHud::EVENTS);
+                hadEvent = true;
+                if (recorder_) recorder_->write(e);
+                hud_.noteInput(e);
+                processEvent(e, running, needsRedraw, overlayDirty);
+            }
         }
         lastFrameTicks = SDL_GetTicks();
+        hud_.beginFrame();
 
-        SDL_GetWindowSize(window, &winW_, &winH_);
-        bool hadEvent = false;
-        while (SDL_PollEvent(&e)) {
-            hadEvent = true;
-            processEvent(e, running, needsRedraw, overlayDirty);
+        {
+            PerfHud::Timer t(hud_, PerfHud::EVENTS);
+            while (SDL_PollEvent(&e)) {
+                hadEvent = true;
+                if (recorder_) recorder_->write(e);
+                hud_.noteInput(e);
+                processEvent(e, running, needsRedraw, overlayDirty);
+            }
         }
         if (hadEvent) idleCount = 0;
 
+        if (!pendingPixels_.empty())
+            uploadPendingRows(needsRedraw);
+        if (script_ && !loading_)
+            stepScript(minFrameIntervalMs, needsRedraw, overlayDirty);
+
         // Poll toolbar for a committed canvas resize (Enter key in text field)
         {
             auto req = toolbar.getResizeRequest();
@@ -1814,8 +2342,10 @@ void kPen::run() {
             if (ta || va) needsRedraw = true;
             else {
                 idleCount++;
+                flushSnapshots();
                 lastFrameTicks = SDL_GetTicks();
-                SDL_Delay(idleCount > idleThreshold ? idleDelayLong : idleDelayShort);
+                // Wakes early for input, which the next pass handles at once.
+                SDL_WaitEventTimeout(nullptr, idleCount > idleThreshold ? idleDelayLong : idleDelayShort);
                 continue;
             }
         } else {
@@ -9,9 +9,14 @@
 #include "CursorManager.h"
 #include "UndoManager.h"
 #include "ViewController.h"
+#include "ImageLoader.h"
+#include "TiledCanvas.h"
+#include "Script.h"
+#include "EventLog.h"
+#include "PerfHud.h"
 #include "menu/MacMenu.h"
 
-class kPen : public ICoordinateMapper {
+class kPen : public ICoordinateMapper, public Script::Host {
   public:
     kPen();
     ~kPen();
@@ -26,13 +31,40 @@ class kPen : public ICoordinateMapper {
 
     // Resize canvas; scaleContent=true stretches pixels, false crops/pads. originX/Y = top-left shift in canvas px (negative = grew up/left).
     // Returns false if new texture creation failed (canvas/overlay unchanged).
-    bool resizeCanvas(int newW, int newH, bool scaleContent, int originX = 0, int originY = 0);
+    bool resizeCanvas(int newW, int newH, bool scaleContent, int originX = 0, int originY = 0) override;
+
+    // Run a command script (Script.h) while the window is shown; "-" reads stdin.
+    // Commands are executed in batches between frames. False if it can't be opened.
+    bool startScript(const std::string& path);
+
+    // Record every processed event to `path` (EventLog.h). Call before run().
+    bool startRecording(const std::string& path);
+    // Replay a recorded log instead of run(): as fast as possible, or with the
+    // recorded timing. Prints timing, latency percentiles, peak memory and a
+    // checksum of the final canvas; returns nonzero if the log can't be read or
+    // the checksum differs from `expectChecksum` (hex, optional).
+    int replay(const std::string& path, bool realtime, const std::string& expectChecksum = "");
+
+    // Script::Host — the same paths as mouse input on the canvas, with undo.
+    void selectTool(ToolType t, bool option) override;
+    void setBrushSize(int size) override;
+    void setBrushColor(SDL_Color color) override;
+    void pointerDown(int cX, int cY) override;
+    void pointerMove(int cX, int cY) override;
+    void pointerUp  (int cX, int cY) override;
+    bool floatingBounds(SDL_Rect& out) override;
+    bool rotateFloating(float radians) override;
+    void commitTool() override;
+    int  maxCanvasSide() override;
+    bool newCanvas(int w, int h) override;
+    void clearCanvas(SDL_Color color) override;
+    bool saveImage(const std::string& path) override;
 
   private:
     SDL_Window*   window;
     SDL_Renderer* renderer;
-    SDL_Texture*  canvas;
-    SDL_Texture*  overlay;
+    std::unique_ptr<TiledCanvas> canvas;
+    std::unique_ptr<TiledCanvas> overlay;  // tool previews, canvas-sized
 
     int canvasW = 1200;
     int canvasH = 800;
@@ -99,9 +131,39 @@ class kPen : public ICoordinateMapper {
     bool tickView();
 
     // --- Undo / redo ---
+    // The canvas differs from the undo top only inside unsavedRect_, unless
+    // unsavedAll_. withCanvas sets unsavedAll_ (anything may be drawn);
+    // withToolCanvas narrows it to what the tool reports, if it tracks that.
+    SDL_Rect unsavedRect_ = {0, 0, 0, 0};
+    bool     unsavedAll_  = true;
     template<typename F> void withCanvas(F f);
+    template<typename F> void withToolCanvas(F f);
+    // Read back `area` (whole canvas if null) without marking anything unsaved.
+    void readCanvas(const SDL_Rect* area, uint32_t* out);
+    // Upload `area` (whole canvas if null); rows are area->w pixels apart.
+    void writeCanvas(const SDL_Rect* area, const uint32_t* pixels);
     void saveState();
+    // saveState copies a changed area of up to a tile on the GPU and queues
+    // it; reading it back would wait for the GPU, so that and the undo push
+    // run after the frame is presented. Everything else reaches the history
+    // through history(), which flushes the queue first so steps stay in order.
+    struct PendingSnapshot {
+        SDL_Rect  area;  // on the canvas
+        SDL_Point at;    // in snapshotTarget_
+        std::unique_ptr<UndoCommand> command;
+    };
+    std::vector<PendingSnapshot> snapshots_;
+    // Queued snapshots are packed into this one target, row by row. It is
+    // kept between strokes and only replaced (after a flush) by a larger one.
+    SDL_Texture* snapshotTarget_ = nullptr;
+    int snapshotSide_ = 0;
+    int shelfX_ = 0, shelfY_ = 0, shelfH_ = 0;
+    bool placeSnapshot(int w, int h, SDL_Point& at);
+    void flushSnapshots();
+    UndoManager& history() { flushSnapshots(); return undoManager; }
     void applyState(CanvasState& s);
+    // Start over with blank w×h canvas/overlay targets. False = size out of range, nothing changed.
+    bool replaceCanvasTextures(int w, int h);
     void stampForRedo(AbstractTool* tool);
     void undo();
     void redo();
@@ -118,12 +180,48 @@ class kPen : public ICoordinateMapper {
     std::string currentFilePath;
     int         savedStateId = 0;
     bool hasUnsavedChanges() const {
+        if (loading_) return false;  // placeholder canvas; nothing to lose yet
+        if (!snapshots_.empty()) return true;
         return undoManager.getUndoSize() == 0 || undoManager.currentSerial() != savedStateId;
     }
     void updateWindowTitle();
     bool promptSaveIfNeeded();
+    int         jpegQuality_ = 92;  // last quality chosen for JPEG save (1-100)
     void doSave(bool forceSaveAs);
+    bool promptJpegQuality();   // false if cancelled
+    void doExportIndexed();
+    void doMemoryReport();
+#ifdef KPEN_ENABLE_TRACING
+    void doSaveTrace();  // Trace.h
+#endif
     void doOpen();
+    void newDocument();
+
+    // --- Async open ---
+    // openPath maps the file, sizes a blank placeholder canvas from the header and
+    // decodes on a worker (ImageLoader). The decoded pixels are then uploaded a band
+    // of rows per frame so the window stays responsive. Editing input is ignored
+    // until the upload completes.
+    bool     loading_        = false;
+    unsigned loadGeneration_ = 0;
+    std::vector<uint32_t> pendingPixels_;  // decoded image awaiting upload
+    int      pendingRow_     = 0;          // next row of pendingPixels_ to upload
+    void openPath(const std::string& path);
+    void cancelLoad();
+    void handleImageLoaded(ImageLoader::Result* r, bool& needsRedraw);
+    void uploadPendingRows(bool& needsRedraw);
+
+    // --- Script playback ---
+    std::unique_ptr<Script::Reader> script_;
+    size_t scriptCommands_ = 0;
+    void stepScript(Uint32 budgetMs, bool& needsRedraw, bool& overlayDirty);
+
+    PerfHud hud_;  // F3
+
+    // --- Event record/replay ---
+    std::unique_ptr<EventLog::Writer> recorder_;
+    void finishLoadForReplay(bool& running, bool& needsRedraw, bool& overlayDirty);
+    uint64_t canvasChecksum();
 
     // Menu/shortcut dispatch (MacMenu::Code); SDL_USEREVENT on macOS, SDL_KEYDOWN elsewhere.
     void dispatchCommand(int code, bool& running, bool& needsRedraw, bool& overlayDirty);
@@ -134,6 +232,7 @@ class kPen : public ICoordinateMapper {
     void handleKeyDown(SDL_Event& e, bool& running, bool& needsRedraw, bool& overlayDirty);
     void handleKeyUp(SDL_Event& e, bool& needsRedraw);
     void handleWindowEvent(SDL_Event& e, bool& needsRedraw);
+    void handleDropFile(SDL_Event& e, bool& needsRedraw);
     void handleMouseWheel(SDL_Event& e, bool& needsRedraw, bool& overlayDirty);
     void handleFingerDown(SDL_Event& e);
     void handleFingerUp(SDL_Event& e, bool& needsRedraw, bool& overlayDirty);
@@ -1,7 +1,58 @@
 #include "kPen.h"
+#include "Headless.h"
+#include "Trace.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+// kPen links as a GUI program, so it has no console of its own and stdio goes
+// nowhere. Use the console it was started from, for the streams that are not
+// already redirected to a file or pipe.
+static void attachParentConsole() {
+    if (!AttachConsole(ATTACH_PARENT_PROCESS)) return;  // started from Explorer
+    auto unset = [](DWORD id) { return GetFileType(GetStdHandle(id)) == FILE_TYPE_UNKNOWN; };
+    if (unset(STD_INPUT_HANDLE))  freopen("CONIN$",  "r", stdin);
+    if (unset(STD_OUTPUT_HANDLE)) freopen("CONOUT$", "w", stdout);
+    if (unset(STD_ERROR_HANDLE))  freopen("CONOUT$", "w", stderr);
+}
+#endif
 
 int main(int argc, char** argv) {
+#ifdef _WIN32
+    if (argc > 1) attachParentConsole();  // --headless, --replay, ... report on the console
+#endif
+#ifdef KPEN_ENABLE_TRACING
+    Trace::dumpAtExitFromEnv();
+#endif
+    // Batch mode: no window, no renderer.
+    if (argc > 1 && std::strcmp(argv[1], "--headless") == 0)
+        return Headless::run(argc, argv);
+
+    const char* script = nullptr;
+    const char* record = nullptr;
+    const char* replay = nullptr;
+    const char* expect = "";
+    bool realtime = false;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if      (!std::strcmp(argv[i], "--script") && hasValue) script = argv[++i];
+        else if (!std::strcmp(argv[i], "--record") && hasValue) record = argv[++i];
+        else if (!std::strcmp(argv[i], "--replay") && hasValue) replay = argv[++i];
+        else if (!std::strcmp(argv[i], "--expect") && hasValue) expect = argv[++i];
+        else if (!std::strcmp(argv[i], "--realtime")) realtime = true;
+    }
+
     kPen app;
+    if (replay) return app.replay(replay, realtime, expect);
+    if (record && !app.startRecording(record))
+        fprintf(stderr, "kPen: could not write event log %s\n", record);
+    if (script && !app.startScript(script))
+        fprintf(stderr, "kPen: could not open script %s\n", script);
     app.run();
     return 0;
 }
@@ -26,6 +26,8 @@ namespace MacMenu {
         FILE_SAVE     = 1002,
         FILE_SAVE_AS  = 1003,
         FILE_CLOSE    = 1004,
+        FILE_EXPORT_INDEXED = 1005,
+        FILE_SAVE_TRACE = 1006,  // only in KPEN_ENABLE_TRACING builds
         EDIT_UNDO     = 1010,
         EDIT_REDO     = 1011,
         EDIT_CUT      = 1012,
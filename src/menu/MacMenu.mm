@@ -290,6 +290,10 @@ void MacMenu::install() {
         [fileMenu addItem:[NSMenuItem separatorItem]];
         [fileMenu addItem:makeItem(@"Save",    @"s", NSEventModifierFlagCommand,              MacMenu::FILE_SAVE)];
         [fileMenu addItem:makeItem(@"Save As…",@"s", NSEventModifierFlagCommand|NSEventModifierFlagShift, MacMenu::FILE_SAVE_AS)];
+        [fileMenu addItem:makeItem(@"Export Indexed PNG…", @"e", NSEventModifierFlagCommand|NSEventModifierFlagShift, MacMenu::FILE_EXPORT_INDEXED)];
+#ifdef KPEN_ENABLE_TRACING
+        [fileMenu addItem:makeItem(@"Save Performance Trace…", @"", 0, MacMenu::FILE_SAVE_TRACE)];
+#endif
         [fileMenu addItem:[NSMenuItem separatorItem]];
         [fileMenu addItem:makeItem(@"Close",   @"w", NSEventModifierFlagCommand,              MacMenu::FILE_CLOSE)];
 
@@ -50,7 +50,7 @@ void install(SDL_Window* window) {
         AppendMenuA(bar, MF_POPUP, (UINT_PTR)app, "kPen");
     }
 
-    // File menu: New, Open, separator, Save, Save As, separator, Close
+    // File menu: New, Open, separator, Save, Save As, Export Indexed PNG, separator, Close
     HMENU file = CreatePopupMenu();
     if (file) {
         AppendMenuA(file, MF_STRING, (UINT_PTR)MacMenu::FILE_NEW, "New");
@@ -58,6 +58,10 @@ void install(SDL_Window* window) {
         AppendMenuA(file, MF_SEPARATOR, 0, nullptr);
         AppendMenuA(file, MF_STRING, (UINT_PTR)MacMenu::FILE_SAVE, "Save");
         AppendMenuA(file, MF_STRING, (UINT_PTR)MacMenu::FILE_SAVE_AS, "Save As...");
+        AppendMenuA(file, MF_STRING, (UINT_PTR)MacMenu::FILE_EXPORT_INDEXED, "Export Indexed PNG...");
+#ifdef KPEN_ENABLE_TRACING
+        AppendMenuA(file, MF_STRING, (UINT_PTR)MacMenu::FILE_SAVE_TRACE, "Save Performance Trace...");
+#endif
         AppendMenuA(file, MF_SEPARATOR, 0, nullptr);
         AppendMenuA(file, MF_STRING, (UINT_PTR)MacMenu::FILE_CLOSE, "Close");
         AppendMenuA(bar, MF_POPUP, (UINT_PTR)file, "File");
@@ -1,4 +1,6 @@
 #include "Tools.h"
+#include "DrawingUtils.h"
+#include "Trace.h"
 #include <algorithm>
 
 
@@ -13,7 +15,7 @@ static void samplePixel(int cX, int cY, SDL_Renderer* r,
     // Read 1×1 pixel from the canvas render target (currently active).
     SDL_Rect r1 = { x, y, 1, 1 };
     Uint32 pixel = 0;
-    SDL_RenderReadPixels(r, &r1, SDL_PIXELFORMAT_ARGB8888, &pixel, 4);
+    DrawingUtils::readPixels(r, &r1, &pixel, 4);
 
     SDL_Color c;
     c.a = (pixel >> 24) & 0xFF;
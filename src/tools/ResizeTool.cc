@@ -1,5 +1,7 @@
 #include "Tools.h"
 #include "DrawingUtils.h"
+#include "MemoryStats.h"
+#include "Trace.h"
 #include <algorithm>
 #include <cmath>
 
@@ -82,8 +84,8 @@ void ResizeTool::renderShapeAt(SDL_Renderer* r, float x, float y, int w, int h,
         return;
     }
 
-    SDL_Texture* tmp = SDL_CreateTexture(r, SDL_PIXELFORMAT_ARGB8888,
-                                          SDL_TEXTUREACCESS_TARGET, w, h);
+    SDL_Texture* tmp = MemoryStats::createTexture(r, SDL_PIXELFORMAT_ARGB8888,
+                                          SDL_TEXTUREACCESS_TARGET, w, h, MemoryStats::TEMP_TEXTURE);
     if (!tmp) return;
     SDL_SetTextureBlendMode(tmp, SDL_BLENDMODE_BLEND);
     SDL_Texture* prev = SDL_GetRenderTarget(r);
@@ -106,8 +108,8 @@ void ResizeTool::renderShapeAt(SDL_Renderer* r, float x, float y, int w, int h,
     }
     SDL_FRect dstF = { x, y, (float)w, (float)h };
     SDL_FPoint centerF = { pivotX, pivotY };
-    SDL_RenderCopyExF(r, tmp, nullptr, &dstF, angleDeg, &centerF, SDL_FLIP_NONE);
-    SDL_DestroyTexture(tmp);
+    DrawingUtils::renderCopyEx(r, tmp, &dstF, angleDeg, &centerF, SDL_FLIP_NONE);
+    MemoryStats::destroyTexture(tmp);
 }
 
 void ResizeTool::onOverlayRender(SDL_Renderer* r) {
@@ -146,7 +148,8 @@ void ResizeTool::deactivate(SDL_Renderer* r) {
 std::vector<uint32_t> ResizeTool::getFloatingPixels(SDL_Renderer* r) const {
     int w = currentBounds.w, h = currentBounds.h;
     if (w <= 0 || h <= 0) return {};
-    SDL_Texture* tmp = SDL_CreateTexture(r, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, w, h);
+    SDL_Texture* tmp = MemoryStats::createTexture(r, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, w, h,
+                                                  MemoryStats::TEMP_TEXTURE);
     if (!tmp) return {};
     SDL_SetTextureBlendMode(tmp, SDL_BLENDMODE_BLEND);
     SDL_Texture* prev = SDL_GetRenderTarget(r);
@@ -154,10 +157,10 @@ std::vector<uint32_t> ResizeTool::getFloatingPixels(SDL_Renderer* r) const {
     SDL_SetRenderDrawColor(r, 0, 0, 0, 0);
     SDL_RenderClear(r);
     renderShape(r, {0, 0, w, h}, *liveBrushSize, *liveColor, w, h);
-    std::vector<uint32_t> pixels(w * h);
+    std::vector<uint32_t> pixels(static_cast<size_t>(w) * h);
     SDL_RenderReadPixels(r, nullptr, SDL_PIXELFORMAT_ARGB8888, pixels.data(), w * 4);
     SDL_SetRenderTarget(r, prev);
-    SDL_DestroyTexture(tmp);
+    MemoryStats::destroyTexture(tmp);
     return pixels;
 }
 
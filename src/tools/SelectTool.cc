@@ -1,5 +1,7 @@
 #include "Tools.h"
 #include "DrawingUtils.h"
+#include "MemoryStats.h"
+#include "Trace.h"
 #include <cmath>
 #include <algorithm>
 #include <cstring>
@@ -12,7 +14,7 @@ SelectTool::SelectTool(ICoordinateMapper* m, bool lassoMode)
     : TransformTool(m), lassoMode_(lassoMode) {}
 
 SelectTool::~SelectTool() {
-    if (selectionTexture) SDL_DestroyTexture(selectionTexture);
+    MemoryStats::destroyTexture(selectionTexture);
 }
 
 // Robust integer ray-cast: count crossings of horizontal line at py with segment (xj,yj)-(xi,yi).
@@ -57,7 +59,7 @@ void SelectTool::commitLassoSelection(SDL_Renderer* r, int canvasW, int canvasH)
 
     std::vector<uint32_t> canvasPixels(static_cast<size_t>(rw) * rh);
     SDL_Rect readRect = { rx, ry, rw, rh };
-    SDL_RenderReadPixels(r, &readRect, SDL_PIXELFORMAT_ARGB8888, canvasPixels.data(), rw * 4);
+    DrawingUtils::readPixels(r, &readRect, canvasPixels.data(), rw * 4);
 
     std::vector<uint32_t> texPixels(static_cast<size_t>(rw) * rh, 0);
     for (int py = 0; py < rh; py++) {
@@ -69,9 +71,9 @@ void SelectTool::commitLassoSelection(SDL_Renderer* r, int canvasW, int canvasH)
         }
     }
 
-    if (selectionTexture) SDL_DestroyTexture(selectionTexture);
-    selectionTexture = SDL_CreateTexture(r, SDL_PIXELFORMAT_ARGB8888,
-                                         SDL_TEXTUREACCESS_TARGET, rw, rh);
+    MemoryStats::destroyTexture(selectionTexture);
+    selectionTexture = MemoryStats::createTexture(r, SDL_PIXELFORMAT_ARGB8888,
+                                         SDL_TEXTUREACCESS_TARGET, rw, rh, MemoryStats::SELECTION_TEXTURE);
     if (!selectionTexture) {
         isDrawing = false;
         lassoPoints_.clear();
@@ -87,7 +89,7 @@ void SelectTool::commitLassoSelection(SDL_Renderer* r, int canvasW, int canvasH)
             int cx = rx + px, cy = ry + py;
             if (pointInPolygon(cx, cy, lassoPoints_)) {
                 SDL_Rect one = { cx, cy, 1, 1 };
-                SDL_RenderFillRect(r, &one);
+                DrawingUtils::renderFillRect(r, &one);
             }
         }
     }
@@ -111,7 +113,7 @@ void SelectTool::renderWithTransform(SDL_Renderer* r, const SDL_Rect& dst) const
     float hw = dst.w * 0.5f, hh = dst.h * 0.5f;
     SDL_FRect dstF = { (float)dst.x, (float)dst.y, (float)dst.w, (float)dst.h };
     SDL_FPoint centerF = { hw, hh };
-    SDL_RenderCopyExF(r, selectionTexture, nullptr, &dstF, angleDeg, &centerF, flip);
+    DrawingUtils::renderCopyEx(r, selectionTexture, &dstF, angleDeg, &centerF, flip);
 }
 
 void SelectTool::onMouseDown(int cX, int cY, SDL_Renderer* r, int brushSize, SDL_Color color) {
@@ -165,23 +167,23 @@ bool SelectTool::onMouseUp(int cX, int cY, SDL_Renderer* r, int brushSize, SDL_C
     int rw = rx2 - rx, rh = ry2 - ry;
     if (rw <= 0 || rh <= 0) { isDrawing = false; return false; }
 
-    if (selectionTexture) SDL_DestroyTexture(selectionTexture);
-    selectionTexture = SDL_CreateTexture(r, SDL_PIXELFORMAT_ARGB8888,
-                                         SDL_TEXTUREACCESS_TARGET, rw, rh);
+    MemoryStats::destroyTexture(selectionTexture);
+    selectionTexture = MemoryStats::createTexture(r, SDL_PIXELFORMAT_ARGB8888,
+                                         SDL_TEXTUREACCESS_TARGET, rw, rh, MemoryStats::SELECTION_TEXTURE);
     if (!selectionTexture) {
         isDrawing = false;
         return false;
     }
     SDL_SetTextureBlendMode(selectionTexture, SDL_BLENDMODE_BLEND);
 
-    std::vector<uint32_t> pixels(rw * rh);
+    std::vector<uint32_t> pixels(static_cast<size_t>(rw) * rh);
     SDL_Rect readRect = { rx, ry, rw, rh };
-    SDL_RenderReadPixels(r, &readRect, SDL_PIXELFORMAT_ARGB8888, pixels.data(), rw * 4);
+    DrawingUtils::readPixels(r, &readRect, pixels.data(), rw * 4);
     SDL_UpdateTexture(selectionTexture, nullptr, pixels.data(), rw * 4);
 
     SDL_SetRenderDrawColor(r, 0, 0, 0, 0);
     SDL_SetRenderDrawBlendMode(r, SDL_BLENDMODE_NONE);
-    SDL_RenderFillRect(r, &readRect);
+    DrawingUtils::renderFillRect(r, &readRect);
     SDL_SetRenderDrawBlendMode(r, SDL_BLENDMODE_BLEND);
 
     currentBounds = { rx, ry, rw, rh };
@@ -261,7 +263,7 @@ void SelectTool::deactivate(SDL_Renderer* r) {
                     rotatePt(px, py, drawCenterX, drawCenterY, getRotation(), outX, outY);
                     int ix = (int)std::round(outX), iy = (int)std::round(outY);
                     if (ix >= 0 && ix < cw && iy >= 0 && iy < ch)
-                        SDL_RenderDrawPoint(r, ix, iy);
+                        DrawingUtils::renderPoint(r, ix, iy);
                 }
             }
             SDL_SetRenderDrawBlendMode(r, SDL_BLENDMODE_BLEND);
@@ -269,16 +271,17 @@ void SelectTool::deactivate(SDL_Renderer* r) {
             for (size_t i = 0; i < pixels.size(); i++) {
                 if (pixels[i] == TRANSPARENT_FILL_PREVIEW_ARGB) pixels[i] = 0;
             }
-            SDL_Texture* tmp = SDL_CreateTexture(r, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, w, h);
+            SDL_Texture* tmp = MemoryStats::createTexture(r, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+                                                          w, h, MemoryStats::SELECTION_TEXTURE);
             if (tmp) {
                 SDL_SetTextureBlendMode(tmp, SDL_BLENDMODE_BLEND);
                 SDL_UpdateTexture(tmp, nullptr, pixels.data(), w * 4);
-                SDL_DestroyTexture(selectionTexture);
+                MemoryStats::destroyTexture(selectionTexture);
                 selectionTexture = tmp;
             }
         }
         renderWithTransform(r, currentBounds);
-        SDL_DestroyTexture(selectionTexture);
+        MemoryStats::destroyTexture(selectionTexture);
         selectionTexture = nullptr;
     }
     active = false;
@@ -289,7 +292,7 @@ bool SelectTool::isHit(int cX, int cY) const {
 }
 
 void SelectTool::activateWithTexture(SDL_Texture* tex, SDL_Rect area) {
-    if (selectionTexture) SDL_DestroyTexture(selectionTexture);
+    MemoryStats::destroyTexture(selectionTexture);
     selectionTexture = tex;
     currentBounds = area;
     rotation = 0.f;
@@ -312,20 +315,20 @@ void SelectTool::commitRectSelection(SDL_Renderer* r, int canvasW, int canvasH,
     int rw = rx2 - rx, rh = ry2 - ry;
     if (rw <= 0 || rh <= 0) return;
 
-    if (selectionTexture) SDL_DestroyTexture(selectionTexture);
-    selectionTexture = SDL_CreateTexture(r, SDL_PIXELFORMAT_ARGB8888,
-                                         SDL_TEXTUREACCESS_TARGET, rw, rh);
+    MemoryStats::destroyTexture(selectionTexture);
+    selectionTexture = MemoryStats::createTexture(r, SDL_PIXELFORMAT_ARGB8888,
+                                         SDL_TEXTUREACCESS_TARGET, rw, rh, MemoryStats::SELECTION_TEXTURE);
     if (!selectionTexture) return;
     SDL_SetTextureBlendMode(selectionTexture, SDL_BLENDMODE_BLEND);
 
     std::vector<uint32_t> pixels(static_cast<size_t>(rw) * rh);
     SDL_Rect readRect = { rx, ry, rw, rh };
-    SDL_RenderReadPixels(r, &readRect, SDL_PIXELFORMAT_ARGB8888, pixels.data(), rw * 4);
+    DrawingUtils::readPixels(r, &readRect, pixels.data(), rw * 4);
     SDL_UpdateTexture(selectionTexture, nullptr, pixels.data(), rw * 4);
 
     SDL_SetRenderDrawColor(r, 0, 0, 0, 0);
     SDL_SetRenderDrawBlendMode(r, SDL_BLENDMODE_NONE);
-    SDL_RenderFillRect(r, &readRect);
+    DrawingUtils::renderFillRect(r, &readRect);
     SDL_SetRenderDrawBlendMode(r, SDL_BLENDMODE_BLEND);
 
     currentBounds = { rx, ry, rw, rh };
@@ -346,9 +349,9 @@ std::vector<uint32_t> SelectTool::getFloatingPixels(SDL_Renderer* r) const {
         return {};
     int w = currentBounds.w, h = currentBounds.h;
 
-    std::vector<uint32_t> pixels(w * h, 0);
-    SDL_Texture* tmp = SDL_CreateTexture(r, SDL_PIXELFORMAT_ARGB8888,
-                                          SDL_TEXTUREACCESS_TARGET, w, h);
+    std::vector<uint32_t> pixels(static_cast<size_t>(w) * h, 0);
+    SDL_Texture* tmp = MemoryStats::createTexture(r, SDL_PIXELFORMAT_ARGB8888,
+                                          SDL_TEXTUREACCESS_TARGET, w, h, MemoryStats::TEMP_TEXTURE);
     if (!tmp) return pixels;
     SDL_Texture* prev = SDL_GetRenderTarget(r);
     SDL_SetRenderTarget(r, tmp);
@@ -358,7 +361,7 @@ std::vector<uint32_t> SelectTool::getFloatingPixels(SDL_Renderer* r) const {
     renderWithTransform(r, dst);
     SDL_RenderReadPixels(r, nullptr, SDL_PIXELFORMAT_ARGB8888, pixels.data(), w * 4);
     SDL_SetRenderTarget(r, prev);
-    SDL_DestroyTexture(tmp);
+    MemoryStats::destroyTexture(tmp);
     if (fillColorIsTransparent_) {
         for (size_t i = 0; i < pixels.size(); i++) {
             if (pixels[i] == TRANSPARENT_FILL_PREVIEW_ARGB) pixels[i] = 0;
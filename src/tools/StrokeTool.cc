@@ -2,21 +2,76 @@
 
 void StrokeTool::onMouseDown(int cX, int cY, SDL_Renderer* r, int brushSize, SDL_Color color) {
     AbstractTool::onMouseDown(cX, cY, r, brushSize, color);
+    command = std::make_unique<StrokeCommand>();
+    command->eraser    = eraser;
+    command->square    = squareBrush;
+    command->brushSize = brushSize;
+    command->color     = color;
+    command->points.push_back({ cX, cY });
     if (isPointOnCanvas(mapper, cX, cY)) {
         int cw, ch;
         mapper->getCanvasSize(&cw, &ch);
         stampAt(r, cX, cY, brushSize, cw, ch, color);
+        markDirty(DrawingUtils::strokeBounds(cX, cY, cX, cY, brushSize, cw, ch));
     }
 }
 
 void StrokeTool::onMouseMove(int cX, int cY, SDL_Renderer* r, int brushSize, SDL_Color color) {
     if (isDrawing) {
+        if (command) {
+            const SDL_Color& c = command->color;
+            if (brushSize != command->brushSize || color.r != c.r || color.g != c.g || color.b != c.b || color.a != c.a)
+                command.reset();
+            else
+                command->points.push_back({ cX, cY });
+        }
         if (isPointOnCanvas(mapper, cX, cY) || isPointOnCanvas(mapper, lastX, lastY)) {
             int cw, ch;
             mapper->getCanvasSize(&cw, &ch);
             drawSegment(r, lastX, lastY, cX, cY, brushSize, cw, ch, color);
+            markDirty(DrawingUtils::strokeBounds(lastX, lastY, cX, cY, brushSize, cw, ch));
         }
         lastX = cX;
         lastY = cY;
     }
 }
+
+std::unique_ptr<UndoCommand> StrokeTool::takeCommand() {
+    if (isDrawing) return nullptr;
+    return std::move(command);
+}
+
+namespace {
+
+// Canvas coordinates are window coordinates; only the canvas size matters
+// to the stroke tools.
+class ReplayMapper : public ICoordinateMapper {
+  public:
+    int w, h;
+    ReplayMapper(int cw, int ch) : w(cw), h(ch) {}
+    void getCanvasCoords(int winX, int winY, int* cX, int* cY) override { *cX = winX; *cY = winY; }
+    void getWindowCoords(int canX, int canY, int* wX, int* wY) override { *wX = canX; *wY = canY; }
+    int  getWindowSize(int canSize) override { return canSize; }
+    void getCanvasSize(int* cw, int* ch) override { *cw = w; *ch = h; }
+};
+
+} // namespace
+
+void StrokeCommand::apply(uint32_t* pixels, int w, int h) const {
+    if (points.empty()) return;
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormatFrom(pixels, w, h, 32, w * 4, SDL_PIXELFORMAT_ARGB8888);
+    SDL_Renderer* r = surface ? SDL_CreateSoftwareRenderer(surface) : nullptr;
+    if (r) {
+        ReplayMapper mapper(w, h);
+        std::unique_ptr<StrokeTool> tool;
+        if (eraser) tool = std::make_unique<EraserTool>(&mapper, square);
+        else        tool = std::make_unique<BrushTool>(&mapper, square);
+        tool->onMouseDown(points[0].x, points[0].y, r, brushSize, color);
+        for (size_t i = 1; i < points.size(); i++)
+            tool->onMouseMove(points[i].x, points[i].y, r, brushSize, color);
+        tool->onMouseUp(points.back().x, points.back().y, r, brushSize, color);
+        SDL_RenderFlush(r);
+        SDL_DestroyRenderer(r);
+    }
+    if (surface) SDL_FreeSurface(surface);
+}
@@ -389,6 +389,12 @@ void TransformTool::nudge(int dx, int dy) {
     syncDrawCenterFromBounds();
 }
 
+// Same result as dragging the rotate handle by that angle about the box centre.
+void TransformTool::rotateBy(float radians) {
+    rotation += radians;
+    moved = true;
+}
+
 void TransformTool::drawHandles(SDL_Renderer* winRenderer) const {
     SDL_Point wpts[4];
     getBoxWindowCorners(wpts);